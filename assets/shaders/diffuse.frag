@@ -2,7 +2,18 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
 
-layout (binding = 1) uniform sampler2D albedo;
+//Must match MAX_TEXTURES in vulkan.hh
+#define MAX_TEXTURES 64
+
+//Without dynamic indexing, the bound set holds the draw's texture alone
+layout (constant_id = 0) const bool TEXTURE_TABLE = true;
+layout (constant_id = 1) const uint TEXTURE_SLOTS = MAX_TEXTURES;
+
+layout (set = 1, binding = 0) uniform sampler2D textures[TEXTURE_SLOTS];
+
+layout (push_constant) uniform _draw {
+	uint texture_index;
+} draw;
 
 layout (location = 0) in vec4 in_color;
 layout (location = 1) in vec3 in_normal;
@@ -17,7 +28,11 @@ void main() {
 	vec2 uv = in_uv;
 	uv.y = 1.0 - in_uv.y;
 
-	vec3 diffuse = texture(albedo, uv).rgb;
+	vec3 diffuse;
+	if (TEXTURE_TABLE)
+		diffuse = texture(textures[draw.texture_index], uv).rgb;
+	else
+		diffuse = texture(textures[0], uv).rgb;
 	float light_intensity = clamp(dot(in_normal.xyz, light_direction), 0.2, 1.0);
 
 	out_color.a = 1.0;
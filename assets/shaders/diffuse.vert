@@ -2,7 +2,7 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
 
-layout (std140, binding = 0) uniform _matrices {
+layout (std140, set = 0, binding = 0) uniform _matrices {
         mat4 clip;
         mat4 model;
         mat4 view;
@@ -12,6 +12,8 @@ layout (std140, binding = 0) uniform _matrices {
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 uv;
+//Per instance, locations 3 to 6
+layout (location = 3) in mat4 instance;
 
 layout (location = 0) out vec4 out_color;
 layout (location = 1) out vec3 out_normal;
@@ -23,10 +25,12 @@ out gl_PerVertex {
 
 void main() 
 {
-	mat4 MVP = udata.clip * udata.projection * udata.view * udata.model;
+	//The scene rotation applies first: each copy spins in place on the grid
+	mat4 model = instance * udata.model;
+	mat4 MVP = udata.clip * udata.projection * udata.view * model;
 
 	out_color = vec4(1.0, 1.0, 1.0, 1.0);
 	out_uv = uv;
-	out_normal = (udata.model * normal.xyzz).xyz;
+	out_normal = (model * normal.xyzz).xyz;
 	gl_Position = MVP * vec4(position, 1.0);
 }
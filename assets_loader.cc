@@ -1,6 +1,23 @@
+#include <unordered_map>
+
 #include "tiny_obj_loader.hh"
 #include "assets_loader.hh"
 
+//An OBJ corner is a position, normal and texcoord triple: equal triples share a vertex
+struct corner_hash_t {
+	size_t operator()(const tinyobj::index_t &idx) const {
+		return ((size_t)idx.vertex_index * 73856093) ^ ((size_t)idx.normal_index * 19349663)
+			^ ((size_t)idx.texcoord_index * 83492791);
+	}
+};
+
+struct corner_equal_t {
+	bool operator()(const tinyobj::index_t &a, const tinyobj::index_t &b) const {
+		return a.vertex_index == b.vertex_index && a.normal_index == b.normal_index
+			&& a.texcoord_index == b.texcoord_index;
+	}
+};
+
 bool load_model(const char* path, model_t *model) {
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
@@ -12,9 +29,17 @@ bool load_model(const char* path, model_t *model) {
 		return false;
 	
 	std::vector<vertex_t> vertices;
-	
+	std::vector<uint32_t> indices;
+	std::unordered_map<tinyobj::index_t, uint32_t, corner_hash_t, corner_equal_t> corners;
+
 	for (tinyobj::shape_t& s : shapes) {
 		for (tinyobj::index_t& idx : s.mesh.indices) {
+			auto found = corners.find(idx);
+			if (found != corners.end()) {
+				indices.push_back(found->second);
+				continue;
+			}
+
 			vertex_t v;
 			v.pos = {
 				attrib.vertices[3 * idx.vertex_index + 0],
@@ -40,11 +65,13 @@ bool load_model(const char* path, model_t *model) {
 			} else {
 				v.uv = { 0, 0 };
 			}
+			corners.emplace(idx, vertices.size());
+			indices.push_back(vertices.size());
 			vertices.push_back(v);
 		}
 	}
 
-	printf("[INFO] Loading model %s [%zu vertices]\n", path, vertices.size());
+	printf("[INFO] Loading model %s [%zu vertices, %zu indices]\n", path, vertices.size(), indices.size());
 
 	model->count = vertices.size();
 
@@ -55,5 +82,17 @@ bool load_model(const char* path, model_t *model) {
 	for (uint64_t i = 0; i < model->count; i++)
 		model->vertices[i] = vertices[i];
 
+	model->index_count = indices.size();
+	model->indices = new uint32_t[model->index_count];
+	std::copy(indices.begin(), indices.end(), model->indices);
+
 	return true;
 }
+
+//Once uploaded, the GPU buffers hold the only copy needed
+void free_model(model_t *model) {
+	delete[] model->vertices;
+	delete[] model->indices;
+	model->vertices = NULL;
+	model->indices = NULL;
+}
@@ -4,3 +4,4 @@
 #include "types.hh"
 
 bool load_model(const char *path, model_t *model);
+void free_model(model_t *model);
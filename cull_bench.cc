@@ -0,0 +1,134 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "culling.hh"
+
+/*
+ * Frustum culling throughput, scalar against AVX2, from 1 to N workers.
+ * Objects are spheres (or boxes with -b) spread in a cube the camera sits
+ * in front of, partly outside the frustum. Speedups are against the scalar
+ * kernel on one worker, every run must find its visible list.
+ *   usage: cull_bench [-c objects] [-n iterations] [-t max_workers] [-b]
+ */
+
+#define BENCH_OBJECTS (1u << 20)
+#define BENCH_SPACE (1000.0f)
+
+static float bench_random(uint32_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return (*state & 0xFFFFFF) / (float)0x1000000;
+}
+
+static void bench_fill(cull_bounds_t *bounds, bool boxes) {
+	uint32_t state = 0x9E3779B9;
+	for (uint32_t i = 0; i < bounds->count; i++) {
+		glm::vec3 center = glm::vec3(bench_random(&state), bench_random(&state), bench_random(&state));
+		center = (center - 0.5f) * BENCH_SPACE;
+		if (boxes) {
+			glm::vec3 extent = glm::vec3(bench_random(&state), bench_random(&state), bench_random(&state));
+			cull_bounds_set_box(bounds, i, center, extent * 2.0f + 0.1f);
+		}
+		else
+			cull_bounds_set_sphere(bounds, i, center, bench_random(&state) * 2.0f + 0.1f);
+	}
+}
+
+static double bench_cull(job_system_t *jobs, const cull_frustum_t *frustum, const cull_bounds_t *bounds,
+												 cull_result_t *result, uint32_t iterations) {
+	//Warm up the workers and the caches before timing
+	cull_frustum(jobs, frustum, bounds, result);
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < iterations; i++)
+		cull_frustum(jobs, frustum, bounds, result);
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / iterations;
+}
+
+int main(int argc, char **argv) {
+	uint32_t count = BENCH_OBJECTS;
+	uint32_t iterations = 20;
+	uint32_t max_workers = std::thread::hardware_concurrency();
+	bool boxes = false;
+
+	for (int32_t i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			count = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			iterations = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			max_workers = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-b") == 0)
+			boxes = true;
+		else
+			iterations = 0;
+	}
+	if (count == 0 || iterations == 0 || max_workers == 0) {
+		fprintf(stderr, "usage: %s [-c objects] [-n iterations] [-t max_workers] [-b]\n", argv[0]);
+		return 1;
+	}
+	max_workers = std::min(max_workers, (uint32_t)JOB_MAX_WORKERS);
+
+	cull_bounds_t bounds;
+	cull_bounds_create(&bounds, count, boxes);
+	bench_fill(&bounds, boxes);
+	cull_result_t result;
+	cull_result_create(&result, count);
+	cull_result_t reference;
+	cull_result_create(&reference, count);
+
+	//Same clip space as the viewer
+	scene_info_t scene = { };
+	scene.clip = glm::mat4(
+		1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, -1.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, 0.5f, 0.0f,
+		0.0f, 0.0f, 0.5f, 1.0f
+	);
+	scene.view = glm::lookAt(glm::vec3(0, 0, BENCH_SPACE), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+	scene.projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, BENCH_SPACE * 2.0f);
+	cull_frustum_t frustum;
+	cull_frustum_from_scene(&scene, &frustum);
+
+	printf("%u %s, %u iterations\n", count, boxes ? "boxes" : "spheres", iterations);
+	printf("%8s %8s %10s %8s %10s\n", "kernel", "workers", "ms", "speedup", "visible");
+	double base = 0.0;
+	for (uint32_t k = CULL_KERNEL_SCALAR; k < CULL_KERNEL_COUNT; k++) {
+		cull_kernel_e kernel = (cull_kernel_e)k;
+		if (!cull_select_kernel(kernel)) {
+			printf("%8s unsupported\n", cull_kernel_name(kernel));
+			continue;
+		}
+
+		for (uint32_t workers = 1; workers <= max_workers; workers++) {
+			job_system_t jobs;
+			job_system_create(&jobs, workers);
+			double ms = bench_cull(&jobs, &frustum, &bounds, &result, iterations);
+			job_system_destroy(&jobs);
+			if (kernel == CULL_KERNEL_SCALAR && workers == 1) {
+				base = ms;
+				reference.count = result.count;
+				memcpy(reference.visible, result.visible, result.count * sizeof(uint32_t));
+			}
+			printf("%8s %8u %10.3f %8.2f %10u\n", cull_kernel_name(kernel), workers, ms,
+						 base / ms, result.count);
+
+			if (result.count != reference.count
+					|| memcmp(result.visible, reference.visible, result.count * sizeof(uint32_t)) != 0) {
+				fprintf(stderr, "%s: visible list differs from the scalar one\n", cull_kernel_name(kernel));
+				return 1;
+			}
+		}
+	}
+
+	cull_result_destroy(&reference);
+	cull_result_destroy(&result);
+	cull_bounds_destroy(&bounds);
+	return 0;
+}
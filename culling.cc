@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CULL_HAS_AVX2 1
+#else
+#define CULL_HAS_AVX2 0
+#endif
+
+#include "culling.hh"
+
+#define CULL_ALIGNMENT (32)
+
+//Kernels write the indices of the visible objects of [first, last) in out, and count them
+typedef uint32_t (*cull_kernel_f)(const cull_frustum_t *frustum, const cull_bounds_t *bounds,
+																	uint32_t first, uint32_t last, uint32_t *out);
+
+static cull_kernel_e cull_kernel = CULL_KERNEL_AUTO;
+
+/*
+ * For each 8 bit visibility mask, the lanes to keep packed at the front, a
+ * byte each. Widened to 32 bits, they permute the object indices in place.
+ */
+struct cull_lane_table_t {
+	uint64_t lanes[1 << CULL_SIMD_WIDTH];
+};
+
+static constexpr cull_lane_table_t cull_build_lane_table(void) {
+	cull_lane_table_t table = { };
+	for (uint32_t mask = 0; mask < (1u << CULL_SIMD_WIDTH); mask++) {
+		uint32_t packed = 0;
+		for (uint32_t lane = 0; lane < CULL_SIMD_WIDTH; lane++) {
+			if (mask & (1u << lane))
+				table.lanes[mask] |= (uint64_t)lane << (8 * packed++);
+		}
+	}
+	return table;
+}
+
+static constexpr cull_lane_table_t cull_lane_table = cull_build_lane_table();
+
+//Zeroed past the count, the kernels may read a whole vector
+static float* cull_array_create(uint32_t count) {
+	size_t size = (count * sizeof(float) + CULL_ALIGNMENT - 1) / CULL_ALIGNMENT * CULL_ALIGNMENT;
+	float *array = (float*)aligned_alloc(CULL_ALIGNMENT, std::max(size, (size_t)CULL_ALIGNMENT));
+	assert(array != NULL);
+	memset(array, 0, size);
+	return array;
+}
+
+void cull_bounds_create(cull_bounds_t *bounds, uint32_t count, bool boxes) {
+	bounds->count = count;
+	bounds->center_x = cull_array_create(count);
+	bounds->center_y = cull_array_create(count);
+	bounds->center_z = cull_array_create(count);
+	bounds->radius = cull_array_create(count);
+	bounds->extent_x = boxes ? cull_array_create(count) : NULL;
+	bounds->extent_y = boxes ? cull_array_create(count) : NULL;
+	bounds->extent_z = boxes ? cull_array_create(count) : NULL;
+}
+
+void cull_bounds_destroy(cull_bounds_t *bounds) {
+	free(bounds->center_x);
+	free(bounds->center_y);
+	free(bounds->center_z);
+	free(bounds->radius);
+	free(bounds->extent_x);
+	free(bounds->extent_y);
+	free(bounds->extent_z);
+	*bounds = { };
+}
+
+void cull_bounds_set_sphere(cull_bounds_t *bounds, uint32_t index, glm::vec3 center, float radius) {
+	assert(index < bounds->count);
+	bounds->center_x[index] = center.x;
+	bounds->center_y[index] = center.y;
+	bounds->center_z[index] = center.z;
+	bounds->radius[index] = radius;
+}
+
+//The sphere is kept around the box: both stay conservative
+void cull_bounds_set_box(cull_bounds_t *bounds, uint32_t index, glm::vec3 center, glm::vec3 extent) {
+	assert(bounds->extent_x != NULL && "Bounds created without boxes");
+	cull_bounds_set_sphere(bounds, index, center, glm::length(extent));
+	bounds->extent_x[index] = extent.x;
+	bounds->extent_y[index] = extent.y;
+	bounds->extent_z[index] = extent.z;
+}
+
+void cull_result_create(cull_result_t *result, uint32_t capacity) {
+	result->count = 0;
+	result->capacity = capacity;
+	result->visible = new uint32_t[std::max(capacity, 1u)];
+	result->scratch = new uint32_t[std::max(capacity, 1u)];
+	result->batch_counts.resize((capacity + CULL_BATCH - 1) / CULL_BATCH);
+	result->batch_offsets.resize(result->batch_counts.size());
+}
+
+void cull_result_destroy(cull_result_t *result) {
+	delete[] result->visible;
+	delete[] result->scratch;
+	result->visible = NULL;
+	result->scratch = NULL;
+	result->capacity = 0;
+	result->count = 0;
+}
+
+/*
+ * Planes are rows combinations of the matrix (Gribb & Hartmann). Depth is
+ * clipped to [0, w] as in Vulkan, so the near plane is the third row alone.
+ */
+void cull_frustum_extract(const glm::mat4 &view_projection, cull_frustum_t *frustum) {
+	glm::mat4 m = glm::transpose(view_projection);
+	frustum->planes[0] = m[3] + m[0];
+	frustum->planes[1] = m[3] - m[0];
+	frustum->planes[2] = m[3] + m[1];
+	frustum->planes[3] = m[3] - m[1];
+	frustum->planes[4] = m[2];
+	frustum->planes[5] = m[3] - m[2];
+
+	for (uint32_t i = 0; i < CULL_PLANE_COUNT; i++)
+		frustum->planes[i] /= glm::length(glm::vec3(frustum->planes[i]));
+}
+
+//Bounds are in world space: the scene model matrix applies under the instance transform
+void cull_frustum_from_scene(const scene_info_t *scene, cull_frustum_t *frustum) {
+	cull_frustum_extract(scene->clip * scene->projection * scene->view, frustum);
+}
+
+//Outside a plane when the center is further behind it than the volume reaches
+template<bool boxes>
+static uint32_t cull_range_scalar(const cull_frustum_t *frustum, const cull_bounds_t *bounds,
+																	uint32_t first, uint32_t last, uint32_t *out) {
+	uint32_t count = 0;
+	for (uint32_t i = first; i < last; i++) {
+		bool inside = true;
+		for (uint32_t p = 0; p < CULL_PLANE_COUNT && inside; p++) {
+			const glm::vec4 &plane = frustum->planes[p];
+			float distance = plane.x * bounds->center_x[i] + plane.y * bounds->center_y[i]
+				+ plane.z * bounds->center_z[i] + plane.w;
+			float reach = bounds->radius[i];
+			if constexpr (boxes) {
+				float box = fabsf(plane.x) * bounds->extent_x[i] + fabsf(plane.y) * bounds->extent_y[i]
+					+ fabsf(plane.z) * bounds->extent_z[i];
+				reach = std::min(reach, box);
+			}
+			inside = distance + reach > 0.0f;
+		}
+		out[count] = i;
+		count += inside;
+	}
+	return count;
+}
+
+#if CULL_HAS_AVX2
+/*
+ * Eight objects per iteration, all six planes tested without branching.
+ * Visible indices are packed with a permutation and stored as a whole
+ * vector: the count never exceeds the objects read, so the store stays in
+ * the batch's part of the output.
+ */
+template<bool boxes>
+__attribute__((target("avx2,popcnt")))
+static uint32_t cull_range_avx2(const cull_frustum_t *frustum, const cull_bounds_t *bounds,
+																uint32_t first, uint32_t last, uint32_t *out) {
+	__m256 plane_x[CULL_PLANE_COUNT], plane_y[CULL_PLANE_COUNT], plane_z[CULL_PLANE_COUNT];
+	__m256 plane_w[CULL_PLANE_COUNT];
+	__m256 abs_x[CULL_PLANE_COUNT], abs_y[CULL_PLANE_COUNT], abs_z[CULL_PLANE_COUNT];
+	for (uint32_t p = 0; p < CULL_PLANE_COUNT; p++) {
+		const glm::vec4 &plane = frustum->planes[p];
+		plane_x[p] = _mm256_set1_ps(plane.x);
+		plane_y[p] = _mm256_set1_ps(plane.y);
+		plane_z[p] = _mm256_set1_ps(plane.z);
+		plane_w[p] = _mm256_set1_ps(plane.w);
+		abs_x[p] = _mm256_set1_ps(fabsf(plane.x));
+		abs_y[p] = _mm256_set1_ps(fabsf(plane.y));
+		abs_z[p] = _mm256_set1_ps(fabsf(plane.z));
+	}
+	const __m256 zero = _mm256_setzero_ps();
+
+	uint32_t count = 0;
+	uint32_t i = first;
+	for (; i + CULL_SIMD_WIDTH <= last; i += CULL_SIMD_WIDTH) {
+		__m256 cx = _mm256_loadu_ps(bounds->center_x + i);
+		__m256 cy = _mm256_loadu_ps(bounds->center_y + i);
+		__m256 cz = _mm256_loadu_ps(bounds->center_z + i);
+		__m256 radius = _mm256_loadu_ps(bounds->radius + i);
+		__m256 ex, ey, ez;
+		if constexpr (boxes) {
+			ex = _mm256_loadu_ps(bounds->extent_x + i);
+			ey = _mm256_loadu_ps(bounds->extent_y + i);
+			ez = _mm256_loadu_ps(bounds->extent_z + i);
+		}
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (uint32_t p = 0; p < CULL_PLANE_COUNT; p++) {
+			//Summed in the scalar order, both kernels must agree on the edge cases
+			__m256 distance = _mm256_add_ps(_mm256_mul_ps(plane_x[p], cx), _mm256_mul_ps(plane_y[p], cy));
+			distance = _mm256_add_ps(_mm256_add_ps(distance, _mm256_mul_ps(plane_z[p], cz)), plane_w[p]);
+			__m256 reach = radius;
+			if constexpr (boxes) {
+				__m256 box = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(abs_x[p], ex), _mm256_mul_ps(abs_y[p], ey)),
+																	 _mm256_mul_ps(abs_z[p], ez));
+				reach = _mm256_min_ps(reach, box);
+			}
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), zero, _CMP_GT_OQ));
+		}
+
+		uint32_t mask = _mm256_movemask_ps(inside);
+		__m256i lanes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&cull_lane_table.lanes[mask]));
+		__m256i indices = _mm256_add_epi32(_mm256_set1_epi32(i), lanes);
+		_mm256_storeu_si256((__m256i*)(out + count), indices);
+		count += _mm_popcnt_u32(mask);
+	}
+
+	return count + cull_range_scalar<boxes>(frustum, bounds, i, last, out + count);
+}
+#endif
+
+bool cull_kernel_supported(cull_kernel_e kernel) {
+	switch (kernel) {
+		case CULL_KERNEL_AUTO:
+		case CULL_KERNEL_SCALAR:
+			return true;
+		case CULL_KERNEL_AVX2:
+#if CULL_HAS_AVX2
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#else
+			return false;
+#endif
+		default:
+			return false;
+	}
+}
+
+//Forces a kernel, false when the CPU lacks it
+bool cull_select_kernel(cull_kernel_e kernel) {
+	if (!cull_kernel_supported(kernel))
+		return false;
+	cull_kernel = kernel;
+	return true;
+}
+
+const char* cull_kernel_name(cull_kernel_e kernel) {
+	static const char *names[CULL_KERNEL_COUNT] = { "auto", "scalar", "avx2" };
+	assert(kernel < CULL_KERNEL_COUNT);
+	return names[kernel];
+}
+
+static cull_kernel_f cull_kernel_function(cull_kernel_e kernel, bool boxes) {
+	if (kernel == CULL_KERNEL_AUTO)
+		kernel = cull_kernel_supported(CULL_KERNEL_AVX2) ? CULL_KERNEL_AVX2 : CULL_KERNEL_SCALAR;
+#if CULL_HAS_AVX2
+	if (kernel == CULL_KERNEL_AVX2)
+		return boxes ? cull_range_avx2<true> : cull_range_avx2<false>;
+#endif
+	return boxes ? cull_range_scalar<true> : cull_range_scalar<false>;
+}
+
+struct cull_job_t {
+	const cull_frustum_t *frustum;
+	const cull_bounds_t *bounds;
+	cull_result_t *result;
+	cull_kernel_f kernel;
+};
+
+//Ranges start on a batch, but may span several when run inline
+static void cull_test_range(void *data, uint32_t first, uint32_t last) {
+	cull_job_t *job = (cull_job_t*)data;
+	for (uint32_t start = first; start < last; start += CULL_BATCH) {
+		uint32_t end = std::min(start + CULL_BATCH, last);
+		job->result->batch_counts[start / CULL_BATCH] = job->kernel(job->frustum, job->bounds, start, end,
+																																job->result->scratch + start);
+	}
+}
+
+static void cull_pack_range(void *data, uint32_t first, uint32_t last) {
+	cull_result_t *result = (cull_result_t*)data;
+	for (uint32_t batch = first; batch < last; batch++) {
+		memcpy(result->visible + result->batch_offsets[batch], result->scratch + batch * CULL_BATCH,
+					 result->batch_counts[batch] * sizeof(uint32_t));
+	}
+}
+
+/*
+ * Tests every object against the frustum over the job system, then packs
+ * the batches' visible indices. Returns how many are visible.
+ */
+uint32_t cull_frustum(job_system_t *jobs, const cull_frustum_t *frustum, const cull_bounds_t *bounds,
+											cull_result_t *result) {
+	assert(bounds->count <= result->capacity);
+	cull_job_t job = { frustum, bounds, result, cull_kernel_function(cull_kernel, bounds->extent_x != NULL) };
+	job_parallel_for(jobs, bounds->count, CULL_BATCH, cull_test_range, &job);
+
+	uint32_t batch_count = (bounds->count + CULL_BATCH - 1) / CULL_BATCH;
+	result->count = 0;
+	for (uint32_t batch = 0; batch < batch_count; batch++) {
+		result->batch_offsets[batch] = result->count;
+		result->count += result->batch_counts[batch];
+	}
+
+	//A single batch is already packed
+	if (batch_count == 1)
+		std::swap(result->visible, result->scratch);
+	else
+		job_parallel_for(jobs, batch_count, 1, cull_pack_range, result);
+	return result->count;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "job_system.hh"
+#include "types.hh"
+
+#define CULL_PLANE_COUNT (6)
+//Objects per job, a multiple of the SIMD width
+#define CULL_BATCH (8192)
+#define CULL_SIMD_WIDTH (8)
+
+enum cull_kernel_e {
+	//Widest kernel the CPU runs
+	CULL_KERNEL_AUTO = 0,
+	CULL_KERNEL_SCALAR,
+	CULL_KERNEL_AVX2,
+	CULL_KERNEL_COUNT
+};
+
+//Normalized planes, facing inward: xyz is the normal, w the distance
+struct cull_frustum_t {
+	glm::vec4 planes[CULL_PLANE_COUNT];
+};
+
+/*
+ * Bounding volumes as arrays of components, the kernels load eight of each
+ * at once. Boxes are axis aligned, centered on the sphere: an object is
+ * culled when either of its volumes is outside a plane. Without boxes only
+ * the spheres are read.
+ */
+struct cull_bounds_t {
+	uint32_t count;
+	float *center_x;
+	float *center_y;
+	float *center_z;
+	float *radius;
+	//Box half sizes, null when the spheres only are tested
+	float *extent_x;
+	float *extent_y;
+	float *extent_z;
+};
+
+/*
+ * Indices of the visible objects, in increasing order. Batches first fill
+ * their own part of the scratch array, then are packed in visible.
+ */
+struct cull_result_t {
+	uint32_t count;
+	uint32_t capacity;
+	uint32_t *visible;
+	uint32_t *scratch;
+	std::vector<uint32_t> batch_counts;
+	std::vector<uint32_t> batch_offsets;
+};
+
+void cull_bounds_create(cull_bounds_t *bounds, uint32_t count, bool boxes);
+void cull_bounds_destroy(cull_bounds_t *bounds);
+void cull_bounds_set_sphere(cull_bounds_t *bounds, uint32_t index, glm::vec3 center, float radius);
+void cull_bounds_set_box(cull_bounds_t *bounds, uint32_t index, glm::vec3 center, glm::vec3 extent);
+
+void cull_result_create(cull_result_t *result, uint32_t capacity);
+void cull_result_destroy(cull_result_t *result);
+
+void cull_frustum_extract(const glm::mat4 &view_projection, cull_frustum_t *frustum);
+void cull_frustum_from_scene(const scene_info_t *scene, cull_frustum_t *frustum);
+
+bool cull_kernel_supported(cull_kernel_e kernel);
+bool cull_select_kernel(cull_kernel_e kernel);
+const char* cull_kernel_name(cull_kernel_e kernel);
+
+uint32_t cull_frustum(job_system_t *jobs, const cull_frustum_t *frustum, const cull_bounds_t *bounds,
+											cull_result_t *result);
@@ -0,0 +1,85 @@
+#include "deferred.hh"
+#include "vulkan.hh"
+
+static void deferred_push(vulkan_info_t *info, const deferred_object_t *object) {
+	info->deferred.objects.push_back(*object);
+}
+
+static void deferred_destroy(vulkan_info_t *info, deferred_object_t *object) {
+	if (object->view != VK_NULL_HANDLE)
+		vkDestroyImageView(info->device, object->view, NULL);
+	if (object->image != VK_NULL_HANDLE)
+		vkDestroyImage(info->device, object->image, NULL);
+	if (object->buffer != VK_NULL_HANDLE)
+		vkDestroyBuffer(info->device, object->buffer, NULL);
+	memory_free(info, &object->allocation);
+	if (object->command != VK_NULL_HANDLE)
+		vkFreeCommandBuffers(info->device, object->pool, 1, &object->command);
+	if (object->semaphore != VK_NULL_HANDLE)
+		vkDestroySemaphore(info->device, object->semaphore, NULL);
+}
+
+//The allocation may be null, for a view alone
+void deferred_destroy_image(vulkan_info_t *info, VkImage image, VkImageView view,
+														const gpu_allocation_t *allocation, uint64_t value) {
+	deferred_object_t object = { };
+	object.value = value;
+	object.image = image;
+	object.view = view;
+	if (allocation != NULL)
+		object.allocation = *allocation;
+	deferred_push(info, &object);
+}
+
+void deferred_destroy_buffer(vulkan_info_t *info, const data_buffer_t *buffer, uint64_t value) {
+	deferred_object_t object = { };
+	object.value = value;
+	object.buffer = buffer->buffer;
+	object.allocation = buffer->allocation;
+	deferred_push(info, &object);
+}
+
+void deferred_free_command(vulkan_info_t *info, VkCommandPool pool, VkCommandBuffer command,
+													 uint64_t value) {
+	deferred_object_t object = { };
+	object.value = value;
+	object.pool = pool;
+	object.command = command;
+	deferred_push(info, &object);
+}
+
+void deferred_destroy_semaphore(vulkan_info_t *info, VkSemaphore semaphore, uint64_t value) {
+	deferred_object_t object = { };
+	object.value = value;
+	object.semaphore = semaphore;
+	deferred_push(info, &object);
+}
+
+//Called with the value of the frame just submitted
+void deferred_seal(vulkan_info_t *info, uint64_t value) {
+	for (deferred_object_t &object : info->deferred.objects)
+		if (object.value == DEFERRED_NEXT_FRAME)
+			object.value = value;
+}
+
+//Destroys what the GPU is done with, never blocks
+void deferred_collect(vulkan_info_t *info) {
+	std::vector<deferred_object_t> &objects = info->deferred.objects;
+	for (size_t i = 0; i < objects.size();) {
+		if (objects[i].value == DEFERRED_NEXT_FRAME
+				|| !timeline_reached(info, &info->graphic_timeline, objects[i].value)) {
+			i++;
+			continue;
+		}
+		deferred_destroy(info, &objects[i]);
+		objects[i] = objects.back();
+		objects.pop_back();
+	}
+}
+
+//The device must be idle
+void deferred_flush(vulkan_info_t *info) {
+	for (deferred_object_t &object : info->deferred.objects)
+		deferred_destroy(info, &object);
+	info->deferred.objects.clear();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "types.hh"
+
+struct vulkan_info_t;
+
+//Released while recording a frame: sealed with that frame's value when it is submitted
+#define DEFERRED_NEXT_FRAME (~0ull)
+
+//Any of the handles may be null
+struct deferred_object_t {
+	uint64_t value;
+	VkImage image;
+	VkImageView view;
+	VkBuffer buffer;
+	gpu_allocation_t allocation;
+	VkCommandPool pool;
+	VkCommandBuffer command;
+	VkSemaphore semaphore;
+};
+
+/*
+ * Objects the GPU may still be using, destroyed once the graphic timeline
+ * reaches the value of the last submission reading them. Polled every
+ * frame: releasing an object never waits on the GPU.
+ */
+struct deferred_queue_t {
+	std::vector<deferred_object_t> objects;
+};
+
+void deferred_destroy_image(vulkan_info_t *info, VkImage image, VkImageView view,
+														const gpu_allocation_t *allocation, uint64_t value);
+void deferred_destroy_buffer(vulkan_info_t *info, const data_buffer_t *buffer, uint64_t value);
+void deferred_free_command(vulkan_info_t *info, VkCommandPool pool, VkCommandBuffer command,
+													 uint64_t value);
+void deferred_destroy_semaphore(vulkan_info_t *info, VkSemaphore semaphore, uint64_t value);
+
+void deferred_seal(vulkan_info_t *info, uint64_t value);
+void deferred_collect(vulkan_info_t *info);
+void deferred_flush(vulkan_info_t *info);
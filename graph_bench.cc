@@ -0,0 +1,299 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "render_graph.hh"
+
+/*
+ * Render graph compilation without a device, memory requirements are made
+ * up from the formats. A deferred frame with debug passes not reaching the
+ * backbuffer checks the culling, the transient attachments and the memory
+ * slots, then a long chain of passes with dead branches is timed.
+ * Slots never hold overlapping lifetimes, the aliased memory stays between
+ * the peak of the live resources and the unaliased total.
+ *   usage: graph_bench [-p chain_passes] [-n iterations]
+ */
+
+#define BENCH_WIDTH (1920)
+#define BENCH_HEIGHT (1080)
+#define BENCH_SHADOW_SIZE (2048)
+#define BENCH_ALIGNMENT (64ull << 10)
+//Memory types: attachments in the first one, transient ones lazily allocated in the second
+#define BENCH_TYPE_OPTIMAL (1u << 0)
+#define BENCH_TYPE_LAZY (1u << 1)
+#define BENCH_CHAIN_PASSES (1024)
+//A dead branch every that many chain passes
+#define BENCH_CHAIN_BRANCH (4)
+
+static void bench_record(render_graph_context_t *context) {
+}
+
+static VkDeviceSize bench_texel_size(VkFormat format) {
+	switch (format) {
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+	case VK_FORMAT_R32G32_SFLOAT:
+		return 8;
+	default:
+		return 4;
+	}
+}
+
+static void bench_requirements(const render_graph_t *graph, std::vector<VkMemoryRequirements> *requirements) {
+	requirements->resize(graph->resources.size());
+	for (uint32_t r = 0; r < graph->resources.size(); r++) {
+		const render_graph_resource_t *resource = &graph->resources[r];
+		VkDeviceSize size = resource->extent.width * resource->extent.height * bench_texel_size(resource->format);
+		VkMemoryRequirements *needed = &(*requirements)[r];
+		needed->size = (size + BENCH_ALIGNMENT - 1) & ~(BENCH_ALIGNMENT - 1);
+		needed->alignment = BENCH_ALIGNMENT;
+		needed->memoryTypeBits = resource->transient ? BENCH_TYPE_LAZY : BENCH_TYPE_OPTIMAL;
+	}
+}
+
+//Planned and assigned, as render_graph_compile does before touching the device
+static void bench_compile(render_graph_t *graph, std::vector<VkMemoryRequirements> *requirements) {
+	render_graph_plan(graph);
+	bench_requirements(graph, requirements);
+	render_graph_assign_slots(graph, requirements->data());
+}
+
+static bool bench_fail(const char *what) {
+	fprintf(stderr, "check failed: %s\n", what);
+	return false;
+}
+
+/*
+ * Checks what holds for any graph: no overlap in a slot, no slot for unused
+ * resources, and the aliased size bounds. Prints the sizes in KiB.
+ */
+static bool bench_check_memory(const render_graph_t *graph, const std::vector<VkMemoryRequirements> &requirements,
+															 bool verbose) {
+	for (uint32_t s = 0; s < graph->slots.size(); s++) {
+		const render_graph_slot_t *slot = &graph->slots[s];
+		for (uint32_t a = 0; a < slot->resources.size(); a++) {
+			const render_graph_resource_t *first = &graph->resources[slot->resources[a]];
+			if (first->transient != slot->transient)
+				return bench_fail("slot holding resources of another transience");
+			for (uint32_t b = a + 1; b < slot->resources.size(); b++) {
+				const render_graph_resource_t *second = &graph->resources[slot->resources[b]];
+				if (first->first_use <= second->last_use && second->first_use <= first->last_use)
+					return bench_fail("slot holding overlapping lifetimes");
+			}
+		}
+		if (verbose) {
+			printf("  slot %u%s:", s, slot->transient ? " (transient)" : "");
+			for (uint32_t r : slot->resources)
+				printf(" %s", graph->resources[r].name.c_str());
+			printf(", %lu KiB\n", (unsigned long)(slot->requirements.size >> 10));
+		}
+	}
+
+	VkDeviceSize unaliased = 0;
+	for (uint32_t r = 0; r < graph->resources.size(); r++) {
+		const render_graph_resource_t *resource = &graph->resources[r];
+		if (resource->imported)
+			continue;
+		bool used = resource->first_use != RENDER_GRAPH_NONE;
+		if (used != (resource->slot != RENDER_GRAPH_NONE))
+			return bench_fail("slot assigned to an unused resource, or missing");
+		if (used)
+			unaliased += requirements[r].size;
+	}
+
+	VkDeviceSize aliased = 0;
+	for (const render_graph_slot_t &slot : graph->slots)
+		aliased += slot.requirements.size;
+
+	//Largest sum of the resources alive at once, what no aliasing goes under
+	VkDeviceSize peak = 0;
+	for (uint32_t i = 0; i < graph->schedule.size(); i++) {
+		VkDeviceSize live = 0;
+		for (uint32_t r = 0; r < graph->resources.size(); r++) {
+			const render_graph_resource_t *resource = &graph->resources[r];
+			if (!resource->imported && resource->first_use != RENDER_GRAPH_NONE
+					&& resource->first_use <= i && i <= resource->last_use)
+				live += requirements[r].size;
+		}
+		peak = std::max(peak, live);
+	}
+
+	printf("  aliased %lu KiB, unaliased %lu KiB, live peak %lu KiB\n", (unsigned long)(aliased >> 10),
+				 (unsigned long)(unaliased >> 10), (unsigned long)(peak >> 10));
+	if (aliased < peak || aliased > unaliased)
+		return bench_fail("aliased size out of its bounds");
+	return true;
+}
+
+static uint32_t bench_pass(render_graph_t *graph, const char *name) {
+	return render_graph_add_pass(graph, name, bench_record, NULL);
+}
+
+/*
+ * Shadow, G-buffer, lighting, bloom, tonemap then UI. The shadow and UI
+ * depths are transient, the debug passes never reach the backbuffer.
+ */
+static bool bench_frame_graph() {
+	render_graph_t graph;
+	render_graph_create(&graph);
+
+	VkImage image = VK_NULL_HANDLE;
+	VkImageView view = VK_NULL_HANDLE;
+	uint32_t backbuffer = render_graph_import(&graph, "backbuffer", 1, &image, &view, VK_FORMAT_B8G8R8A8_UNORM,
+																						BENCH_WIDTH, BENCH_HEIGHT, IMAGE_ACCESS_UNDEFINED,
+																						IMAGE_ACCESS_PRESENT);
+	render_graph_output(&graph, backbuffer);
+
+	uint32_t moments = render_graph_image(&graph, "shadow_moments", VK_FORMAT_R32G32_SFLOAT,
+																				BENCH_SHADOW_SIZE, BENCH_SHADOW_SIZE);
+	uint32_t shadow_depth = render_graph_image(&graph, "shadow_depth", VK_FORMAT_D32_SFLOAT,
+																						 BENCH_SHADOW_SIZE, BENCH_SHADOW_SIZE);
+	uint32_t albedo = render_graph_image(&graph, "albedo", VK_FORMAT_R8G8B8A8_UNORM, BENCH_WIDTH, BENCH_HEIGHT);
+	uint32_t normal = render_graph_image(&graph, "normal", VK_FORMAT_R16G16B16A16_SFLOAT,
+																			 BENCH_WIDTH, BENCH_HEIGHT);
+	uint32_t depth = render_graph_image(&graph, "depth", VK_FORMAT_D32_SFLOAT, BENCH_WIDTH, BENCH_HEIGHT);
+	uint32_t hdr = render_graph_image(&graph, "hdr", VK_FORMAT_R16G16B16A16_SFLOAT, BENCH_WIDTH, BENCH_HEIGHT);
+	uint32_t bloom = render_graph_image(&graph, "bloom", VK_FORMAT_R16G16B16A16_SFLOAT,
+																			BENCH_WIDTH / 2, BENCH_HEIGHT / 2);
+	uint32_t ui_depth = render_graph_image(&graph, "ui_depth", VK_FORMAT_D32_SFLOAT, BENCH_WIDTH, BENCH_HEIGHT);
+	uint32_t debug_view = render_graph_image(&graph, "debug_view", VK_FORMAT_R8G8B8A8_UNORM,
+																					 BENCH_WIDTH, BENCH_HEIGHT);
+	uint32_t debug_blur = render_graph_image(&graph, "debug_blur", VK_FORMAT_R8G8B8A8_UNORM,
+																					 BENCH_WIDTH, BENCH_HEIGHT);
+
+	uint32_t pass = bench_pass(&graph, "shadow");
+	render_graph_write(&graph, pass, moments, IMAGE_ACCESS_COLOR_ATTACHMENT, true);
+	render_graph_write(&graph, pass, shadow_depth, IMAGE_ACCESS_DEPTH_ATTACHMENT, true);
+
+	pass = bench_pass(&graph, "gbuffer");
+	render_graph_write(&graph, pass, albedo, IMAGE_ACCESS_COLOR_ATTACHMENT, true);
+	render_graph_write(&graph, pass, normal, IMAGE_ACCESS_COLOR_ATTACHMENT, true);
+	render_graph_write(&graph, pass, depth, IMAGE_ACCESS_DEPTH_ATTACHMENT, true);
+
+	pass = bench_pass(&graph, "debug_normals");
+	render_graph_read(&graph, pass, normal, IMAGE_ACCESS_FRAGMENT_SAMPLED);
+	render_graph_write(&graph, pass, debug_view, IMAGE_ACCESS_COLOR_ATTACHMENT, true);
+
+	pass = bench_pass(&graph, "lighting");
+	render_graph_read(&graph, pass, moments, IMAGE_ACCESS_FRAGMENT_SAMPLED);
+	render_graph_read(&graph, pass, albedo, IMAGE_ACCESS_FRAGMENT_SAMPLED);
+	render_graph_read(&graph, pass, normal, IMAGE_ACCESS_FRAGMENT_SAMPLED);
+	render_graph_read(&graph, pass, depth, IMAGE_ACCESS_FRAGMENT_SAMPLED);
+	render_graph_write(&graph, pass, hdr, IMAGE_ACCESS_COLOR_ATTACHMENT, true);
+
+	pass = bench_pass(&graph, "debug_blur");
+	render_graph_read(&graph, pass, debug_view, IMAGE_ACCESS_FRAGMENT_SAMPLED);
+	render_graph_write(&graph, pass, debug_blur, IMAGE_ACCESS_COLOR_ATTACHMENT, true);
+
+	pass = bench_pass(&graph, "bloom");
+	render_graph_read(&graph, pass, hdr, IMAGE_ACCESS_FRAGMENT_SAMPLED);
+	render_graph_write(&graph, pass, bloom, IMAGE_ACCESS_COLOR_ATTACHMENT, true);
+
+	pass = bench_pass(&graph, "tonemap");
+	render_graph_read(&graph, pass, hdr, IMAGE_ACCESS_FRAGMENT_SAMPLED);
+	render_graph_read(&graph, pass, bloom, IMAGE_ACCESS_FRAGMENT_SAMPLED);
+	render_graph_write(&graph, pass, backbuffer, IMAGE_ACCESS_COLOR_ATTACHMENT, true);
+
+	pass = bench_pass(&graph, "ui");
+	render_graph_write(&graph, pass, backbuffer, IMAGE_ACCESS_COLOR_ATTACHMENT, false);
+	render_graph_write(&graph, pass, ui_depth, IMAGE_ACCESS_DEPTH_ATTACHMENT, true);
+
+	std::vector<VkMemoryRequirements> requirements;
+	bench_compile(&graph, &requirements);
+
+	printf("frame graph: %zu passes, %zu scheduled\n", graph.passes.size(), graph.schedule.size());
+	for (uint32_t p : graph.schedule)
+		printf("  %s\n", graph.passes[p].name.c_str());
+
+	bool success = true;
+	for (const render_graph_pass_t &declared : graph.passes) {
+		bool debug = declared.name.compare(0, 6, "debug_") == 0;
+		if (declared.culled != debug)
+			success = bench_fail("only the debug passes are culled");
+	}
+	if (graph.resources[debug_view].first_use != RENDER_GRAPH_NONE
+			|| graph.resources[debug_blur].first_use != RENDER_GRAPH_NONE)
+		success = bench_fail("resources of culled passes in use");
+	for (uint32_t r = 0; r < graph.resources.size(); r++) {
+		bool transient = r == shadow_depth || r == ui_depth;
+		if (graph.resources[r].transient != transient)
+			success = bench_fail("only the shadow and UI depths are transient");
+	}
+	if (graph.resources[shadow_depth].slot != graph.resources[ui_depth].slot)
+		success = bench_fail("the transient depths do not share their slot");
+	if (graph.resources[bloom].slot != graph.resources[moments].slot)
+		success = bench_fail("bloom does not reuse the shadow moments memory");
+	
+	success &= bench_check_memory(&graph, requirements, true);
+	return success;
+}
+
+/*
+ * Each pass samples the previous target and clears its own, every few
+ * passes a dead branch reads the target. Two slots hold the whole chain.
+ */
+static void bench_chain_graph(render_graph_t *graph, uint32_t passes) {
+	render_graph_create(graph);
+	char name[32];
+	uint32_t previous = RENDER_GRAPH_NONE;
+	for (uint32_t i = 0; i < passes; i++) {
+		snprintf(name, sizeof(name), "target_%u", i);
+		uint32_t target = render_graph_image(graph, name, VK_FORMAT_R8G8B8A8_UNORM, BENCH_WIDTH, BENCH_HEIGHT);
+		uint32_t pass = bench_pass(graph, "chain");
+		if (previous != RENDER_GRAPH_NONE)
+			render_graph_read(graph, pass, previous, IMAGE_ACCESS_FRAGMENT_SAMPLED);
+		render_graph_write(graph, pass, target, IMAGE_ACCESS_COLOR_ATTACHMENT, true);
+		previous = target;
+
+		if (i % BENCH_CHAIN_BRANCH != 0)
+			continue;
+		snprintf(name, sizeof(name), "dead_%u", i);
+		uint32_t dead = render_graph_image(graph, name, VK_FORMAT_R8G8B8A8_UNORM, BENCH_WIDTH, BENCH_HEIGHT);
+		pass = bench_pass(graph, "dead");
+		render_graph_read(graph, pass, previous, IMAGE_ACCESS_FRAGMENT_SAMPLED);
+		render_graph_write(graph, pass, dead, IMAGE_ACCESS_COLOR_ATTACHMENT, true);
+	}
+	render_graph_output(graph, previous);
+}
+
+int main(int argc, char **argv) {
+	uint32_t passes = BENCH_CHAIN_PASSES;
+	uint32_t iterations = 20;
+
+	for (int32_t i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			passes = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			iterations = atoi(argv[++i]);
+		else
+			iterations = 0;
+	}
+	if (passes < 2 || iterations == 0) {
+		fprintf(stderr, "usage: %s [-p chain_passes] [-n iterations]\n", argv[0]);
+		return 1;
+	}
+
+	if (!bench_frame_graph())
+		return 1;
+
+	//Declaration included: a graph is compiled once
+	render_graph_t graph;
+	std::vector<VkMemoryRequirements> requirements;
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < iterations; i++) {
+		bench_chain_graph(&graph, passes);
+		bench_compile(&graph, &requirements);
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+	uint32_t dead = (passes + BENCH_CHAIN_BRANCH - 1) / BENCH_CHAIN_BRANCH;
+	printf("chain graph: %u passes, %zu scheduled, %zu slots, %.3f ms per compilation\n",
+				 passes + dead, graph.schedule.size(), graph.slots.size(), elapsed.count() / iterations);
+	if (graph.schedule.size() != passes || graph.slots.size() != 2) {
+		fprintf(stderr, "check failed: chain scheduled or aliased wrong\n");
+		return 1;
+	}
+	if (!bench_check_memory(&graph, requirements, false))
+		return 1;
+	return 0;
+}
@@ -0,0 +1,94 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "image_import.hh"
+#include "stb_image.h"
+
+/*
+ * Compares the in-house streaming decoders against stb_image.
+ * Both decode into the same pitched sink, the way textures are uploaded,
+ * and the outputs are checked to be identical.
+ *   usage: image_bench [-n iterations] image...
+ */
+
+#define BENCH_PITCH_PADDING (256)
+
+typedef bool (*import_fn)(const char *path, image_sink_t *sink);
+
+static bool import_stb(const char *path, image_sink_t *sink) {
+	int32_t w, h, channels;
+	stbi_uc *pixels = stbi_load(path, &w, &h, &channels, STBI_rgb_alpha);
+	if (pixels == NULL)
+		return false;
+	for (uint32_t y = 0; y < sink->height; y++)
+		image_sink_write_row(sink, y, &pixels[y * sink->width * 4]);
+	stbi_image_free(pixels);
+	return true;
+}
+
+static double bench(import_fn fn, const char *path, image_sink_t *sink, uint32_t iterations) {
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < iterations; i++) {
+		if (!fn(path, sink))
+			return -1.0;
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / iterations;
+}
+
+int main(int argc, char **argv) {
+	uint32_t iterations = 10;
+	int32_t first = 1;
+
+	if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+		iterations = atoi(argv[2]);
+		first = 3;
+	}
+	if (first >= argc || iterations == 0) {
+		fprintf(stderr, "usage: %s [-n iterations] image...\n", argv[0]);
+		return 1;
+	}
+
+	printf("%-32s %10s %10s %10s %8s\n", "file", "pixels", "stb ms", "ours ms", "match");
+	for (int32_t i = first; i < argc; i++) {
+		const char *path = argv[i];
+		uint32_t w, h;
+		if (!image_import_info(path, &w, &h)) {
+			printf("%-32s unreadable\n", path);
+			continue;
+		}
+
+		size_t pitch = w * 4 + BENCH_PITCH_PADDING;
+		uint8_t *reference = new uint8_t[pitch * h]();
+		uint8_t *ours = new uint8_t[pitch * h]();
+		image_sink_t ref_sink = { reference, pitch, w, h };
+		image_sink_t our_sink = { ours, pitch, w, h };
+
+		uint8_t magic[2] = { 0 };
+		FILE *file = fopen(path, "rb");
+		if (file != NULL) {
+			if (fread(magic, 1, 2, file) != 2)
+				magic[0] = 0;
+			fclose(file);
+		}
+		import_fn decoder = magic[0] == 'B' && magic[1] == 'M' ? image_import_bmp : image_import_png;
+
+		double stb_ms = bench(import_stb, path, &ref_sink, iterations);
+		double our_ms = bench(decoder, path, &our_sink, iterations);
+
+		bool match = true;
+		for (uint32_t y = 0; y < h && match; y++)
+			match = memcmp(reference + y * pitch, ours + y * pitch, w * 4) == 0;
+
+		if (our_ms < 0.0)
+			printf("%-32s %10u %10.2f %10s %8s\n", path, w * h, stb_ms, "unsupported", "-");
+		else
+			printf("%-32s %10u %10.2f %10.2f %8s\n", path, w * h, stb_ms, our_ms, match ? "yes" : "NO");
+
+		delete[] reference;
+		delete[] ours;
+	}
+	return 0;
+}
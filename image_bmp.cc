@@ -0,0 +1,187 @@
+#include <cstdio>
+#include <cstring>
+
+#include "image_import.hh"
+
+/*
+ * Streaming BMP decoder: one file row is read, converted and handed
+ * to the sink at a time. Bottom-up files simply emit rows in reverse.
+ * Uncompressed 8, 16, 24 and 32 bits images are handled, RLE is not.
+ */
+
+#define BI_RGB (0)
+#define BI_BITFIELDS (3)
+
+struct bmp_channel_t {
+	uint32_t mask;
+	uint32_t shift;
+	uint32_t bits;
+};
+
+static uint32_t read_le16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t read_le32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bmp_channel_t bmp_channel(uint32_t mask) {
+	bmp_channel_t c = { mask, 0, 0 };
+	if (mask == 0)
+		return c;
+	while (!((mask >> c.shift) & 1))
+		c.shift++;
+	while (c.shift + c.bits < 32 && ((mask >> (c.shift + c.bits)) & 1))
+		c.bits++;
+	return c;
+}
+
+//Narrow channels repeat their bits to fill the byte, 5 bits 0x1f gives 0xff
+static inline uint8_t bmp_extract(const bmp_channel_t *c, uint32_t v, uint8_t missing) {
+	if (c->mask == 0)
+		return missing;
+	uint32_t value = (v & c->mask) >> c->shift;
+	if (c->bits >= 8)
+		return value >> (c->bits - 8);
+
+	uint32_t top = value << (8 - c->bits);
+	uint32_t result = top;
+	for (uint32_t z = c->bits; z < 8; z += c->bits)
+		result += top >> z;
+	return result;
+}
+
+bool image_import_bmp(const char *path, image_sink_t *sink) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return false;
+
+	uint8_t header[14 + 124];
+	if (fread(header, 1, 14 + 4, file) != 14 + 4 || header[0] != 'B' || header[1] != 'M') {
+		fclose(file);
+		return false;
+	}
+
+	uint32_t data_offset = read_le32(header + 10);
+	uint32_t dib_size = read_le32(header + 14);
+	if (dib_size < 40 || dib_size > 124
+			|| fread(header + 18, 1, dib_size - 4, file) != dib_size - 4) {
+		fclose(file);
+		return false;
+	}
+
+	const uint8_t *dib = header + 14;
+	int32_t width = (int32_t)read_le32(dib + 4);
+	int32_t height = (int32_t)read_le32(dib + 8);
+	uint32_t bits = read_le16(dib + 14);
+	uint32_t compression = read_le32(dib + 16);
+	uint32_t colors = read_le32(dib + 32);
+	bool top_down = height < 0;
+	if (top_down)
+		height = -height;
+
+	bool supported = width > 0 && (uint32_t)width == sink->width && (uint32_t)height == sink->height
+									 && (compression == BI_RGB || (compression == BI_BITFIELDS && (bits == 16 || bits == 32)))
+									 && (bits == 8 || bits == 16 || bits == 24 || bits == 32);
+	if (!supported) {
+		fclose(file);
+		return false;
+	}
+
+	//Masks follow a 40 bytes header, or are part of the V4/V5 ones
+	bmp_channel_t r, g, b, a;
+	if (compression == BI_BITFIELDS) {
+		uint8_t masks[16] = { 0 };
+		if (dib_size >= 56)
+			memcpy(masks, dib + 40, 16);
+		else if (fread(masks, 1, 12, file) != 12) {
+			fclose(file);
+			return false;
+		}
+		r = bmp_channel(read_le32(masks));
+		g = bmp_channel(read_le32(masks + 4));
+		b = bmp_channel(read_le32(masks + 8));
+		a = bmp_channel(read_le32(masks + 12));
+	} else if (bits == 16) {
+		r = bmp_channel(0x7c00);
+		g = bmp_channel(0x03e0);
+		b = bmp_channel(0x001f);
+		a = bmp_channel(0);
+	} else {
+		r = bmp_channel(0xff0000);
+		g = bmp_channel(0x00ff00);
+		b = bmp_channel(0x0000ff);
+		a = bmp_channel(bits == 32 ? 0xff000000 : 0);
+	}
+
+	uint8_t palette[256 * 4];
+	if (bits == 8) {
+		if (colors == 0 || colors > 256)
+			colors = 256;
+		memset(palette, 0, sizeof(palette));
+		fseek(file, 14 + dib_size, SEEK_SET);
+		if (fread(palette, 4, colors, file) != colors) {
+			fclose(file);
+			return false;
+		}
+	}
+
+	uint32_t stride = ((width * bits + 31) / 32) * 4;
+	uint8_t *line = new uint8_t[stride];
+	uint8_t *rgba = new uint8_t[width * 4];
+	bool success = fseek(file, data_offset, SEEK_SET) == 0;
+	uint8_t any_alpha = a.mask == 0 ? 255 : 0;
+
+	for (int32_t i = 0; success && i < height; i++) {
+		if (fread(line, 1, stride, file) != stride) {
+			success = false;
+			break;
+		}
+
+		for (int32_t x = 0; x < width; x++) {
+			uint8_t *px = &rgba[x * 4];
+			switch (bits) {
+				case 8: {
+					const uint8_t *entry = &palette[line[x] * 4];
+					px[0] = entry[2];
+					px[1] = entry[1];
+					px[2] = entry[0];
+					px[3] = 255;
+					break;
+				}
+				case 24:
+					px[0] = line[x * 3 + 2];
+					px[1] = line[x * 3 + 1];
+					px[2] = line[x * 3 + 0];
+					px[3] = 255;
+					break;
+				default: {
+					uint32_t v = bits == 16 ? read_le16(&line[x * 2]) : read_le32(&line[x * 4]);
+					px[0] = bmp_extract(&r, v, 0);
+					px[1] = bmp_extract(&g, v, 0);
+					px[2] = bmp_extract(&b, v, 0);
+					px[3] = bmp_extract(&a, v, 255);
+					any_alpha |= px[3];
+					break;
+				}
+			}
+		}
+
+		image_sink_write_row(sink, top_down ? i : height - 1 - i, rgba);
+	}
+
+	//Plenty of writers leave the alpha bytes to zero: such images are opaque
+	if (success && any_alpha == 0) {
+		for (int32_t y = 0; y < height; y++) {
+			uint8_t *row = sink->data + y * sink->row_pitch;
+			for (int32_t x = 0; x < width; x++)
+				row[x * 4 + 3] = 255;
+		}
+	}
+
+	delete[] line;
+	delete[] rgba;
+	fclose(file);
+	return success;
+}
@@ -0,0 +1,97 @@
+#include <cstdio>
+#include <cstring>
+
+#include "image_import.hh"
+#include "stb_image.h"
+
+void image_sink_write_row(image_sink_t *sink, uint32_t y, const uint8_t *rgba) {
+	memcpy(sink->data + y * sink->row_pitch, rgba, sink->width * 4);
+}
+
+static void image_read_magic(const char *path, uint8_t *magic, size_t size) {
+	memset(magic, 0, size);
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return;
+	if (fread(magic, 1, size, file) != size)
+		memset(magic, 0, size);
+	fclose(file);
+}
+
+static uint32_t read_be32(const uint8_t *p) {
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint32_t read_le32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool image_import_info(const char *path, uint32_t *width, uint32_t *height) {
+	uint8_t header[26];
+	image_read_magic(path, header, sizeof(header));
+
+	//PNG IHDR is always the first chunk
+	if (memcmp(header, "\x89PNG", 4) == 0 && memcmp(header + 12, "IHDR", 4) == 0) {
+		*width = read_be32(header + 16);
+		*height = read_be32(header + 20);
+		return *width != 0 && *height != 0;
+	}
+
+	//Top-down BMP store a negative height, stbi_info reports it as is
+	if (header[0] == 'B' && header[1] == 'M' && read_le32(header + 14) >= 40) {
+		int32_t h = (int32_t)read_le32(header + 22);
+		*width = read_le32(header + 18);
+		*height = h < 0 ? -h : h;
+		return *width != 0 && *height != 0;
+	}
+
+	int32_t w, h, channels;
+	if (!stbi_info(path, &w, &h, &channels))
+		return false;
+	*width = w;
+	*height = h;
+	return true;
+}
+
+/*
+ * stb_image only decodes whole images: the buffer is dropped as soon as it is
+ * copied. JPEG always lands here, a streaming decoder for it is in TODO.md.
+ */
+static bool image_import_stb(const char *path, image_sink_t *sink) {
+	int32_t w, h, channels;
+	stbi_uc *pixels = stbi_load(path, &w, &h, &channels, STBI_rgb_alpha);
+	if (pixels == NULL)
+		return false;
+
+	if ((uint32_t)w != sink->width || (uint32_t)h != sink->height) {
+		stbi_image_free(pixels);
+		return false;
+	}
+
+	if (sink->row_pitch == sink->width * 4)
+		memcpy(sink->data, pixels, sink->row_pitch * sink->height);
+	else {
+		for (uint32_t y = 0; y < sink->height; y++)
+			image_sink_write_row(sink, y, &pixels[y * sink->width * 4]);
+	}
+
+	stbi_image_free(pixels);
+	return true;
+}
+
+bool image_import(const char *path, image_sink_t *sink) {
+	uint8_t magic[8];
+	image_read_magic(path, magic, sizeof(magic));
+
+	//Unsupported variants (interlaced PNG, RLE BMP...) fall back on stb_image
+	if (memcmp(magic, "\x89PNG", 4) == 0 && image_import_png(path, sink))
+		return true;
+	if (magic[0] == 'B' && magic[1] == 'M' && image_import_bmp(path, sink))
+		return true;
+
+	if (!image_import_stb(path, sink)) {
+		fprintf(stderr, "[ERROR] Unable to import %s\n", path);
+		return false;
+	}
+	return true;
+}
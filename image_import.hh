@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Destination of a decoded image. Rows are RGBA8 and land at
+ * data + y * row_pitch, which is usually mapped staging memory.
+ * Decoders may emit rows in any order.
+ */
+struct image_sink_t {
+	uint8_t *data;
+	size_t row_pitch;
+	uint32_t width;
+	uint32_t height;
+};
+
+bool image_import_info(const char *path, uint32_t *width, uint32_t *height);
+bool image_import(const char *path, image_sink_t *sink);
+
+//In-house streaming decoders, image_import picks them from the file magic
+bool image_import_png(const char *path, image_sink_t *sink);
+bool image_import_bmp(const char *path, image_sink_t *sink);
+
+void image_sink_write_row(image_sink_t *sink, uint32_t y, const uint8_t *rgba);
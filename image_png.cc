@@ -0,0 +1,651 @@
+#include <cstdio>
+#include <cstring>
+
+#include "image_import.hh"
+
+/*
+ * Streaming PNG decoder: IDAT chunks are inflated into a sliding window,
+ * and every complete scanline is unfiltered and handed to the sink.
+ * Only the window and two scanlines live in memory at any time.
+ * Interlaced images are not handled and report a failure.
+ */
+
+#define INFLATE_WINDOW (32768)
+//Room for the window plus a few maximum length matches before a flush
+#define INFLATE_BUFFER (INFLATE_WINDOW * 2)
+#define INFLATE_MAX_MATCH (258)
+#define HUFFMAN_FAST_BITS (10)
+#define HUFFMAN_MAX_BITS (15)
+
+struct huffman_t {
+	uint16_t fast[1 << HUFFMAN_FAST_BITS];
+	uint16_t count[HUFFMAN_MAX_BITS + 1];
+	uint16_t symbol[288];
+};
+
+struct png_stream_t {
+	FILE *file;
+	uint32_t chunk_left;
+	bool idat_done;
+
+	uint8_t input[16384];
+	const uint8_t *in;
+	size_t in_left;
+	uint64_t bits;
+	uint32_t bit_count;
+	bool overrun;
+
+	uint8_t window[INFLATE_BUFFER];
+	size_t pos;
+	size_t flushed;
+
+	//Scanline assembly
+	uint32_t width;
+	uint32_t height;
+	uint8_t depth;
+	uint8_t color_type;
+	uint32_t channels;
+	uint32_t stride;
+	uint32_t bpp;
+	uint8_t *row;
+	uint8_t *prev;
+	uint8_t *rgba;
+	uint32_t row_fill;
+	uint32_t y;
+
+	uint8_t palette[256 * 4];
+	bool has_key;
+	uint16_t key[3];
+
+	image_sink_t *sink;
+};
+
+static uint32_t read_be32(const uint8_t *p) {
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+//=========== IDAT BYTE SOURCE
+
+static bool png_next_idat(png_stream_t *s) {
+	uint8_t header[8];
+
+	//Skips the CRC of the current chunk, then looks for another IDAT
+	if (fseek(s->file, s->chunk_left + 4, SEEK_CUR) != 0)
+		return false;
+	if (fread(header, 1, 8, s->file) != 8)
+		return false;
+	if (memcmp(header + 4, "IDAT", 4) != 0)
+		return false;
+	s->chunk_left = read_be32(header);
+	return true;
+}
+
+static bool png_refill_input(png_stream_t *s) {
+	while (s->chunk_left == 0) {
+		if (s->idat_done || !png_next_idat(s)) {
+			s->idat_done = true;
+			return false;
+		}
+	}
+
+	size_t want = s->chunk_left < sizeof(s->input) ? s->chunk_left : sizeof(s->input);
+	size_t got = fread(s->input, 1, want, s->file);
+	if (got == 0) {
+		s->idat_done = true;
+		return false;
+	}
+	s->chunk_left -= got;
+	s->in = s->input;
+	s->in_left = got;
+	return true;
+}
+
+static inline void fill_bits(png_stream_t *s) {
+	while (s->bit_count <= 56) {
+		if (s->in_left == 0 && !png_refill_input(s)) {
+			//Zero padding past the end, flagged if actually consumed
+			if (s->bit_count < HUFFMAN_MAX_BITS)
+				s->overrun = true;
+			return;
+		}
+		s->bits |= (uint64_t)*s->in++ << s->bit_count;
+		s->in_left--;
+		s->bit_count += 8;
+	}
+}
+
+static inline uint32_t get_bits(png_stream_t *s, uint32_t n) {
+	if (s->bit_count < n)
+		fill_bits(s);
+	uint32_t v = s->bits & ((1ull << n) - 1);
+	s->bits >>= n;
+	s->bit_count = s->bit_count >= n ? s->bit_count - n : 0;
+	return v;
+}
+
+//=========== SCANLINES
+
+static inline uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+	int32_t p = a + b - c;
+	int32_t pa = p > a ? p - a : a - p;
+	int32_t pb = p > b ? p - b : b - p;
+	int32_t pc = p > c ? p - c : c - p;
+	if (pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+static bool png_unfilter(png_stream_t *s) {
+	uint8_t filter = s->row[0];
+	uint8_t *cur = s->row + 1;
+	const uint8_t *up = s->prev + 1;
+	uint32_t bpp = s->bpp;
+
+	switch (filter) {
+		case 0:
+			break;
+		case 1:
+			for (uint32_t i = bpp; i < s->stride; i++)
+				cur[i] += cur[i - bpp];
+			break;
+		case 2:
+			for (uint32_t i = 0; i < s->stride; i++)
+				cur[i] += up[i];
+			break;
+		case 3:
+			for (uint32_t i = 0; i < bpp; i++)
+				cur[i] += up[i] >> 1;
+			for (uint32_t i = bpp; i < s->stride; i++)
+				cur[i] += (cur[i - bpp] + up[i]) >> 1;
+			break;
+		case 4:
+			for (uint32_t i = 0; i < bpp; i++)
+				cur[i] += up[i];
+			for (uint32_t i = bpp; i < s->stride; i++)
+				cur[i] += paeth(cur[i - bpp], up[i], up[i - bpp]);
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
+
+static inline uint32_t png_sample(png_stream_t *s, const uint8_t *line, uint32_t index) {
+	switch (s->depth) {
+		case 16:
+			return (line[index * 2] << 8) | line[index * 2 + 1];
+		case 8:
+			return line[index];
+		default: {
+			uint32_t bit = index * s->depth;
+			uint32_t shift = 8 - s->depth - (bit & 7);
+			return (line[bit >> 3] >> shift) & ((1 << s->depth) - 1);
+		}
+	}
+}
+
+//16 bits samples keep their high byte, low depths are stretched to 0-255
+static inline uint8_t png_scale(uint32_t v, uint8_t depth, uint32_t max) {
+	return depth == 16 ? v >> 8 : v * 255 / max;
+}
+
+static void png_convert_row(png_stream_t *s) {
+	const uint8_t *line = s->row + 1;
+	uint8_t *out = s->rgba;
+	uint32_t max = (1 << s->depth) - 1;
+
+	//Fast paths for the common 8 bit layouts
+	if (s->depth == 8 && s->color_type == 6) {
+		memcpy(out, line, s->width * 4);
+		return;
+	}
+	if (s->depth == 8 && s->color_type == 2 && !s->has_key) {
+		for (uint32_t x = 0; x < s->width; x++) {
+			out[x * 4 + 0] = line[x * 3 + 0];
+			out[x * 4 + 1] = line[x * 3 + 1];
+			out[x * 4 + 2] = line[x * 3 + 2];
+			out[x * 4 + 3] = 255;
+		}
+		return;
+	}
+
+	for (uint32_t x = 0; x < s->width; x++) {
+		uint32_t c = x * s->channels;
+		uint8_t *px = &out[x * 4];
+
+		switch (s->color_type) {
+			case 0: {
+				uint32_t g = png_sample(s, line, c);
+				px[0] = px[1] = px[2] = png_scale(g, s->depth, max);
+				px[3] = s->has_key && g == s->key[0] ? 0 : 255;
+				break;
+			}
+			case 2: {
+				uint32_t r = png_sample(s, line, c);
+				uint32_t g = png_sample(s, line, c + 1);
+				uint32_t b = png_sample(s, line, c + 2);
+				px[0] = png_scale(r, s->depth, max);
+				px[1] = png_scale(g, s->depth, max);
+				px[2] = png_scale(b, s->depth, max);
+				px[3] = s->has_key && r == s->key[0] && g == s->key[1] && b == s->key[2] ? 0 : 255;
+				break;
+			}
+			case 3:
+				memcpy(px, &s->palette[png_sample(s, line, c) * 4], 4);
+				break;
+			case 4:
+				px[0] = px[1] = px[2] = png_scale(png_sample(s, line, c), s->depth, max);
+				px[3] = png_scale(png_sample(s, line, c + 1), s->depth, max);
+				break;
+			case 6:
+				for (uint32_t i = 0; i < 4; i++)
+					px[i] = png_scale(png_sample(s, line, c + i), s->depth, max);
+				break;
+		}
+	}
+}
+
+static bool png_consume(png_stream_t *s, const uint8_t *data, size_t size) {
+	uint32_t row_size = s->stride + 1;
+
+	while (size > 0 && s->y < s->height) {
+		size_t n = row_size - s->row_fill;
+		if (n > size)
+			n = size;
+		memcpy(s->row + s->row_fill, data, n);
+		s->row_fill += n;
+		data += n;
+		size -= n;
+
+		if (s->row_fill < row_size)
+			break;
+
+		if (!png_unfilter(s))
+			return false;
+		png_convert_row(s);
+		image_sink_write_row(s->sink, s->y, s->rgba);
+
+		uint8_t *tmp = s->prev;
+		s->prev = s->row;
+		s->row = tmp;
+		s->row_fill = 0;
+		s->y++;
+	}
+	return true;
+}
+
+//Hands the decoded bytes over and keeps the last 32K for back references
+static bool inflate_flush(png_stream_t *s) {
+	if (!png_consume(s, s->window + s->flushed, s->pos - s->flushed))
+		return false;
+	s->flushed = s->pos;
+
+	if (s->pos >= INFLATE_BUFFER - INFLATE_MAX_MATCH) {
+		memmove(s->window, s->window + s->pos - INFLATE_WINDOW, INFLATE_WINDOW);
+		s->pos = INFLATE_WINDOW;
+		s->flushed = INFLATE_WINDOW;
+	}
+	return true;
+}
+
+//=========== INFLATE
+
+static bool huffman_build(huffman_t *h, const uint8_t *lengths, uint32_t count) {
+	uint16_t offsets[HUFFMAN_MAX_BITS + 2];
+	uint16_t next_code[HUFFMAN_MAX_BITS + 2];
+
+	memset(h->count, 0, sizeof(h->count));
+	memset(h->fast, 0, sizeof(h->fast));
+	for (uint32_t i = 0; i < count; i++)
+		h->count[lengths[i]]++;
+	h->count[0] = 0;
+
+	int32_t left = 1;
+	for (uint32_t len = 1; len <= HUFFMAN_MAX_BITS; len++) {
+		left = (left << 1) - h->count[len];
+		if (left < 0)
+			return false;
+	}
+
+	offsets[1] = 0;
+	for (uint32_t len = 1; len <= HUFFMAN_MAX_BITS; len++)
+		offsets[len + 1] = offsets[len] + h->count[len];
+	for (uint32_t i = 0; i < count; i++)
+		if (lengths[i] != 0)
+			h->symbol[offsets[lengths[i]]++] = i;
+
+	//Fast table entries are (symbol << 4) | length, zero means slow path
+	uint32_t code = 0;
+	for (uint32_t len = 1; len <= HUFFMAN_MAX_BITS; len++) {
+		code = (code + h->count[len - 1]) << 1;
+		next_code[len] = code;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t len = lengths[i];
+		if (len == 0 || len > HUFFMAN_FAST_BITS)
+			continue;
+		uint32_t c = next_code[len]++;
+		uint32_t reversed = 0;
+		for (uint32_t b = 0; b < len; b++)
+			reversed |= ((c >> b) & 1) << (len - 1 - b);
+		for (uint32_t j = reversed; j < (1u << HUFFMAN_FAST_BITS); j += 1 << len)
+			h->fast[j] = (i << 4) | len;
+	}
+	return true;
+}
+
+static int32_t huffman_decode(png_stream_t *s, const huffman_t *h) {
+	if (s->bit_count < HUFFMAN_MAX_BITS)
+		fill_bits(s);
+
+	uint16_t entry = h->fast[s->bits & ((1 << HUFFMAN_FAST_BITS) - 1)];
+	if (entry != 0) {
+		uint32_t len = entry & 15;
+		if (len > s->bit_count)
+			return -1;
+		s->bits >>= len;
+		s->bit_count -= len;
+		return entry >> 4;
+	}
+
+	//Canonical decoding, one bit at a time
+	int32_t code = 0, first = 0, index = 0;
+	for (uint32_t len = 1; len <= HUFFMAN_MAX_BITS; len++) {
+		code |= get_bits(s, 1);
+		int32_t count = h->count[len];
+		if (code - count < first)
+			return h->symbol[index + (code - first)];
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+static const uint16_t length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static bool inflate_codes(png_stream_t *s, const huffman_t *lit, const huffman_t *dist) {
+	while (true) {
+		if (s->pos >= INFLATE_BUFFER - INFLATE_MAX_MATCH && !inflate_flush(s))
+			return false;
+
+		int32_t sym = huffman_decode(s, lit);
+		if (sym < 0 || s->overrun)
+			return false;
+		if (sym < 256) {
+			s->window[s->pos++] = sym;
+			continue;
+		}
+		if (sym == 256)
+			return true;
+
+		sym -= 257;
+		if (sym >= 29)
+			return false;
+		uint32_t length = length_base[sym] + get_bits(s, length_extra[sym]);
+
+		int32_t dsym = huffman_decode(s, dist);
+		if (dsym < 0 || dsym >= 30)
+			return false;
+		uint32_t distance = dist_base[dsym] + get_bits(s, dist_extra[dsym]);
+		if (distance > s->pos)
+			return false;
+
+		uint8_t *dst = s->window + s->pos;
+		const uint8_t *src = dst - distance;
+		for (uint32_t i = 0; i < length; i++)
+			dst[i] = src[i];
+		s->pos += length;
+	}
+}
+
+static bool inflate_stored(png_stream_t *s) {
+	//Drops the bits up to the byte boundary
+	get_bits(s, s->bit_count & 7);
+	uint32_t len = get_bits(s, 16);
+	uint32_t nlen = get_bits(s, 16);
+	if ((len ^ 0xffff) != nlen)
+		return false;
+
+	while (len-- > 0) {
+		if (s->pos >= INFLATE_BUFFER - INFLATE_MAX_MATCH && !inflate_flush(s))
+			return false;
+		s->window[s->pos++] = get_bits(s, 8);
+	}
+	return !s->overrun;
+}
+
+static bool huffman_build_fixed(huffman_t *lit, huffman_t *dist) {
+	uint8_t lengths[288];
+	for (uint32_t i = 0; i < 144; i++) lengths[i] = 8;
+	for (uint32_t i = 144; i < 256; i++) lengths[i] = 9;
+	for (uint32_t i = 256; i < 280; i++) lengths[i] = 7;
+	for (uint32_t i = 280; i < 288; i++) lengths[i] = 8;
+	huffman_build(lit, lengths, 288);
+	for (uint32_t i = 0; i < 30; i++) lengths[i] = 5;
+	return huffman_build(dist, lengths, 30);
+}
+
+static bool inflate_fixed(png_stream_t *s) {
+	//Static init is thread safe, the streamer decodes from its loader thread
+	static huffman_t lit, dist;
+	static bool built = huffman_build_fixed(&lit, &dist);
+	(void)built;
+
+	return inflate_codes(s, &lit, &dist);
+}
+
+static bool inflate_dynamic(png_stream_t *s) {
+	static const uint8_t order[19] = {
+		16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+	};
+	huffman_t lit, dist, lencode;
+	uint8_t lengths[320];
+
+	uint32_t nlen = get_bits(s, 5) + 257;
+	uint32_t ndist = get_bits(s, 5) + 1;
+	uint32_t ncode = get_bits(s, 4) + 4;
+	if (nlen > 286 || ndist > 30)
+		return false;
+
+	memset(lengths, 0, 19);
+	for (uint32_t i = 0; i < ncode; i++)
+		lengths[order[i]] = get_bits(s, 3);
+	if (!huffman_build(&lencode, lengths, 19))
+		return false;
+
+	uint32_t index = 0;
+	while (index < nlen + ndist) {
+		int32_t sym = huffman_decode(s, &lencode);
+		if (sym < 0)
+			return false;
+		if (sym < 16) {
+			lengths[index++] = sym;
+			continue;
+		}
+
+		uint8_t value = 0;
+		uint32_t repeat = 0;
+		if (sym == 16) {
+			if (index == 0)
+				return false;
+			value = lengths[index - 1];
+			repeat = 3 + get_bits(s, 2);
+		} else if (sym == 17)
+			repeat = 3 + get_bits(s, 3);
+		else
+			repeat = 11 + get_bits(s, 7);
+
+		if (index + repeat > nlen + ndist)
+			return false;
+		while (repeat--)
+			lengths[index++] = value;
+	}
+
+	if (!huffman_build(&lit, lengths, nlen) || !huffman_build(&dist, lengths + nlen, ndist))
+		return false;
+	return inflate_codes(s, &lit, &dist);
+}
+
+static bool png_inflate(png_stream_t *s) {
+	//zlib header: deflate method, no preset dictionary
+	uint32_t cmf = get_bits(s, 8);
+	uint32_t flg = get_bits(s, 8);
+	if ((cmf & 15) != 8 || ((cmf << 8) | flg) % 31 != 0 || (flg & 32))
+		return false;
+
+	uint32_t last = 0;
+	while (!last && s->y < s->height) {
+		last = get_bits(s, 1);
+		uint32_t type = get_bits(s, 2);
+		bool ok = false;
+
+		if (type == 0)
+			ok = inflate_stored(s);
+		else if (type == 1)
+			ok = inflate_fixed(s);
+		else if (type == 2)
+			ok = inflate_dynamic(s);
+		if (!ok)
+			return false;
+	}
+	return inflate_flush(s) && s->y == s->height;
+}
+
+//=========== CHUNKS
+
+static bool png_read_header(png_stream_t *s) {
+	static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	uint8_t header[8];
+
+	if (fread(header, 1, 8, s->file) != 8 || memcmp(header, signature, 8) != 0)
+		return false;
+
+	for (uint32_t i = 0; i < 256; i++) {
+		s->palette[i * 4 + 0] = 0;
+		s->palette[i * 4 + 1] = 0;
+		s->palette[i * 4 + 2] = 0;
+		s->palette[i * 4 + 3] = 255;
+	}
+
+	//Walks the chunks until the first IDAT, the stream reader takes over from there
+	while (fread(header, 1, 8, s->file) == 8) {
+		uint32_t length = read_be32(header);
+		const uint8_t *type = header + 4;
+
+		if (memcmp(type, "IDAT", 4) == 0) {
+			s->chunk_left = length;
+			return s->width != 0;
+		}
+
+		uint8_t data[768];
+		bool keep = memcmp(type, "IHDR", 4) == 0 || memcmp(type, "PLTE", 4) == 0
+								|| memcmp(type, "tRNS", 4) == 0;
+		if (keep && length <= sizeof(data)) {
+			if (fread(data, 1, length, s->file) != length)
+				return false;
+			fseek(s->file, 4, SEEK_CUR);
+		} else {
+			fseek(s->file, length + 4, SEEK_CUR);
+			continue;
+		}
+
+		if (memcmp(type, "IHDR", 4) == 0) {
+			if (length != 13)
+				return false;
+			s->width = read_be32(data);
+			s->height = read_be32(data + 4);
+			s->depth = data[8];
+			s->color_type = data[9];
+			//Compression, filter method, interlace
+			if (data[10] != 0 || data[11] != 0 || data[12] != 0)
+				return false;
+		} else if (memcmp(type, "PLTE", 4) == 0) {
+			for (uint32_t i = 0; i < length / 3; i++) {
+				s->palette[i * 4 + 0] = data[i * 3 + 0];
+				s->palette[i * 4 + 1] = data[i * 3 + 1];
+				s->palette[i * 4 + 2] = data[i * 3 + 2];
+			}
+		} else if (memcmp(type, "tRNS", 4) == 0) {
+			if (s->color_type == 3) {
+				for (uint32_t i = 0; i < length && i < 256; i++)
+					s->palette[i * 4 + 3] = data[i];
+			} else {
+				s->has_key = true;
+				for (uint32_t i = 0; i < 3 && i * 2 + 1 < length; i++)
+					s->key[i] = (data[i * 2] << 8) | data[i * 2 + 1];
+			}
+		}
+	}
+	return false;
+}
+
+static bool png_setup(png_stream_t *s) {
+	switch (s->color_type) {
+		case 0: s->channels = 1; break;
+		case 2: s->channels = 3; break;
+		case 3: s->channels = 1; break;
+		case 4: s->channels = 2; break;
+		case 6: s->channels = 4; break;
+		default: return false;
+	}
+
+	bool valid_depth = s->depth == 8 || s->depth == 16
+										 || ((s->color_type == 0 || s->color_type == 3) && s->depth < 8
+												 && (s->depth == 1 || s->depth == 2 || s->depth == 4));
+	if (!valid_depth || (s->color_type == 3 && s->depth == 16))
+		return false;
+
+	//Color keys are compared against samples of the image depth
+	if (s->has_key && s->depth == 8) {
+		s->key[0] &= 0xff;
+		s->key[1] &= 0xff;
+		s->key[2] &= 0xff;
+	}
+
+	s->stride = (s->width * s->channels * s->depth + 7) / 8;
+	s->bpp = (s->channels * s->depth + 7) / 8;
+	return true;
+}
+
+bool image_import_png(const char *path, image_sink_t *sink) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return false;
+
+	png_stream_t *s = new png_stream_t();
+	s->file = file;
+	s->sink = sink;
+
+	bool success = png_read_header(s) && png_setup(s)
+								 && s->width == sink->width && s->height == sink->height;
+	if (success) {
+		s->row = new uint8_t[s->stride + 1];
+		s->prev = new uint8_t[s->stride + 1]();
+		s->rgba = new uint8_t[s->width * 4];
+		success = png_inflate(s);
+
+		delete[] s->row;
+		delete[] s->prev;
+		delete[] s->rgba;
+	}
+
+	fclose(file);
+	delete s;
+	return success;
+}
@@ -0,0 +1,166 @@
+#include <cassert>
+
+#include "image_state.hh"
+
+struct image_access_desc_t {
+	VkImageLayout layout;
+	VkPipelineStageFlags stages;
+	VkAccessFlags access;
+	//Write part of the access, 0 for reads
+	VkAccessFlags writes;
+};
+
+static const image_access_desc_t image_accesses[IMAGE_ACCESS_COUNT] = {
+	//IMAGE_ACCESS_UNDEFINED
+	{ VK_IMAGE_LAYOUT_UNDEFINED, 0, 0, 0 },
+	//IMAGE_ACCESS_HOST_WRITTEN
+	{ VK_IMAGE_LAYOUT_PREINITIALIZED, VK_PIPELINE_STAGE_HOST_BIT,
+		VK_ACCESS_HOST_WRITE_BIT, VK_ACCESS_HOST_WRITE_BIT },
+	//IMAGE_ACCESS_TRANSFER_SRC
+	{ VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_ACCESS_TRANSFER_READ_BIT, 0 },
+	//IMAGE_ACCESS_TRANSFER_DST
+	{ VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_WRITE_BIT },
+	//IMAGE_ACCESS_COLOR_ATTACHMENT
+	{ VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT },
+	//IMAGE_ACCESS_DEPTH_ATTACHMENT
+	{ VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT },
+	//IMAGE_ACCESS_FRAGMENT_SAMPLED
+	{ VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_ACCESS_SHADER_READ_BIT, 0 },
+	//IMAGE_ACCESS_PRESENT, the presentation engine waits on a semaphore, not on the barrier
+	{ VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0 },
+	//IMAGE_ACCESS_HOST_REWRITE
+	{ VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_HOST_BIT,
+		VK_ACCESS_HOST_WRITE_BIT, VK_ACCESS_HOST_WRITE_BIT },
+};
+
+VkImageLayout image_access_layout(image_access_e access) {
+	return image_accesses[access].layout;
+}
+
+VkPipelineStageFlags image_access_stages(image_access_e access) {
+	return image_accesses[access].stages;
+}
+
+VkAccessFlags image_access_mask(image_access_e access) {
+	return image_accesses[access].access;
+}
+
+VkAccessFlags image_access_writes(image_access_e access) {
+	return image_accesses[access].writes;
+}
+
+bool image_access_is_attachment(image_access_e access) {
+	return access == IMAGE_ACCESS_COLOR_ATTACHMENT || access == IMAGE_ACCESS_DEPTH_ATTACHMENT;
+}
+
+void image_state_init(image_state_t *state, VkImage image, VkImageAspectFlags aspect,
+											uint32_t levels, image_access_e initial) {
+	assert(initial == IMAGE_ACCESS_UNDEFINED || initial == IMAGE_ACCESS_HOST_WRITTEN);
+	const image_access_desc_t *desc = &image_accesses[initial];
+
+	state->image = image;
+	state->range.aspectMask = aspect;
+	state->range.baseMipLevel = 0;
+	state->range.levelCount = levels;
+	state->range.baseArrayLayer = 0;
+	state->range.layerCount = 1;
+	state->layout = desc->layout;
+	state->write_stages = desc->writes != 0 ? desc->stages : 0;
+	state->write_access = desc->writes;
+	state->visible_stages = 0;
+	state->read_stages = 0;
+}
+
+void barrier_batch_begin(barrier_batch_t *batch, VkCommandBuffer command) {
+	batch->command = command;
+	batch->src_stages = 0;
+	batch->dst_stages = 0;
+	batch->images.clear();
+}
+
+/*
+ * Layout changes and writes wait on every earlier access, reads only on the
+ * last write. Nothing is emitted for a read already covered.
+ */
+void barrier_image(barrier_batch_t *batch, image_state_t *state, image_access_e access) {
+	assert(access != IMAGE_ACCESS_UNDEFINED && access != IMAGE_ACCESS_HOST_WRITTEN);
+	const image_access_desc_t *desc = &image_accesses[access];
+
+	VkPipelineStageFlags src_stages;
+	VkAccessFlags src_access = state->write_access;
+	bool transition = desc->layout != state->layout;
+	if (transition || desc->writes != 0)
+		src_stages = state->write_stages | state->read_stages;
+	else if (state->write_stages != 0 && (desc->stages & ~state->visible_stages) != 0)
+		src_stages = state->write_stages;
+	else {
+		state->read_stages |= desc->stages;
+		return;
+	}
+
+	//An image barrier per image and batch: a second access needs the first one recorded
+	for (const VkImageMemoryBarrier &pending : batch->images) {
+		if (pending.image == state->image) {
+			barrier_flush(batch);
+			break;
+		}
+	}
+
+	VkImageMemoryBarrier barrier = { };
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.pNext = NULL;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = desc->access;
+	barrier.oldLayout = state->layout;
+	barrier.newLayout = desc->layout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = state->image;
+	barrier.subresourceRange = state->range;
+	batch->images.push_back(barrier);
+
+	//Nothing to wait for still needs a valid source stage
+	batch->src_stages |= src_stages != 0 ? src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	batch->dst_stages |= desc->stages;
+
+	/*
+	 * The layout transition counts as a write at the destination stages,
+	 * made visible to them by this barrier. Reads from other stages later
+	 * chain a barrier from these.
+	 */
+	state->layout = desc->layout;
+	if (desc->writes != 0) {
+		state->write_stages = desc->stages;
+		state->write_access = desc->writes;
+		state->visible_stages = 0;
+		state->read_stages = 0;
+	} else {
+		if (transition) {
+			state->write_stages = desc->stages;
+			state->write_access = 0;
+			state->visible_stages = 0;
+			state->read_stages = 0;
+		}
+		state->visible_stages |= desc->stages;
+		state->read_stages |= desc->stages;
+	}
+}
+
+void barrier_flush(barrier_batch_t *batch) {
+	if (batch->images.empty())
+		return;
+
+	vkCmdPipelineBarrier(batch->command, batch->src_stages, batch->dst_stages, 0,
+											 0, NULL, 0, NULL, batch->images.size(), batch->images.data());
+	batch->src_stages = 0;
+	batch->dst_stages = 0;
+	batch->images.clear();
+}
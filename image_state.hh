@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+/*
+ * How an image is accessed next. Each access maps to a layout, the stages
+ * touching the image and their access mask, see image_accesses.
+ */
+enum image_access_e {
+	//Initial states only: nothing to keep, or written by the host before any submission
+	IMAGE_ACCESS_UNDEFINED,
+	IMAGE_ACCESS_HOST_WRITTEN,
+	IMAGE_ACCESS_TRANSFER_SRC,
+	IMAGE_ACCESS_TRANSFER_DST,
+	IMAGE_ACCESS_COLOR_ATTACHMENT,
+	IMAGE_ACCESS_DEPTH_ATTACHMENT,
+	IMAGE_ACCESS_FRAGMENT_SAMPLED,
+	IMAGE_ACCESS_PRESENT,
+	//Linear image handed back to the host, rewritten in place once the submission completed
+	IMAGE_ACCESS_HOST_REWRITE,
+	IMAGE_ACCESS_COUNT
+};
+
+/*
+ * Current layout of an image, its last write and the reads since. A barrier
+ * is only emitted when the layout changes, when a write follows any access,
+ * or when a read comes from a stage the last write is not visible to yet.
+ */
+struct image_state_t {
+	VkImage image;
+	VkImageSubresourceRange range;
+	VkImageLayout layout;
+	VkPipelineStageFlags write_stages;
+	VkAccessFlags write_access;
+	//Stages the last write was made visible to
+	VkPipelineStageFlags visible_stages;
+	VkPipelineStageFlags read_stages;
+};
+
+/*
+ * Barriers gathered for one command buffer, recorded as a single
+ * vkCmdPipelineBarrier at the next flush. Flush before recording the
+ * commands using the images.
+ */
+struct barrier_batch_t {
+	VkCommandBuffer command;
+	VkPipelineStageFlags src_stages;
+	VkPipelineStageFlags dst_stages;
+	std::vector<VkImageMemoryBarrier> images;
+};
+
+VkImageLayout image_access_layout(image_access_e access);
+VkPipelineStageFlags image_access_stages(image_access_e access);
+VkAccessFlags image_access_mask(image_access_e access);
+VkAccessFlags image_access_writes(image_access_e access);
+bool image_access_is_attachment(image_access_e access);
+
+void image_state_init(image_state_t *state, VkImage image, VkImageAspectFlags aspect,
+											uint32_t levels, image_access_e initial);
+
+void barrier_batch_begin(barrier_batch_t *batch, VkCommandBuffer command);
+void barrier_image(barrier_batch_t *batch, image_state_t *state, image_access_e access);
+void barrier_flush(barrier_batch_t *batch);
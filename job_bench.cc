@@ -0,0 +1,142 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "job_system.hh"
+
+/*
+ * Scaling of the job system from 1 to N workers on two workloads:
+ *   parallel for: independent batches of math over a large array,
+ *   fork-join: a binary tree of small jobs, each waiting on its children,
+ *   which keeps the thieves busy.
+ * Steal attempts and contended deques are summed over the workers.
+ *   usage: job_bench [-n iterations] [-t max_workers]
+ */
+
+#define BENCH_ELEMENTS (1u << 22)
+#define BENCH_TREE_DEPTH (16)
+//Leaf work of the fork-join tree, in loop iterations
+#define BENCH_LEAF_WORK (2000)
+
+struct bench_array_t {
+	float *values;
+};
+
+static void bench_range(void *data, uint32_t first, uint32_t last) {
+	bench_array_t *array = (bench_array_t*)data;
+	for (uint32_t i = first; i < last; i++) {
+		float x = array->values[i];
+		array->values[i] = sqrtf(x * x + 1.0f) * sinf(x) + cosf(x * 0.5f);
+	}
+}
+
+struct bench_node_t {
+	job_system_t *system;
+	uint32_t depth;
+	float result;
+};
+
+static void bench_tree(void *data) {
+	bench_node_t *node = (bench_node_t*)data;
+	if (node->depth == 0) {
+		float sum = 0.0f;
+		for (uint32_t i = 0; i < BENCH_LEAF_WORK; i++)
+			sum += sqrtf((float)i);
+		node->result = sum;
+		return;
+	}
+
+	bench_node_t children[2];
+	job_counter_t counter;
+	job_counter_init(&counter);
+	for (uint32_t i = 0; i < 2; i++) {
+		children[i] = { node->system, node->depth - 1, 0.0f };
+		job_submit(node->system, bench_tree, &children[i], &counter);
+	}
+	job_wait(node->system, &counter);
+	node->result = children[0].result + children[1].result;
+}
+
+static double bench_parallel_for(job_system_t *system, bench_array_t *array, uint32_t iterations) {
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < iterations; i++)
+		job_parallel_for(system, BENCH_ELEMENTS, 0, bench_range, array);
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / iterations;
+}
+
+static double bench_fork_join(job_system_t *system, uint32_t iterations) {
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < iterations; i++) {
+		bench_node_t root = { system, BENCH_TREE_DEPTH, 0.0f };
+		bench_tree(&root);
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / iterations;
+}
+
+static void bench_contention(job_system_t *system, uint64_t *stolen, uint64_t *attempts, uint64_t *contended) {
+	*stolen = 0;
+	*attempts = 0;
+	*contended = 0;
+	for (uint32_t i = 0; i < system->count; i++) {
+		*stolen += system->workers[i].stats.stolen.load();
+		*attempts += system->workers[i].stats.steal_attempts.load();
+		*contended += system->workers[i].stats.steal_contended.load();
+	}
+}
+
+int main(int argc, char **argv) {
+	uint32_t iterations = 10;
+	uint32_t max_workers = std::thread::hardware_concurrency();
+
+	for (int32_t i = 1; i + 1 < argc; i += 2) {
+		if (strcmp(argv[i], "-n") == 0)
+			iterations = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-t") == 0)
+			max_workers = atoi(argv[i + 1]);
+	}
+	if (iterations == 0 || max_workers == 0 || argc % 2 == 0) {
+		fprintf(stderr, "usage: %s [-n iterations] [-t max_workers]\n", argv[0]);
+		return 1;
+	}
+	max_workers = std::min(max_workers, (uint32_t)JOB_MAX_WORKERS);
+
+	bench_array_t array;
+	array.values = new float[BENCH_ELEMENTS];
+
+	double for_base = 0.0;
+	double tree_base = 0.0;
+	printf("%8s %10s %8s %10s %8s %10s %10s %10s\n", "workers", "for ms", "speedup",
+				 "tree ms", "speedup", "stolen", "attempts", "contended");
+	for (uint32_t workers = 1; workers <= max_workers; workers++) {
+		for (uint32_t i = 0; i < BENCH_ELEMENTS; i++)
+			array.values[i] = (float)i * 1e-6f;
+
+		job_system_t system;
+		job_system_create(&system, workers);
+		//Warm up the threads and caches before timing
+		bench_parallel_for(&system, &array, 1);
+		job_system_reset_stats(&system);
+
+		double for_ms = bench_parallel_for(&system, &array, iterations);
+		double tree_ms = bench_fork_join(&system, iterations);
+		if (workers == 1) {
+			for_base = for_ms;
+			tree_base = tree_ms;
+		}
+
+		uint64_t stolen, attempts, contended;
+		bench_contention(&system, &stolen, &attempts, &contended);
+		printf("%8u %10.2f %8.2f %10.2f %8.2f %10lu %10lu %9.1f%%\n", workers,
+					 for_ms, for_base / for_ms, tree_ms, tree_base / tree_ms,
+					 (unsigned long)stolen, (unsigned long)attempts,
+					 attempts > 0 ? 100.0 * contended / attempts : 0.0);
+		job_system_destroy(&system);
+	}
+
+	delete[] array.values;
+	return 0;
+}
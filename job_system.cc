@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+#include "job_system.hh"
+
+#define JOB_NO_WORKER (~0u)
+
+//Worker the calling thread is, in the system it belongs to
+static thread_local job_system_t *job_current_system = NULL;
+static thread_local uint32_t job_current_worker = JOB_NO_WORKER;
+static thread_local uint32_t job_random_state = 0;
+
+static uint32_t job_worker_index(job_system_t *system) {
+	return job_current_system == system ? job_current_worker : JOB_NO_WORKER;
+}
+
+//Xorshift: victims are picked at random so thieves spread over the deques
+static uint32_t job_random(void) {
+	if (job_random_state == 0)
+		job_random_state = std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+	job_random_state ^= job_random_state << 13;
+	job_random_state ^= job_random_state >> 17;
+	job_random_state ^= job_random_state << 5;
+	return job_random_state;
+}
+
+//Sleepers count themselves before checking the queue: seeing none, the pusher knows its job gets found
+static void job_push(job_system_t *system, const job_t *job) {
+	uint32_t worker = job_worker_index(system);
+	if (worker == JOB_NO_WORKER)
+		worker = system->next_victim.fetch_add(1, std::memory_order_relaxed) % system->count;
+
+	{
+		std::lock_guard<std::mutex> guard(system->workers[worker].lock);
+		system->workers[worker].jobs.push_back(*job);
+		system->queued.fetch_add(1);
+	}
+	if (system->sleepers.load() > 0) {
+		std::lock_guard<std::mutex> guard(system->sleep_lock);
+		system->wake.notify_one();
+	}
+}
+
+static bool job_pop(job_system_t *system, uint32_t worker, job_t *job) {
+	job_worker_t *owner = &system->workers[worker];
+	std::lock_guard<std::mutex> guard(owner->lock);
+	if (owner->jobs.empty())
+		return false;
+	*job = owner->jobs.back();
+	owner->jobs.pop_back();
+	system->queued.fetch_sub(1);
+	return true;
+}
+
+//A deque locked by someone else is skipped rather than waited on
+static bool job_steal(job_system_t *system, uint32_t thief, job_t *job) {
+	job_worker_stats_t *stats = thief != JOB_NO_WORKER ? &system->workers[thief].stats : NULL;
+	uint32_t start = job_random();
+
+	for (uint32_t i = 0; i < system->count; i++) {
+		uint32_t victim = (start + i) % system->count;
+		if (victim == thief)
+			continue;
+		job_worker_t *target = &system->workers[victim];
+		if (stats != NULL)
+			stats->steal_attempts.fetch_add(1, std::memory_order_relaxed);
+
+		std::unique_lock<std::mutex> guard(target->lock, std::try_to_lock);
+		if (!guard.owns_lock()) {
+			if (stats != NULL)
+				stats->steal_contended.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+		if (target->jobs.empty())
+			continue;
+		*job = target->jobs.front();
+		target->jobs.pop_front();
+		system->queued.fetch_sub(1);
+		if (stats != NULL)
+			stats->stolen.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Only the last decrement takes the lock: the continuations are released
+ * under it, and a waiter seeing zero takes it once before letting the
+ * counter go out of scope.
+ */
+static void job_counter_decrement(job_system_t *system, job_counter_t *counter) {
+	uint32_t pending = counter->pending.load();
+	while (pending > 1) {
+		if (counter->pending.compare_exchange_weak(pending, pending - 1))
+			return;
+	}
+
+	std::vector<job_t> continuations;
+	{
+		std::lock_guard<std::mutex> guard(counter->lock);
+		if (counter->pending.fetch_sub(1) == 1)
+			continuations.swap(counter->continuations);
+	}
+	for (const job_t &job : continuations)
+		job_push(system, &job);
+}
+
+static void job_run(job_system_t *system, uint32_t worker, const job_t *job) {
+	job->function(job->data);
+	if (worker != JOB_NO_WORKER)
+		system->workers[worker].stats.executed.fetch_add(1, std::memory_order_relaxed);
+	if (job->counter != NULL)
+		job_counter_decrement(system, job->counter);
+}
+
+static bool job_try_run(job_system_t *system, uint32_t worker) {
+	job_t job;
+	bool found = (worker != JOB_NO_WORKER && job_pop(system, worker, &job))
+		|| job_steal(system, worker, &job);
+	if (found)
+		job_run(system, worker, &job);
+	return found;
+}
+
+static void job_worker_main(job_system_t *system, uint32_t worker) {
+	job_current_system = system;
+	job_current_worker = worker;
+	job_worker_stats_t *stats = &system->workers[worker].stats;
+
+	uint32_t idle = 0;
+	while (!system->quit.load()) {
+		if (job_try_run(system, worker)) {
+			idle = 0;
+			continue;
+		}
+		if (++idle < JOB_SPIN_ROUNDS) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		system->sleepers.fetch_add(1);
+		{
+			std::unique_lock<std::mutex> guard(system->sleep_lock);
+			stats->sleeps.fetch_add(1, std::memory_order_relaxed);
+			system->wake.wait(guard, [system] {
+				return system->quit.load() || system->queued.load() > 0;
+			});
+		}
+		system->sleepers.fetch_sub(1);
+		idle = 0;
+	}
+}
+
+//The calling thread is worker 0: count - 1 threads are started
+void job_system_create(job_system_t *system, uint32_t count) {
+	count = std::max(1u, std::min(count, (uint32_t)JOB_MAX_WORKERS));
+	system->count = count;
+	system->workers = new job_worker_t[count];
+	system->next_victim = 0;
+	system->queued = 0;
+	system->sleepers = 0;
+	system->quit = false;
+	job_system_reset_stats(system);
+
+	job_current_system = system;
+	job_current_worker = 0;
+	for (uint32_t i = 1; i < count; i++)
+		system->workers[i].thread = std::thread(job_worker_main, system, i);
+}
+
+//Jobs still queued are dropped, wait on their counters first
+void job_system_destroy(job_system_t *system) {
+	{
+		std::lock_guard<std::mutex> guard(system->sleep_lock);
+		system->quit = true;
+	}
+	system->wake.notify_all();
+	for (uint32_t i = 1; i < system->count; i++)
+		system->workers[i].thread.join();
+
+	if (job_current_system == system) {
+		job_current_system = NULL;
+		job_current_worker = JOB_NO_WORKER;
+	}
+	delete[] system->workers;
+	system->workers = NULL;
+	system->count = 0;
+}
+
+void job_counter_init(job_counter_t *counter) {
+	counter->pending = 0;
+	counter->continuations.clear();
+}
+
+void job_submit(job_system_t *system, job_f function, void *data, job_counter_t *counter) {
+	if (counter != NULL)
+		counter->pending.fetch_add(1);
+	job_t job = { function, data, counter };
+	job_push(system, &job);
+}
+
+//Counts on the counter right away, queued once after reaches zero
+void job_submit_after(job_system_t *system, job_counter_t *after, job_f function, void *data,
+											job_counter_t *counter) {
+	if (counter != NULL)
+		counter->pending.fetch_add(1);
+	job_t job = { function, data, counter };
+
+	{
+		std::lock_guard<std::mutex> guard(after->lock);
+		if (after->pending.load() > 0) {
+			after->continuations.push_back(job);
+			return;
+		}
+	}
+	job_push(system, &job);
+}
+
+//Runs jobs until the counter reaches zero, any thread may wait
+void job_wait(job_system_t *system, job_counter_t *counter) {
+	uint32_t worker = job_worker_index(system);
+	while (counter->pending.load() > 0) {
+		if (!job_try_run(system, worker))
+			std::this_thread::yield();
+	}
+	std::lock_guard<std::mutex> guard(counter->lock);
+}
+
+struct job_range_t {
+	job_range_f function;
+	void *data;
+	uint32_t first;
+	uint32_t last;
+};
+
+static void job_range_run(void *data) {
+	job_range_t *range = (job_range_t*)data;
+	range->function(range->data, range->first, range->last);
+}
+
+/*
+ * Splits [0, count) in batches of the given size, 0 picks four batches per
+ * worker so stealing evens out uneven batches. Returns once all ran.
+ */
+void job_parallel_for(job_system_t *system, uint32_t count, uint32_t batch, job_range_f function, void *data) {
+	if (count == 0)
+		return;
+	if (batch == 0)
+		batch = std::max(1u, count / (system->count * 4));
+	if (system->count == 1 || batch >= count) {
+		function(data, 0, count);
+		return;
+	}
+
+	std::vector<job_range_t> ranges;
+	ranges.reserve((count + batch - 1) / batch);
+	for (uint32_t first = 0; first < count; first += batch)
+		ranges.push_back({ function, data, first, std::min(first + batch, count) });
+
+	job_counter_t counter;
+	job_counter_init(&counter);
+	//The caller runs the first batch itself, the others are up for grabs
+	for (uint32_t i = 1; i < ranges.size(); i++)
+		job_submit(system, job_range_run, &ranges[i], &counter);
+	job_range_run(&ranges[0]);
+	job_wait(system, &counter);
+}
+
+void job_system_reset_stats(job_system_t *system) {
+	for (uint32_t i = 0; i < system->count; i++) {
+		job_worker_stats_t *stats = &system->workers[i].stats;
+		stats->executed = 0;
+		stats->stolen = 0;
+		stats->steal_attempts = 0;
+		stats->steal_contended = 0;
+		stats->sleeps = 0;
+	}
+}
+
+void job_system_print_stats(job_system_t *system) {
+	printf("[INFO] Job system: %u workers\n", system->count);
+	printf("[INFO]   %6s %10s %10s %10s %10s %8s\n",
+				 "worker", "executed", "stolen", "attempts", "contended", "sleeps");
+	for (uint32_t i = 0; i < system->count; i++) {
+		job_worker_stats_t *stats = &system->workers[i].stats;
+		printf("[INFO]   %6u %10lu %10lu %10lu %10lu %8lu\n", i,
+					 (unsigned long)stats->executed.load(), (unsigned long)stats->stolen.load(),
+					 (unsigned long)stats->steal_attempts.load(), (unsigned long)stats->steal_contended.load(),
+					 (unsigned long)stats->sleeps.load());
+	}
+}
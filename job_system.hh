@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define JOB_MAX_WORKERS (64)
+//Failed pop and steal rounds before a worker goes to sleep
+#define JOB_SPIN_ROUNDS (64)
+
+struct job_counter_t;
+
+typedef void (*job_f)(void *data);
+//Handles elements [first, last) of a parallel for
+typedef void (*job_range_f)(void *data, uint32_t first, uint32_t last);
+
+struct job_t {
+	job_f function;
+	void *data;
+	//Decremented once the job ran, may be null
+	job_counter_t *counter;
+};
+
+/*
+ * Jobs left to finish. Jobs submitted after a counter run once it reaches
+ * zero, job_wait runs other jobs meanwhile. Reusable once back at zero.
+ */
+struct job_counter_t {
+	std::atomic<uint32_t> pending;
+	std::mutex lock;
+	std::vector<job_t> continuations;
+};
+
+//Written by the owning worker only, read once the system is idle
+struct job_worker_stats_t {
+	std::atomic<uint64_t> executed;
+	std::atomic<uint64_t> stolen;
+	std::atomic<uint64_t> steal_attempts;
+	//Victim deque locked by its owner or another thief
+	std::atomic<uint64_t> steal_contended;
+	std::atomic<uint64_t> sleeps;
+};
+
+/*
+ * The owner pushes and pops at the back, newest first: what it just spawned
+ * is still in its cache. Thieves take the oldest job at the front, leaving
+ * the owner its recent work.
+ */
+struct job_worker_t {
+	std::mutex lock;
+	std::deque<job_t> jobs;
+	std::thread thread;
+	job_worker_stats_t stats;
+};
+
+/*
+ * Work-stealing scheduler. Worker 0 is the thread creating the system: it
+ * runs jobs while waiting on a counter. Other threads may submit and wait,
+ * their jobs go round-robin to the workers.
+ */
+struct job_system_t {
+	uint32_t count;
+	job_worker_t *workers;
+	std::atomic<uint32_t> next_victim;
+
+	//Jobs sitting in a deque, sleepers wake when it moves off zero
+	std::atomic<uint32_t> queued;
+	std::atomic<uint32_t> sleepers;
+	std::mutex sleep_lock;
+	std::condition_variable wake;
+	std::atomic<bool> quit;
+};
+
+void job_system_create(job_system_t *system, uint32_t count);
+void job_system_destroy(job_system_t *system);
+
+void job_counter_init(job_counter_t *counter);
+void job_submit(job_system_t *system, job_f function, void *data, job_counter_t *counter);
+void job_submit_after(job_system_t *system, job_counter_t *after, job_f function, void *data,
+											job_counter_t *counter);
+void job_wait(job_system_t *system, job_counter_t *counter);
+
+void job_parallel_for(job_system_t *system, uint32_t count, uint32_t batch, job_range_f function, void *data);
+
+void job_system_reset_stats(job_system_t *system);
+void job_system_print_stats(job_system_t *system);
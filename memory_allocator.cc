@@ -0,0 +1,674 @@
+#include <algorithm>
+
+#include "memory_allocator.hh"
+#include "vulkan.hh"
+#include "vulkan_exception.hh"
+#include "vulkan_wrappers.hh"
+
+static uint32_t order_of(VkDeviceSize size) {
+	uint32_t order = MEMORY_MIN_ORDER;
+	while ((1ull << order) < size)
+		order++;
+	return order;
+}
+
+static VkDeviceSize floor_pow2(VkDeviceSize size) {
+	VkDeviceSize pow2 = 1;
+	while (pow2 * 2 <= size)
+		pow2 *= 2;
+	return pow2;
+}
+
+static bool is_host_visible(vulkan_info_t *info, uint32_t type) {
+	return info->memory_properties.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+}
+
+static memory_heap_stats_t* heap_stats(vulkan_info_t *info, uint32_t type) {
+	return &info->allocator.heaps[info->memory_properties.memoryTypes[type].heapIndex];
+}
+
+//Maps host visible memory for its whole lifetime, next extends the allocate info
+//Out of memory is returned so the caller may fall back to another type
+static VkResult device_allocate(vulkan_info_t *info, uint32_t type, VkDeviceSize size, const void *next,
+																VkDeviceMemory *memory, uint8_t **mapped) {
+	if (info->allocator.device_allocations >= info->device_properties.limits.maxMemoryAllocationCount)
+		throw VkException(VK_ERROR_TOO_MANY_OBJECTS);
+
+	VkMemoryAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.pNext = next;
+	alloc_info.allocationSize = size;
+	alloc_info.memoryTypeIndex = type;
+
+	VkResult res = vkAllocateMemory(info->device, &alloc_info, NULL, memory);
+	if (res == VK_ERROR_OUT_OF_DEVICE_MEMORY || res == VK_ERROR_OUT_OF_HOST_MEMORY)
+		return res;
+	if (res != VK_SUCCESS)
+		throw VkException(res);
+
+	*mapped = NULL;
+	if (is_host_visible(info, type)) {
+		res = vkMapMemory(info->device, *memory, 0, VK_WHOLE_SIZE, 0, (void**)mapped);
+		if (res != VK_SUCCESS) {
+			vkFreeMemory(info->device, *memory, NULL);
+			throw VkException(res);
+		}
+	}
+
+	info->allocator.device_allocations++;
+	return VK_SUCCESS;
+}
+
+static void device_free(vulkan_info_t *info, VkDeviceMemory memory) {
+	vkFreeMemory(info->device, memory, NULL);
+	info->allocator.device_allocations--;
+}
+
+//=========== BUDDY BLOCKS
+
+static memory_block_t* block_create(vulkan_info_t *info, memory_pool_t *pool, uint32_t type) {
+	VkDeviceMemory memory;
+	uint8_t *mapped;
+	if (device_allocate(info, type, pool->block_size, NULL, &memory, &mapped) != VK_SUCCESS)
+		return NULL;
+
+	memory_block_t *block = new memory_block_t();
+	block->memory = memory;
+	block->mapped = mapped;
+	block->used = 0;
+	block->allocations = 0;
+	block->free_lists.resize(pool->max_order - MEMORY_MIN_ORDER + 1);
+	block->free_lists[pool->max_order - MEMORY_MIN_ORDER].insert(0);
+
+	memory_heap_stats_t *stats = heap_stats(info, type);
+	stats->block_bytes += pool->block_size;
+	stats->block_count++;
+	pool->blocks.push_back(block);
+	return block;
+}
+
+//Splits the smallest free buddy able to hold the order, lowest offset first
+static bool block_alloc(memory_pool_t *pool, memory_block_t *block, uint32_t order, VkDeviceSize *offset) {
+	uint32_t found = order;
+	while (found <= pool->max_order && block->free_lists[found - MEMORY_MIN_ORDER].empty())
+		found++;
+	if (found > pool->max_order)
+		return false;
+
+	std::set<VkDeviceSize> &list = block->free_lists[found - MEMORY_MIN_ORDER];
+	*offset = *list.begin();
+	list.erase(list.begin());
+
+	while (found > order) {
+		found--;
+		block->free_lists[found - MEMORY_MIN_ORDER].insert(*offset + (1ull << found));
+	}
+
+	block->used += 1ull << order;
+	block->allocations++;
+	return true;
+}
+
+//Merges the buddy back with its sibling as long as the sibling is free
+static void block_free(memory_pool_t *pool, memory_block_t *block, VkDeviceSize offset, uint32_t order) {
+	block->used -= 1ull << order;
+	block->allocations--;
+
+	while (order < pool->max_order) {
+		std::set<VkDeviceSize> &list = block->free_lists[order - MEMORY_MIN_ORDER];
+		auto buddy = list.find(offset ^ (1ull << order));
+		if (buddy == list.end())
+			break;
+		list.erase(buddy);
+		offset &= ~(1ull << order);
+		order++;
+	}
+	block->free_lists[order - MEMORY_MIN_ORDER].insert(offset);
+}
+
+static void block_destroy(vulkan_info_t *info, memory_pool_t *pool, memory_block_t *block, uint32_t type) {
+	device_free(info, block->memory);
+
+	memory_heap_stats_t *stats = heap_stats(info, type);
+	stats->block_bytes -= pool->block_size;
+	stats->block_count--;
+	delete block;
+}
+
+//=========== MEMORY TYPES
+
+struct memory_usage_desc_t {
+	VkMemoryPropertyFlags required;
+	VkMemoryPropertyFlags preferred;
+	VkMemoryPropertyFlags avoided;
+};
+
+/*
+ * GPU_ONLY does not require DEVICE_LOCAL: a device without room or type for it
+ * still runs from system memory. UPLOAD avoids DEVICE_LOCAL to leave the small
+ * BAR heap to DYNAMIC, which reads it in place instead of across the bus.
+ * Both require HOST_COHERENT: the host writes through the mappings are never
+ * flushed.
+ */
+static const memory_usage_desc_t usage_descs[MEMORY_USAGE_COUNT] = {
+	//MEMORY_USAGE_GPU_ONLY
+	{ 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT },
+	//MEMORY_USAGE_TRANSIENT
+	{ 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT },
+	//MEMORY_USAGE_UPLOAD
+	{ VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT },
+	//MEMORY_USAGE_DYNAMIC
+	{ VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT },
+};
+
+static int32_t type_score(vulkan_info_t *info, const memory_usage_desc_t *desc, uint32_t type) {
+	VkMemoryPropertyFlags flags = info->memory_properties.memoryTypes[type].propertyFlags;
+	return __builtin_popcount(flags & desc->preferred) - __builtin_popcount(flags & desc->avoided);
+}
+
+static VkDeviceSize type_heap_size(vulkan_info_t *info, uint32_t type) {
+	return info->memory_properties.memoryHeaps[info->memory_properties.memoryTypes[type].heapIndex].size;
+}
+
+//Best score first, the larger heap breaking ties
+static void rank_memory_types(vulkan_info_t *info, memory_usage_e usage) {
+	memory_allocator_t *allocator = &info->allocator;
+	const memory_usage_desc_t *desc = &usage_descs[usage];
+	uint32_t *ranking = allocator->ranking[usage];
+	uint32_t count = 0;
+
+	for (uint32_t type = 0; type < info->memory_properties.memoryTypeCount; type++) {
+		if ((info->memory_properties.memoryTypes[type].propertyFlags & desc->required) == desc->required)
+			ranking[count++] = type;
+	}
+
+	std::stable_sort(ranking, ranking + count, [info, desc](uint32_t a, uint32_t b) {
+		int32_t score_a = type_score(info, desc, a);
+		int32_t score_b = type_score(info, desc, b);
+		if (score_a != score_b)
+			return score_a > score_b;
+		return type_heap_size(info, a) > type_heap_size(info, b);
+	});
+	allocator->ranking_count[usage] = count;
+}
+
+//=========== ALLOCATOR
+
+void memory_allocator_create(vulkan_info_t *info) {
+	memory_allocator_t *allocator = &info->allocator;
+	allocator->device_allocations = 0;
+	allocator->generation = 0;
+
+	for (uint32_t i = 0; i < VK_MAX_MEMORY_HEAPS; i++)
+		allocator->heaps[i] = { };
+
+	for (uint32_t type = 0; type < info->memory_properties.memoryTypeCount; type++) {
+		uint32_t heap = info->memory_properties.memoryTypes[type].heapIndex;
+		VkDeviceSize heap_size = info->memory_properties.memoryHeaps[heap].size;
+		VkDeviceSize block_size = std::min(MEMORY_BLOCK_SIZE, floor_pow2(heap_size / 8));
+		block_size = std::max(block_size, (VkDeviceSize)1 << MEMORY_MIN_ORDER);
+
+		for (uint32_t kind = 0; kind < MEMORY_KIND_COUNT; kind++) {
+			memory_pool_t *pool = &allocator->pools[type][kind];
+			pool->block_size = block_size;
+			pool->max_order = order_of(block_size);
+		}
+	}
+
+	for (uint32_t usage = 0; usage < MEMORY_USAGE_COUNT; usage++)
+		rank_memory_types(info, (memory_usage_e)usage);
+}
+
+void memory_allocator_destroy(vulkan_info_t *info) {
+	memory_allocator_t *allocator = &info->allocator;
+	std::lock_guard<std::mutex> guard(allocator->lock);
+
+	for (uint32_t type = 0; type < info->memory_properties.memoryTypeCount; type++) {
+		for (uint32_t kind = 0; kind < MEMORY_KIND_COUNT; kind++) {
+			memory_pool_t *pool = &allocator->pools[type][kind];
+			for (memory_block_t *block : pool->blocks) {
+				if (block->allocations > 0)
+					fprintf(stderr, "[WARNING] %u allocations leaked in memory type %u\n",
+									block->allocations, type);
+				block_destroy(info, pool, block, type);
+			}
+			pool->blocks.clear();
+		}
+	}
+}
+
+/*
+ * Non-coherent host visible memory is flushed and invalidated in whole atoms:
+ * buddies there span at least nonCoherentAtomSize, aligned on their size, so
+ * no atom is shared between two allocations.
+ */
+static uint32_t allocation_order(vulkan_info_t *info, const VkMemoryRequirements *requirements, uint32_t type) {
+	VkDeviceSize size = std::max(requirements->size, requirements->alignment);
+	VkMemoryPropertyFlags flags = info->memory_properties.memoryTypes[type].propertyFlags;
+	if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+		size = std::max(size, info->device_properties.limits.nonCoherentAtomSize);
+	return order_of(size);
+}
+
+//Own VkDeviceMemory, next carries the dedicated allocate info when the driver asked for it
+static bool alloc_dedicated(vulkan_info_t *info, const VkMemoryRequirements *requirements, uint32_t type,
+														memory_kind_e kind, memory_category_e category, const void *next,
+														gpu_allocation_t *allocation) {
+	if (device_allocate(info, type, requirements->size, next, &allocation->memory, &allocation->mapped) != VK_SUCCESS)
+		return false;
+
+	memory_heap_stats_t *stats = heap_stats(info, type);
+	allocation->memory_type = type;
+	allocation->kind = kind;
+	allocation->category = category;
+	allocation->size = requirements->size;
+	allocation->offset = 0;
+	allocation->block = NULL;
+	allocation->order = 0;
+	stats->dedicated_bytes += requirements->size;
+	stats->dedicated_count++;
+	stats->category_bytes[category] += requirements->size;
+	return true;
+}
+
+//False when the type's heap is out of memory
+static bool alloc_from_type(vulkan_info_t *info, const VkMemoryRequirements *requirements, uint32_t type,
+														memory_kind_e kind, memory_category_e category, gpu_allocation_t *allocation) {
+	memory_allocator_t *allocator = &info->allocator;
+	memory_pool_t *pool = &allocator->pools[type][kind];
+	memory_heap_stats_t *stats = heap_stats(info, type);
+	uint32_t order = allocation_order(info, requirements, type);
+
+	if (order >= pool->max_order)
+		return alloc_dedicated(info, requirements, type, kind, category, NULL, allocation);
+
+	allocation->memory_type = type;
+	allocation->kind = kind;
+	allocation->category = category;
+	allocation->size = requirements->size;
+
+	//Buddies are aligned on their own size, which covers the alignment requirement
+	VkDeviceSize offset = 0;
+	memory_block_t *block = NULL;
+	for (memory_block_t *candidate : pool->blocks) {
+		if (block_alloc(pool, candidate, order, &offset)) {
+			block = candidate;
+			break;
+		}
+	}
+	if (block == NULL) {
+		block = block_create(info, pool, type);
+		if (block == NULL)
+			return false;
+		bool success = block_alloc(pool, block, order, &offset);
+		assert(success);
+		(void)success;
+	}
+
+	allocation->memory = block->memory;
+	allocation->offset = offset;
+	allocation->mapped = block->mapped != NULL ? block->mapped + offset : NULL;
+	allocation->block = block;
+	allocation->order = order;
+	stats->used_bytes += 1ull << order;
+	stats->requested_bytes += requirements->size;
+	stats->allocation_count++;
+	stats->category_bytes[category] += requirements->size;
+	return true;
+}
+
+/*
+ * Tries the memory types ranked for the usage in order: a full heap falls back
+ * to the next best type instead of failing, a usage no type can satisfy throws.
+ * A dedicated allocate info skips the blocks. The lock must be held.
+ */
+static void alloc_ranked(vulkan_info_t *info, const VkMemoryRequirements *requirements,
+												 memory_usage_e usage, memory_kind_e kind, memory_category_e category,
+												 const void *dedicated, gpu_allocation_t *allocation) {
+	memory_allocator_t *allocator = &info->allocator;
+	allocator->generation++;
+
+	bool candidate = false;
+	for (uint32_t i = 0; i < allocator->ranking_count[usage]; i++) {
+		uint32_t type = allocator->ranking[usage][i];
+		if (!(requirements->memoryTypeBits & (1u << type)))
+			continue;
+		if (dedicated != NULL
+				? alloc_dedicated(info, requirements, type, kind, category, dedicated, allocation)
+				: alloc_from_type(info, requirements, type, kind, category, allocation))
+			return;
+		candidate = true;
+#ifdef LOG_VERBOSE
+		printf("[INFO] Memory type %u exhausted, falling back\n", type);
+#endif
+	}
+
+	throw VkException(candidate ? VK_ERROR_OUT_OF_DEVICE_MEMORY : VK_ERROR_FEATURE_NOT_PRESENT);
+}
+
+void memory_alloc(vulkan_info_t *info, const VkMemoryRequirements *requirements,
+									memory_usage_e usage, memory_kind_e kind, memory_category_e category,
+									gpu_allocation_t *allocation) {
+	std::lock_guard<std::mutex> guard(info->allocator.lock);
+	alloc_ranked(info, requirements, usage, kind, category, NULL, allocation);
+}
+
+/*
+ * Defragmentation target for `from`: a buddy of the same order in another block
+ * of its pool at least as used as its own. Blocks are never created here.
+ */
+bool memory_alloc_relocation(vulkan_info_t *info, const gpu_allocation_t *from,
+														 const VkMemoryRequirements *requirements, gpu_allocation_t *to) {
+	if (from->block == NULL || !(requirements->memoryTypeBits & (1u << from->memory_type)))
+		return false;
+	if (allocation_order(info, requirements, from->memory_type) != from->order)
+		return false;
+
+	memory_allocator_t *allocator = &info->allocator;
+	std::lock_guard<std::mutex> guard(allocator->lock);
+	memory_pool_t *pool = &allocator->pools[from->memory_type][from->kind];
+
+	std::vector<memory_block_t*> targets;
+	for (memory_block_t *block : pool->blocks) {
+		if (block != from->block && block->used >= from->block->used)
+			targets.push_back(block);
+	}
+	std::sort(targets.begin(), targets.end(), [](memory_block_t *a, memory_block_t *b) {
+		return a->used > b->used;
+	});
+
+	VkDeviceSize offset = 0;
+	for (memory_block_t *block : targets) {
+		if (!block_alloc(pool, block, from->order, &offset))
+			continue;
+
+		*to = *from;
+		to->size = requirements->size;
+		to->memory = block->memory;
+		to->offset = offset;
+		to->mapped = block->mapped != NULL ? block->mapped + offset : NULL;
+		to->block = block;
+
+		memory_heap_stats_t *stats = heap_stats(info, from->memory_type);
+		allocator->generation++;
+		stats->used_bytes += 1ull << from->order;
+		stats->requested_bytes += requirements->size;
+		stats->allocation_count++;
+		stats->category_bytes[from->category] += requirements->size;
+		return true;
+	}
+	return false;
+}
+
+//Least used block of the pool, only when another non-empty block could absorb it
+memory_block_t* memory_sparsest_block(vulkan_info_t *info, uint32_t type, uint32_t kind) {
+	std::lock_guard<std::mutex> guard(info->allocator.lock);
+	memory_pool_t *pool = &info->allocator.pools[type][kind];
+
+	memory_block_t *sparsest = NULL;
+	uint32_t used_blocks = 0;
+	for (memory_block_t *block : pool->blocks) {
+		if (block->allocations == 0)
+			continue;
+		used_blocks++;
+		if (sparsest == NULL || block->used < sparsest->used)
+			sparsest = block;
+	}
+	return used_blocks > 1 ? sparsest : NULL;
+}
+
+uint64_t memory_generation(vulkan_info_t *info) {
+	std::lock_guard<std::mutex> guard(info->allocator.lock);
+	return info->allocator.generation;
+}
+
+void memory_free(vulkan_info_t *info, gpu_allocation_t *allocation) {
+	if (allocation->memory == VK_NULL_HANDLE)
+		return;
+
+	memory_allocator_t *allocator = &info->allocator;
+	std::lock_guard<std::mutex> guard(allocator->lock);
+	memory_heap_stats_t *stats = heap_stats(info, allocation->memory_type);
+	stats->category_bytes[allocation->category] -= allocation->size;
+	allocator->generation++;
+
+	if (allocation->block == NULL) {
+		device_free(info, allocation->memory);
+		stats->dedicated_bytes -= allocation->size;
+		stats->dedicated_count--;
+	} else {
+		memory_pool_t *pool = &allocator->pools[allocation->memory_type][allocation->kind];
+		memory_block_t *block = allocation->block;
+		block_free(pool, block, allocation->offset, allocation->order);
+
+		//One empty block is kept around to absorb alloc/free churn
+		bool spare = std::any_of(pool->blocks.begin(), pool->blocks.end(), [block](memory_block_t *b) {
+			return b != block && b->allocations == 0;
+		});
+		if (block->allocations == 0 && spare) {
+			pool->blocks.erase(std::find(pool->blocks.begin(), pool->blocks.end(), block));
+			block_destroy(info, pool, block, allocation->memory_type);
+		}
+
+		stats->used_bytes -= 1ull << allocation->order;
+		stats->requested_bytes -= allocation->size;
+		stats->allocation_count--;
+	}
+
+	*allocation = { };
+}
+
+#if defined(VK_KHR_dedicated_allocation) && defined(VK_KHR_get_memory_requirements2)
+/*
+ * Allocates alone what the driver prefers or requires alone: large render
+ * targets and buffers it would otherwise place or compress worse.
+ * False when the driver has no such preference.
+ */
+static bool alloc_dedicated_resource(vulkan_info_t *info, const VkMemoryRequirements *requirements,
+																		 const VkMemoryDedicatedRequirementsKHR *dedicated,
+																		 VkBuffer buffer, VkImage image, memory_usage_e usage, memory_kind_e kind,
+																		 memory_category_e category, gpu_allocation_t *allocation) {
+	if (!dedicated->prefersDedicatedAllocation && !dedicated->requiresDedicatedAllocation)
+		return false;
+
+	VkMemoryDedicatedAllocateInfoKHR dedicated_info = { };
+	dedicated_info.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO_KHR;
+	dedicated_info.pNext = NULL;
+	dedicated_info.image = image;
+	dedicated_info.buffer = buffer;
+
+	std::lock_guard<std::mutex> guard(info->allocator.lock);
+	alloc_ranked(info, requirements, usage, kind, category, &dedicated_info, allocation);
+	return true;
+}
+#endif
+
+//Dedicated when the driver prefers it, from the blocks otherwise
+static void alloc_buffer(vulkan_info_t *info, VkBuffer buffer, memory_usage_e usage,
+												 memory_category_e category, gpu_allocation_t *allocation) {
+#if defined(VK_KHR_dedicated_allocation) && defined(VK_KHR_get_memory_requirements2)
+	if (info->dedicated_allocation) {
+		VkMemoryDedicatedRequirementsKHR dedicated = { };
+		dedicated.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS_KHR;
+		dedicated.pNext = NULL;
+
+		VkMemoryRequirements2KHR requirements = { };
+		requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2_KHR;
+		requirements.pNext = &dedicated;
+
+		VkBufferMemoryRequirementsInfo2KHR requirements_info = { };
+		requirements_info.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2_KHR;
+		requirements_info.pNext = NULL;
+		requirements_info.buffer = buffer;
+		info->get_buffer_memory_requirements2(info->device, &requirements_info, &requirements);
+
+		if (!alloc_dedicated_resource(info, &requirements.memoryRequirements, &dedicated, buffer, VK_NULL_HANDLE,
+																	usage, MEMORY_KIND_LINEAR, category, allocation))
+			memory_alloc(info, &requirements.memoryRequirements, usage, MEMORY_KIND_LINEAR, category, allocation);
+		return;
+	}
+#endif
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(info->device, buffer, &requirements);
+	memory_alloc(info, &requirements, usage, MEMORY_KIND_LINEAR, category, allocation);
+}
+
+void memory_bind_buffer(vulkan_info_t *info, VkBuffer buffer, memory_usage_e usage,
+												memory_category_e category, gpu_allocation_t *allocation) {
+	alloc_buffer(info, buffer, usage, category, allocation);
+
+	VkResult res = vkBindBufferMemory(info->device, buffer, allocation->memory, allocation->offset);
+	if (res != VK_SUCCESS)
+		throw VkException(res);
+}
+
+static void alloc_image(vulkan_info_t *info, VkImage image, memory_usage_e usage, memory_kind_e kind,
+												memory_category_e category, gpu_allocation_t *allocation) {
+#if defined(VK_KHR_dedicated_allocation) && defined(VK_KHR_get_memory_requirements2)
+	if (info->dedicated_allocation) {
+		VkMemoryDedicatedRequirementsKHR dedicated = { };
+		dedicated.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS_KHR;
+		dedicated.pNext = NULL;
+
+		VkMemoryRequirements2KHR requirements = { };
+		requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2_KHR;
+		requirements.pNext = &dedicated;
+
+		VkImageMemoryRequirementsInfo2KHR requirements_info = { };
+		requirements_info.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2_KHR;
+		requirements_info.pNext = NULL;
+		requirements_info.image = image;
+		info->get_image_memory_requirements2(info->device, &requirements_info, &requirements);
+
+		if (!alloc_dedicated_resource(info, &requirements.memoryRequirements, &dedicated, VK_NULL_HANDLE, image,
+																	usage, kind, category, allocation))
+			memory_alloc(info, &requirements.memoryRequirements, usage, kind, category, allocation);
+		return;
+	}
+#endif
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(info->device, image, &requirements);
+	memory_alloc(info, &requirements, usage, kind, category, allocation);
+}
+
+void memory_bind_image(vulkan_info_t *info, VkImage image, VkImageTiling tiling,
+											 memory_usage_e usage, memory_category_e category,
+											 gpu_allocation_t *allocation) {
+	memory_kind_e kind = tiling == VK_IMAGE_TILING_OPTIMAL ? MEMORY_KIND_OPTIMAL : MEMORY_KIND_LINEAR;
+	alloc_image(info, image, usage, kind, category, allocation);
+
+	VkResult res = vkBindImageMemory(info->device, image, allocation->memory, allocation->offset);
+	if (res != VK_SUCCESS)
+		throw VkException(res);
+}
+
+//=========== STATS
+
+void memory_get_heap_stats(vulkan_info_t *info, uint32_t heap, memory_heap_stats_t *stats) {
+	std::lock_guard<std::mutex> guard(info->allocator.lock);
+	*stats = info->allocator.heaps[heap];
+}
+
+//Free bytes scattered in blocks, and the largest buddy a single allocation could get
+void memory_get_fragmentation(vulkan_info_t *info, uint32_t heap, memory_fragmentation_t *fragmentation) {
+	std::lock_guard<std::mutex> guard(info->allocator.lock);
+	*fragmentation = { };
+
+	for (uint32_t type = 0; type < info->memory_properties.memoryTypeCount; type++) {
+		if (info->memory_properties.memoryTypes[type].heapIndex != heap)
+			continue;
+
+		for (uint32_t kind = 0; kind < MEMORY_KIND_COUNT; kind++) {
+			memory_pool_t *pool = &info->allocator.pools[type][kind];
+			for (memory_block_t *block : pool->blocks) {
+				fragmentation->free_bytes += pool->block_size - block->used;
+				fragmentation->block_count++;
+				for (uint32_t order = pool->max_order; order >= MEMORY_MIN_ORDER; order--) {
+					if (!block->free_lists[order - MEMORY_MIN_ORDER].empty()) {
+						fragmentation->largest_free = std::max(fragmentation->largest_free, (VkDeviceSize)1 << order);
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+
+#ifdef VK_EXT_memory_budget
+static bool memory_query_budget(vulkan_info_t *info, memory_budget_t *budgets) {
+	if (!info->memory_budget)
+		return false;
+
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR get_properties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)
+		vkGetInstanceProcAddr(info->instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+	if (get_properties2 == NULL)
+		return false;
+
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = { };
+	budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+	budget.pNext = NULL;
+
+	VkPhysicalDeviceMemoryProperties2KHR properties = { };
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+	properties.pNext = &budget;
+	get_properties2(info->physical_device, &properties);
+
+	for (uint32_t i = 0; i < info->memory_properties.memoryHeapCount; i++) {
+		budgets[i].usage = budget.heapUsage[i];
+		budgets[i].budget = budget.heapBudget[i];
+	}
+	return true;
+}
+#endif
+
+void memory_get_budget(vulkan_info_t *info, memory_budget_t budgets[VK_MAX_MEMORY_HEAPS]) {
+#ifdef VK_EXT_memory_budget
+	if (memory_query_budget(info, budgets))
+		return;
+#endif
+
+	std::lock_guard<std::mutex> guard(info->allocator.lock);
+	for (uint32_t i = 0; i < info->memory_properties.memoryHeapCount; i++) {
+		const memory_heap_stats_t *s = &info->allocator.heaps[i];
+		budgets[i].usage = s->block_bytes + s->dedicated_bytes;
+		budgets[i].budget = info->memory_properties.memoryHeaps[i].size;
+	}
+}
+
+static const char *category_names[MEMORY_CATEGORY_COUNT] = {
+	"textures", "geometry", "uniforms", "attachments", "staging",
+};
+
+void memory_print_stats(vulkan_info_t *info) {
+	const VkDeviceSize mb = 1 << 20;
+	memory_budget_t budgets[VK_MAX_MEMORY_HEAPS];
+	memory_get_budget(info, budgets);
+
+	std::lock_guard<std::mutex> guard(info->allocator.lock);
+
+	printf("[INFO] Device memory: %u vkAllocateMemory (limit %u), budget %s\n",
+				 info->allocator.device_allocations, info->device_properties.limits.maxMemoryAllocationCount,
+				 info->memory_budget ? "from VK_EXT_memory_budget" : "is the heap size");
+	for (uint32_t i = 0; i < info->memory_properties.memoryHeapCount; i++) {
+		const memory_heap_stats_t *s = &info->allocator.heaps[i];
+		bool local = info->memory_properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+		printf("[INFO]   heap %u (%s): %llu/%llu MB used of the budget\n", i, local ? "device" : "host",
+					 (unsigned long long)(budgets[i].usage / mb), (unsigned long long)(budgets[i].budget / mb));
+		printf("[INFO]     %llu/%llu MB in %u blocks (%u allocations, %llu MB requested), "
+					 "%u dedicated %llu MB\n",
+					 (unsigned long long)(s->used_bytes / mb), (unsigned long long)(s->block_bytes / mb),
+					 s->block_count, s->allocation_count, (unsigned long long)(s->requested_bytes / mb),
+					 s->dedicated_count, (unsigned long long)(s->dedicated_bytes / mb));
+
+		printf("[INFO]    ");
+		for (uint32_t c = 0; c < MEMORY_CATEGORY_COUNT; c++)
+			printf(" %s %.1f MB", category_names[c], (double)s->category_bytes[c] / mb);
+		printf("\n");
+	}
+}
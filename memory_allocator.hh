@@ -0,0 +1,139 @@
+#pragma once
+
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "types.hh"
+
+struct vulkan_info_t;
+
+//Largest block carved by the buddy allocator, smaller heaps use an eighth of their size
+#define MEMORY_BLOCK_SIZE ((VkDeviceSize)64 << 20)
+//Smallest buddy, 256 bytes
+#define MEMORY_MIN_ORDER (8)
+
+/*
+ * Buffers and linear images never share a block with optimal images,
+ * so bufferImageGranularity never has to be checked between neighbours.
+ */
+enum memory_kind_e {
+	MEMORY_KIND_LINEAR,
+	MEMORY_KIND_OPTIMAL,
+	MEMORY_KIND_COUNT
+};
+
+//What an allocation is used for, accounted per heap
+enum memory_category_e {
+	MEMORY_CATEGORY_TEXTURE,
+	MEMORY_CATEGORY_GEOMETRY,
+	MEMORY_CATEGORY_UNIFORM,
+	MEMORY_CATEGORY_ATTACHMENT,
+	MEMORY_CATEGORY_STAGING,
+	MEMORY_CATEGORY_COUNT
+};
+
+/*
+ * What the memory is for rather than its property flags. Each usage ranks the
+ * memory types by required, preferred and avoided flags, see usage_descs.
+ * Allocations walk that ranking, falling back when a heap is full.
+ */
+enum memory_usage_e {
+	//Read by the GPU only: textures, static geometry
+	MEMORY_USAGE_GPU_ONLY,
+	//Attachments neither loaded nor stored, lazily allocated on tilers
+	MEMORY_USAGE_TRANSIENT,
+	//Written once by the host then copied, kept out of the device local heaps
+	MEMORY_USAGE_UPLOAD,
+	//Rewritten by the host every frame and read in place, device local with a resizable BAR
+	MEMORY_USAGE_DYNAMIC,
+	MEMORY_USAGE_COUNT
+};
+
+struct memory_block_t {
+	VkDeviceMemory memory;
+	uint8_t *mapped;
+	VkDeviceSize used;
+	uint32_t allocations;
+	//Free buddy offsets, indexed by order - MEMORY_MIN_ORDER
+	std::vector<std::set<VkDeviceSize>> free_lists;
+};
+
+struct memory_pool_t {
+	VkDeviceSize block_size;
+	uint32_t max_order;
+	std::vector<memory_block_t*> blocks;
+};
+
+struct memory_heap_stats_t {
+	VkDeviceSize block_bytes;
+	VkDeviceSize used_bytes;
+	VkDeviceSize requested_bytes;
+	VkDeviceSize dedicated_bytes;
+	uint32_t block_count;
+	uint32_t allocation_count;
+	uint32_t dedicated_count;
+	//Requested bytes, block and dedicated allocations alike
+	VkDeviceSize category_bytes[MEMORY_CATEGORY_COUNT];
+};
+
+struct memory_fragmentation_t {
+	VkDeviceSize free_bytes;
+	VkDeviceSize largest_free;
+	uint32_t block_count;
+};
+
+/*
+ * With VK_EXT_memory_budget, usage covers every process on the heap and budget
+ * is the driver estimate. Without it, usage is what this allocator holds and
+ * budget the full heap size.
+ */
+struct memory_budget_t {
+	VkDeviceSize usage;
+	VkDeviceSize budget;
+};
+
+/*
+ * Buddy sub-allocator with a pool per memory type and kind.
+ * Resources larger than half a block get their own VkDeviceMemory, as do
+ * those the driver prefers alone with VK_KHR_dedicated_allocation.
+ * Host visible memory is mapped once for its whole lifetime.
+ * All entry points may be called from the loader threads.
+ */
+struct memory_allocator_t {
+	std::mutex lock;
+	memory_pool_t pools[VK_MAX_MEMORY_TYPES][MEMORY_KIND_COUNT];
+	memory_heap_stats_t heaps[VK_MAX_MEMORY_HEAPS];
+	uint32_t device_allocations;
+	//Bumped by every allocation and free
+	uint64_t generation;
+	//Memory types satisfying each usage, best first, ranked once at creation
+	uint32_t ranking[MEMORY_USAGE_COUNT][VK_MAX_MEMORY_TYPES];
+	uint32_t ranking_count[MEMORY_USAGE_COUNT];
+};
+
+void memory_allocator_create(vulkan_info_t *info);
+void memory_allocator_destroy(vulkan_info_t *info);
+
+void memory_alloc(vulkan_info_t *info, const VkMemoryRequirements *requirements,
+									memory_usage_e usage, memory_kind_e kind, memory_category_e category,
+									gpu_allocation_t *allocation);
+void memory_free(vulkan_info_t *info, gpu_allocation_t *allocation);
+
+bool memory_alloc_relocation(vulkan_info_t *info, const gpu_allocation_t *from,
+														 const VkMemoryRequirements *requirements, gpu_allocation_t *to);
+memory_block_t* memory_sparsest_block(vulkan_info_t *info, uint32_t type, uint32_t kind);
+uint64_t memory_generation(vulkan_info_t *info);
+
+void memory_bind_buffer(vulkan_info_t *info, VkBuffer buffer, memory_usage_e usage,
+												memory_category_e category, gpu_allocation_t *allocation);
+void memory_bind_image(vulkan_info_t *info, VkImage image, VkImageTiling tiling,
+											 memory_usage_e usage, memory_category_e category,
+											 gpu_allocation_t *allocation);
+
+void memory_get_heap_stats(vulkan_info_t *info, uint32_t heap, memory_heap_stats_t *stats);
+void memory_get_fragmentation(vulkan_info_t *info, uint32_t heap, memory_fragmentation_t *fragmentation);
+void memory_get_budget(vulkan_info_t *info, memory_budget_t budgets[VK_MAX_MEMORY_HEAPS]);
+void memory_print_stats(vulkan_info_t *info);
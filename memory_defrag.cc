@@ -0,0 +1,472 @@
+#include <algorithm>
+#include <chrono>
+#include <map>
+
+#include "memory_defrag.hh"
+#include "vulkan.hh"
+#include "vulkan_exception.hh"
+#include "vulkan_wrappers.hh"
+
+//=========== MOVES
+
+//Stages and accesses a buffer of the usage may be used with
+static void buffer_usage_access(VkBufferUsageFlags usage, VkPipelineStageFlags *stages,
+																VkAccessFlags *access, VkAccessFlags *writes) {
+	*stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	*access = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	*writes = VK_ACCESS_TRANSFER_WRITE_BIT;
+	if (usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT) {
+		*stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+		*access |= VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+	}
+	if (usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT) {
+		*stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+		*access |= VK_ACCESS_INDEX_READ_BIT;
+	}
+	if (usage & VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT) {
+		*stages |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+		*access |= VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	}
+	if (usage & (VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)) {
+		*stages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		*access |= VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	}
+	if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) {
+		*access |= VK_ACCESS_SHADER_WRITE_BIT;
+		*writes |= VK_ACCESS_SHADER_WRITE_BIT;
+	}
+}
+
+//Builds the replacement resource inside a fuller block, false when nothing fits
+static bool defrag_prepare(vulkan_info_t *info, defrag_resource_t *resource, defrag_move_t *move) {
+	VkResult res = VK_SUCCESS;
+	VkMemoryRequirements requirements;
+
+	move->resource = resource;
+	move->buffer = VK_NULL_HANDLE;
+	move->image = VK_NULL_HANDLE;
+
+	if (resource->type == DEFRAG_RESOURCE_BUFFER) {
+		res = vkCreateBuffer(info->device, &resource->buffer_info, NULL, &move->buffer);
+		if (res != VK_SUCCESS)
+			throw VkException(res);
+		vkGetBufferMemoryRequirements(info->device, move->buffer, &requirements);
+	} else {
+		res = vkCreateImage(info->device, &resource->image_info, NULL, &move->image);
+		if (res != VK_SUCCESS)
+			throw VkException(res);
+		vkGetImageMemoryRequirements(info->device, move->image, &requirements);
+	}
+
+	if (!memory_alloc_relocation(info, resource->allocation, &requirements, &move->allocation)) {
+		vkDestroyBuffer(info->device, move->buffer, NULL);
+		vkDestroyImage(info->device, move->image, NULL);
+		return false;
+	}
+
+	if (resource->type == DEFRAG_RESOURCE_BUFFER)
+		res = vkBindBufferMemory(info->device, move->buffer, move->allocation.memory, move->allocation.offset);
+	else
+		res = vkBindImageMemory(info->device, move->image, move->allocation.memory, move->allocation.offset);
+	if (res != VK_SUCCESS)
+		throw VkException(res);
+	return true;
+}
+
+static void defrag_discard(vulkan_info_t *info, defrag_move_t *move) {
+	vkDestroyBuffer(info->device, move->buffer, NULL);
+	vkDestroyImage(info->device, move->image, NULL);
+	memory_free(info, &move->allocation);
+}
+
+//Once the graphic timeline reaches the value
+static void defrag_discard_later(vulkan_info_t *info, defrag_move_t *move, uint64_t value) {
+	if (move->buffer != VK_NULL_HANDLE) {
+		data_buffer_t buffer = { };
+		buffer.buffer = move->buffer;
+		buffer.allocation = move->allocation;
+		deferred_destroy_buffer(info, &buffer, value);
+	} else
+		deferred_destroy_image(info, move->image, VK_NULL_HANDLE, &move->allocation, value);
+}
+
+static void defrag_image_barrier(VkCommandBuffer command, defrag_resource_t *resource, VkImage image,
+																 VkImageLayout old_layout, VkImageLayout new_layout,
+																 VkAccessFlags src_access, VkAccessFlags dst_access,
+																 VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage) {
+	VkImageMemoryBarrier barrier = { };
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.pNext = NULL;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+	barrier.oldLayout = old_layout;
+	barrier.newLayout = new_layout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = resource->aspect;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = resource->image_info.mipLevels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+
+	vkCmdPipelineBarrier(command, src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+static void defrag_record_copy(VkCommandBuffer command, defrag_move_t *move) {
+	defrag_resource_t *resource = move->resource;
+
+	if (resource->type == DEFRAG_RESOURCE_BUFFER) {
+		VkBufferCopy region = { };
+		region.srcOffset = 0;
+		region.dstOffset = 0;
+		region.size = resource->buffer_info.size;
+		vkCmdCopyBuffer(command, *resource->buffer, move->buffer, 1, &region);
+
+		VkBufferMemoryBarrier barrier = { };
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.pNext = NULL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = resource->access;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = move->buffer;
+		barrier.offset = 0;
+		barrier.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier(command, VK_PIPELINE_STAGE_TRANSFER_BIT, resource->stages,
+												 0, 0, NULL, 1, &barrier, 0, NULL);
+		return;
+	}
+
+	VkImage old_image = *resource->image;
+	defrag_image_barrier(command, resource, old_image, resource->layout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+											 resource->writes, VK_ACCESS_TRANSFER_READ_BIT,
+											 resource->stages, VK_PIPELINE_STAGE_TRANSFER_BIT);
+	defrag_image_barrier(command, resource, move->image, VK_IMAGE_LAYOUT_UNDEFINED,
+											 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+											 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+	for (uint32_t level = 0; level < resource->image_info.mipLevels; level++) {
+		VkImageCopy region = { };
+		region.srcSubresource.aspectMask = resource->aspect;
+		region.srcSubresource.mipLevel = level;
+		region.srcSubresource.baseArrayLayer = 0;
+		region.srcSubresource.layerCount = 1;
+		region.dstSubresource = region.srcSubresource;
+		region.srcOffset = { 0, 0, 0 };
+		region.dstOffset = { 0, 0, 0 };
+		region.extent.width = std::max(1u, resource->image_info.extent.width >> level);
+		region.extent.height = std::max(1u, resource->image_info.extent.height >> level);
+		region.extent.depth = 1;
+
+		vkCmdCopyImage(command, old_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+									 move->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	}
+
+	//Frames recorded before the swap keep using the old image
+	defrag_image_barrier(command, resource, old_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, resource->layout,
+											 0, resource->access, VK_PIPELINE_STAGE_TRANSFER_BIT, resource->stages);
+	defrag_image_barrier(command, resource, move->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, resource->layout,
+											 VK_ACCESS_TRANSFER_WRITE_BIT, resource->access,
+											 VK_PIPELINE_STAGE_TRANSFER_BIT, resource->stages);
+}
+
+static void defrag_submit(vulkan_info_t *info) {
+	memory_defrag_t *defrag = &info->defrag;
+	VkResult res = VK_SUCCESS;
+
+	defrag->command = create_command_buffer(info, info->cmd_pool);
+	VkCommandBufferBeginInfo begin_info = { };
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.pNext = NULL;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	begin_info.pInheritanceInfo = NULL;
+	res = vkBeginCommandBuffer(defrag->command, &begin_info);
+	assert(res == VK_SUCCESS);
+
+	//Earlier writes to the sources (uploads, previous moves, their own users) become visible to the copies
+	VkPipelineStageFlags src_stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	VkMemoryBarrier barrier = { };
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.pNext = NULL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	for (defrag_move_t &move : defrag->moves) {
+		if (move.resource->writes != 0) {
+			src_stages |= move.resource->stages;
+			barrier.srcAccessMask |= move.resource->writes;
+		}
+	}
+	vkCmdPipelineBarrier(defrag->command, src_stages, VK_PIPELINE_STAGE_TRANSFER_BIT,
+											 0, 1, &barrier, 0, NULL, 0, NULL);
+
+	for (defrag_move_t &move : defrag->moves)
+		defrag_record_copy(defrag->command, &move);
+
+	res = vkEndCommandBuffer(defrag->command);
+	assert(res == VK_SUCCESS);
+
+	VkSubmitInfo submission = { };
+	submission.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submission.commandBufferCount = 1;
+	submission.pCommandBuffers = &defrag->command;
+
+	defrag->copied = timeline_submit(info, &info->graphic_timeline, &submission);
+	defrag->copying = true;
+}
+
+/*
+ * Swaps the copies in once they completed. Frames recorded until now may
+ * still use the old resources: they go with the next frame submitted.
+ */
+static void defrag_finish(vulkan_info_t *info) {
+	memory_defrag_t *defrag = &info->defrag;
+
+	for (defrag_move_t &move : defrag->moves) {
+		defrag_resource_t *resource = move.resource;
+		if (resource->type == DEFRAG_RESOURCE_BUFFER) {
+			data_buffer_t old = { };
+			old.buffer = *resource->buffer;
+			old.allocation = *resource->allocation;
+			deferred_destroy_buffer(info, &old, DEFERRED_NEXT_FRAME);
+			*resource->buffer = move.buffer;
+		} else {
+			deferred_destroy_image(info, *resource->image, VK_NULL_HANDLE, resource->allocation,
+														 DEFERRED_NEXT_FRAME);
+			*resource->image = move.image;
+		}
+		*resource->allocation = move.allocation;
+
+		defrag->report.moved_count++;
+		defrag->report.moved_bytes += move.allocation.size;
+		resource->relocated(info, resource);
+	}
+
+	defrag->moves.clear();
+	vkFreeCommandBuffers(info->device, info->cmd_pool, 1, &defrag->command);
+	defrag->command = VK_NULL_HANDLE;
+	defrag->copying = false;
+}
+
+//=========== REPORT
+
+static double fragmentation_ratio(const memory_fragmentation_t *f) {
+	return f->free_bytes > 0 ? 1.0 - (double)f->largest_free / f->free_bytes : 0.0;
+}
+
+static void defrag_print_heap(uint32_t heap, const memory_fragmentation_t *f, const char *label) {
+	const double mb = 1 << 20;
+	printf("[INFO]   heap %u %s: %u blocks, %.1f MB free, largest %.1f MB, %.0f%% fragmented\n",
+				 heap, label, f->block_count, f->free_bytes / mb, f->largest_free / mb,
+				 fragmentation_ratio(f) * 100.0);
+}
+
+static void defrag_print_report(vulkan_info_t *info) {
+	const defrag_report_t *report = &info->defrag.report;
+	printf("[INFO] Defragmentation moved %u allocations, %.1f MB\n",
+				 report->moved_count, report->moved_bytes / (double)(1 << 20));
+
+	for (uint32_t i = 0; i < info->memory_properties.memoryHeapCount; i++) {
+		memory_fragmentation_t after;
+		memory_get_fragmentation(info, i, &after);
+		if (report->before[i].block_count == 0 && after.block_count == 0)
+			continue;
+		defrag_print_heap(i, &report->before[i], "before");
+		defrag_print_heap(i, &after, "after ");
+	}
+}
+
+void defrag_print_fragmentation(vulkan_info_t *info) {
+	printf("[INFO] Fragmentation:\n");
+	for (uint32_t i = 0; i < info->memory_properties.memoryHeapCount; i++) {
+		memory_fragmentation_t f;
+		memory_get_fragmentation(info, i, &f);
+		if (f.block_count > 0)
+			defrag_print_heap(i, &f, "");
+	}
+}
+
+//=========== PLANNING
+
+//Resources sitting in the sparsest block of their pool, in registration order
+static void defrag_candidates(vulkan_info_t *info, std::vector<defrag_resource_t*> *candidates) {
+	std::map<std::pair<uint32_t, uint32_t>, memory_block_t*> sparsest;
+
+	for (defrag_resource_t *resource : info->defrag.resources) {
+		const gpu_allocation_t *allocation = resource->allocation;
+		if (allocation->block == NULL)
+			continue;
+
+		auto key = std::make_pair(allocation->memory_type, allocation->kind);
+		auto it = sparsest.find(key);
+		if (it == sparsest.end())
+			it = sparsest.emplace(key, memory_sparsest_block(info, key.first, key.second)).first;
+		if (it->second == allocation->block)
+			candidates->push_back(resource);
+	}
+}
+
+static void defrag_settle(vulkan_info_t *info) {
+	memory_defrag_t *defrag = &info->defrag;
+	if (defrag->active && defrag->report.moved_count > 0)
+		defrag_print_report(info);
+	defrag->active = false;
+	defrag->settled_generation = memory_generation(info);
+}
+
+static void defrag_plan(vulkan_info_t *info, uint64_t budget_us) {
+	memory_defrag_t *defrag = &info->defrag;
+	auto start = std::chrono::steady_clock::now();
+
+	//Nothing was allocated or freed since the pools last settled
+	if (memory_generation(info) == defrag->settled_generation)
+		return;
+
+	std::vector<defrag_resource_t*> candidates;
+	defrag_candidates(info, &candidates);
+	if (candidates.empty()) {
+		defrag_settle(info);
+		return;
+	}
+
+	if (!defrag->active) {
+		for (uint32_t i = 0; i < info->memory_properties.memoryHeapCount; i++)
+			memory_get_fragmentation(info, i, &defrag->report.before[i]);
+		defrag->report.moved_count = 0;
+		defrag->report.moved_bytes = 0;
+		defrag->active = true;
+	}
+
+	VkDeviceSize pass_bytes = 0;
+	for (defrag_resource_t *resource : candidates) {
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		if (std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() >= (int64_t)budget_us)
+			break;
+		if (!defrag->moves.empty() && pass_bytes + resource->allocation->size > DEFRAG_MAX_PASS_BYTES)
+			break;
+
+		defrag_move_t move;
+		if (!defrag_prepare(info, resource, &move))
+			continue;
+		defrag->moves.push_back(move);
+		pass_bytes += move.allocation.size;
+	}
+
+	//The sparsest blocks cannot be emptied any further
+	if (defrag->moves.empty()) {
+		defrag_settle(info);
+		return;
+	}
+	defrag_submit(info);
+}
+
+//=========== API
+
+void defrag_create(vulkan_info_t *info) {
+	memory_defrag_t *defrag = &info->defrag;
+	defrag->command = VK_NULL_HANDLE;
+	defrag->copying = false;
+	defrag->active = false;
+	defrag->report = { };
+	defrag->settled_generation = UINT64_MAX;
+	defrag->copied = 0;
+}
+
+void defrag_destroy(vulkan_info_t *info) {
+	memory_defrag_t *defrag = &info->defrag;
+
+	if (defrag->copying) {
+		timeline_wait(info, &info->graphic_timeline, defrag->copied);
+		for (defrag_move_t &move : defrag->moves)
+			defrag_discard(info, &move);
+		defrag->moves.clear();
+		vkFreeCommandBuffers(info->device, info->cmd_pool, 1, &defrag->command);
+		defrag->copying = false;
+	}
+
+	if (!defrag->resources.empty())
+		fprintf(stderr, "[WARNING] %zu relocatable resources still registered\n", defrag->resources.size());
+	defrag->resources.clear();
+}
+
+void defrag_register_buffer(vulkan_info_t *info, defrag_resource_t *resource, data_buffer_t *buffer,
+														defrag_relocated_f relocated, void *user) {
+	assert((buffer->usage & VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+				 && (buffer->usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT));
+	*resource = { };
+	resource->type = DEFRAG_RESOURCE_BUFFER;
+	resource->allocation = &buffer->allocation;
+	resource->buffer = &buffer->buffer;
+	resource->buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	resource->buffer_info.pNext = NULL;
+	resource->buffer_info.flags = 0;
+	resource->buffer_info.size = buffer->descriptor.range;
+	resource->buffer_info.usage = buffer->usage;
+	buffer_usage_access(buffer->usage, &resource->stages, &resource->access, &resource->writes);
+	resource->buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	resource->buffer_info.queueFamilyIndexCount = 0;
+	resource->buffer_info.pQueueFamilyIndices = NULL;
+	resource->relocated = relocated;
+	resource->user = user;
+	info->defrag.resources.push_back(resource);
+}
+
+void defrag_register_image(vulkan_info_t *info, defrag_resource_t *resource,
+													 VkImage *image, gpu_allocation_t *allocation,
+													 const VkImageCreateInfo *image_info, VkImageAspectFlags aspect, image_access_e access,
+													 defrag_relocated_f relocated, void *user) {
+	assert(image_info->pNext == NULL && image_info->arrayLayers == 1);
+	assert((image_info->usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)
+				 && (image_info->usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT));
+	*resource = { };
+	resource->type = DEFRAG_RESOURCE_IMAGE;
+	resource->allocation = allocation;
+	resource->image = image;
+	resource->image_info = *image_info;
+	resource->image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	resource->aspect = aspect;
+	resource->layout = image_access_layout(access);
+	resource->stages = image_access_stages(access);
+	resource->access = image_access_mask(access);
+	resource->writes = image_access_writes(access);
+	resource->relocated = relocated;
+	resource->user = user;
+	info->defrag.resources.push_back(resource);
+}
+
+//A pending move of the resource is dropped, unregistering twice is harmless
+void defrag_unregister(vulkan_info_t *info, defrag_resource_t *resource) {
+	memory_defrag_t *defrag = &info->defrag;
+	auto it = std::find(defrag->resources.begin(), defrag->resources.end(), resource);
+	if (it == defrag->resources.end())
+		return;
+	defrag->resources.erase(it);
+
+	for (auto move = defrag->moves.begin(); move != defrag->moves.end(); ++move) {
+		if (move->resource != resource)
+			continue;
+		//The copy may still be running
+		defrag_discard_later(info, &*move, defrag->copied);
+		defrag->moves.erase(move);
+		break;
+	}
+}
+
+/*
+ * Called once per frame. Swaps the finished copies in, then plans the next
+ * pass. Returns true when handles changed and recorded commands are stale.
+ */
+bool defrag_step(vulkan_info_t *info, uint64_t budget_us) {
+	memory_defrag_t *defrag = &info->defrag;
+	bool relocated = false;
+
+	if (defrag->copying) {
+		if (!timeline_reached(info, &info->graphic_timeline, defrag->copied))
+			return false;
+		relocated = !defrag->moves.empty();
+		defrag_finish(info);
+	}
+
+	defrag_plan(info, budget_us);
+	return relocated;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "image_state.hh"
+#include "memory_allocator.hh"
+#include "types.hh"
+
+struct vulkan_info_t;
+
+//GPU bytes copied by a single pass, bounds the frame hitch of the copies
+#define DEFRAG_MAX_PASS_BYTES ((VkDeviceSize)16 << 20)
+
+enum defrag_resource_e {
+	DEFRAG_RESOURCE_BUFFER,
+	DEFRAG_RESOURCE_IMAGE,
+};
+
+struct defrag_resource_t;
+
+/*
+ * Called once the handle and allocation point to the new place. The old ones
+ * are released when the frames recorded with them retired. The owner
+ * refreshes what copied the old handle: views, descriptors, recorded draws.
+ */
+typedef void (*defrag_relocated_f)(vulkan_info_t *info, defrag_resource_t *resource);
+
+/*
+ * A sub-allocated resource the defragmenter may move. The creation parameters
+ * are kept to build the replacement: usage must allow TRANSFER_SRC and DST.
+ * Images are copied level by level and rest in `layout` between frames.
+ * The copies synchronize with the stages and accesses using the resource:
+ * for buffers those of their usage, for images those of their resting access.
+ */
+struct defrag_resource_t {
+	defrag_resource_e type;
+	gpu_allocation_t *allocation;
+	VkBuffer *buffer;
+	VkBufferCreateInfo buffer_info;
+	VkImage *image;
+	VkImageCreateInfo image_info;
+	VkImageAspectFlags aspect;
+	VkImageLayout layout;
+	VkPipelineStageFlags stages;
+	VkAccessFlags access;
+	//Write part of the access
+	VkAccessFlags writes;
+
+	defrag_relocated_f relocated;
+	void *user;
+};
+
+struct defrag_move_t {
+	defrag_resource_t *resource;
+	VkBuffer buffer;
+	VkImage image;
+	gpu_allocation_t allocation;
+};
+
+struct defrag_report_t {
+	memory_fragmentation_t before[VK_MAX_MEMORY_HEAPS];
+	uint32_t moved_count;
+	VkDeviceSize moved_bytes;
+};
+
+/*
+ * Incremental compaction of the buddy pools. Each pass moves allocations out
+ * of the least used block of a pool into fuller ones, within a CPU time budget
+ * and DEFRAG_MAX_PASS_BYTES, so the emptied block goes back to the driver.
+ * The copies run on the graphic queue and are polled on its timeline.
+ */
+struct memory_defrag_t {
+	std::vector<defrag_resource_t*> resources;
+	std::vector<defrag_move_t> moves;
+	VkCommandBuffer command;
+	//Graphic timeline value signaled once the copies completed
+	uint64_t copied;
+	bool copying;
+
+	//Fragmentation when the current cycle started, printed when it settles
+	bool active;
+	defrag_report_t report;
+	//Allocator generation of the last plan that found nothing to move
+	uint64_t settled_generation;
+};
+
+void defrag_create(vulkan_info_t *info);
+void defrag_destroy(vulkan_info_t *info);
+
+void defrag_register_buffer(vulkan_info_t *info, defrag_resource_t *resource, data_buffer_t *buffer,
+														defrag_relocated_f relocated, void *user);
+void defrag_register_image(vulkan_info_t *info, defrag_resource_t *resource,
+													 VkImage *image, gpu_allocation_t *allocation,
+													 const VkImageCreateInfo *image_info, VkImageAspectFlags aspect, image_access_e access,
+													 defrag_relocated_f relocated, void *user);
+void defrag_unregister(vulkan_info_t *info, defrag_resource_t *resource);
+
+bool defrag_step(vulkan_info_t *info, uint64_t budget_us);
+void defrag_print_fragmentation(vulkan_info_t *info);
@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+#include "memory_allocator.hh"
+#include "render_graph.hh"
+#include "render_pass.hh"
+#include "vulkan.hh"
+#include "vulkan_exception.hh"
+
+/*
+ * The graph resources in use are created to query their requirements, then
+ * bound to the slots they were assigned, each slot allocated once.
+ */
+static void graph_alias_memory(vulkan_info_t *info, render_graph_t *graph) {
+	std::vector<VkMemoryRequirements> requirements(graph->resources.size());
+	for (uint32_t r = 0; r < graph->resources.size(); r++) {
+		render_graph_resource_t *resource = &graph->resources[r];
+		if (resource->imported || resource->first_use == RENDER_GRAPH_NONE)
+			continue;
+
+		VkImage image;
+		attachment_image_create(info, resource->extent.width, resource->extent.height, resource->format,
+														resource->usage, resource->transient, &image);
+		resource->images.assign(1, image);
+		resource->states.resize(1);
+		vkGetImageMemoryRequirements(info->device, image, &requirements[r]);
+	}
+	render_graph_assign_slots(graph, requirements.data());
+
+	for (render_graph_slot_t &slot : graph->slots) {
+		memory_alloc(info, &slot.requirements,
+								 slot.transient ? MEMORY_USAGE_TRANSIENT : MEMORY_USAGE_GPU_ONLY,
+								 MEMORY_KIND_OPTIMAL, MEMORY_CATEGORY_ATTACHMENT, &slot.allocation);
+		for (uint32_t r : slot.resources) {
+			render_graph_resource_t *resource = &graph->resources[r];
+			VkResult res = vkBindImageMemory(info->device, resource->images[0], slot.allocation.memory,
+																			 slot.allocation.offset);
+			if (res != VK_SUCCESS)
+				throw VkException(res);
+
+			VkImageView view;
+			attachment_view_create(info, resource->images[0], resource->format, resource->usage, &view);
+			resource->views.assign(1, view);
+		}
+	}
+
+#ifdef LOG_VERBOSE
+	VkDeviceSize unaliased = 0;
+	VkDeviceSize aliased = 0;
+	uint32_t count = 0;
+	for (const render_graph_slot_t &slot : graph->slots) {
+		for (uint32_t r : slot.resources)
+			unaliased += requirements[r].size;
+		aliased += slot.requirements.size;
+		count += slot.resources.size();
+	}
+	printf("[INFO] Render graph: %u resources in %zu slots, %lu KiB instead of %lu KiB\n",
+				 count, graph->slots.size(), (unsigned long)(aliased >> 10),
+				 (unsigned long)(unaliased >> 10));
+#endif
+}
+
+/*
+ * Contents are loaded when a scheduled pass used the resource before, or when
+ * an imported image comes in defined. They are stored when a pass uses them
+ * after, or when they leave the graph.
+ */
+static uint32_t attachment_usage(render_graph_t *graph, uint32_t position,
+																 const render_graph_access_t *access) {
+	const render_graph_resource_t *resource = &graph->resources[access->resource];
+	uint32_t usage = 0;
+	if (access->clear)
+		usage |= ATTACHMENT_CLEARED;
+	else if (resource->first_use < position || resource->initial_access != IMAGE_ACCESS_UNDEFINED)
+		usage |= ATTACHMENT_READ_BEFORE;
+	if (resource->last_use > position || resource->imported || resource->output)
+		usage |= ATTACHMENT_READ_AFTER;
+	return usage;
+}
+
+/*
+ * The attachments stay in the pass layout at the end of the render pass:
+ * the barriers of the next accesses transition them.
+ */
+static void graph_create_render_passes(vulkan_info_t *info, render_graph_t *graph) {
+	for (uint32_t i = 0; i < graph->schedule.size(); i++) {
+		render_graph_pass_t *pass = &graph->passes[graph->schedule[i]];
+		render_pass_builder_t builder;
+		render_pass_begin(&builder);
+
+		std::vector<uint32_t> attachments;
+		uint32_t variants = 1;
+		for (const render_graph_access_t &access : pass->accesses) {
+			if (!image_access_is_attachment(access.access))
+				continue;
+			const render_graph_resource_t *resource = &graph->resources[access.resource];
+			uint32_t usage = attachment_usage(graph, i, &access);
+			VkImageLayout layout = image_access_layout(access.access);
+			if (access.access == IMAGE_ACCESS_COLOR_ATTACHMENT)
+				render_pass_add_color(&builder, resource->format, usage, layout);
+			else
+				render_pass_add_depth(&builder, resource->format, usage, layout);
+
+			if (attachments.empty())
+				pass->extent = resource->extent;
+			assert(resource->extent.width == pass->extent.width
+						 && resource->extent.height == pass->extent.height);
+			attachments.push_back(access.resource);
+			variants = std::max(variants, (uint32_t)resource->views.size());
+		}
+		if (attachments.empty())
+			continue;
+
+		render_pass_build(info, &builder, &pass->render_pass);
+
+		std::vector<VkImageView> views(attachments.size());
+		VkFramebufferCreateInfo framebuffer_info = { };
+		framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebuffer_info.pNext = NULL;
+		framebuffer_info.flags = 0;
+		framebuffer_info.renderPass = pass->render_pass;
+		framebuffer_info.attachmentCount = views.size();
+		framebuffer_info.pAttachments = views.data();
+		framebuffer_info.width = pass->extent.width;
+		framebuffer_info.height = pass->extent.height;
+		framebuffer_info.layers = 1;
+
+		pass->framebuffers.resize(variants);
+		for (uint32_t v = 0; v < variants; v++) {
+			for (uint32_t a = 0; a < attachments.size(); a++) {
+				const render_graph_resource_t *resource = &graph->resources[attachments[a]];
+				views[a] = resource->views[v % resource->views.size()];
+			}
+			VkResult res = vkCreateFramebuffer(info->device, &framebuffer_info, NULL, &pass->framebuffers[v]);
+			if (res != VK_SUCCESS)
+				throw VkException(res);
+		}
+	}
+}
+
+void render_graph_compile(vulkan_info_t *info, render_graph_t *graph) {
+	assert(!graph->compiled);
+	render_graph_plan(graph);
+	graph_alias_memory(info, graph);
+	graph_create_render_passes(info, graph);
+	graph->compiled = true;
+
+#ifdef LOG_VERBOSE
+	printf("[INFO] Render graph: %zu passes scheduled, %zu culled\n",
+				 graph->schedule.size(), graph->passes.size() - graph->schedule.size());
+	for (uint32_t p : graph->schedule)
+		printf("[INFO]   %s\n", graph->passes[p].name.c_str());
+#endif
+}
+
+static uint32_t resource_variant(const render_graph_resource_t *resource, uint32_t image) {
+	return image % resource->images.size();
+}
+
+/*
+ * States restart at every execution, the recorded commands are replayable.
+ * An imported image coming in undefined still waits for the stages of its
+ * first use, where the acquire semaphore wait is placed.
+ */
+static void graph_reset_states(render_graph_t *graph, uint32_t image) {
+	for (uint32_t r = 0; r < graph->resources.size(); r++) {
+		render_graph_resource_t *resource = &graph->resources[r];
+		if (resource->first_use == RENDER_GRAPH_NONE)
+			continue;
+
+		uint32_t variant = resource_variant(resource, image);
+		image_state_t *state = &resource->states[variant];
+		VkImageUsageFlags depth = resource->usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		image_state_init(state, resource->images[variant], attachment_aspect(resource->format, depth),
+										 1, IMAGE_ACCESS_UNDEFINED);
+
+		if (!resource->imported) {
+			state->write_stages = graph->slots[resource->slot].stages;
+			state->write_access = graph->slots[resource->slot].writes;
+			continue;
+		}
+
+		state->layout = image_access_layout(resource->initial_access);
+		state->write_stages = image_access_stages(resource->initial_access);
+		state->write_access = image_access_writes(resource->initial_access);
+		if (resource->initial_access != IMAGE_ACCESS_UNDEFINED)
+			continue;
+		for (const render_graph_access_t &access : graph->passes[graph->schedule[resource->first_use]].accesses) {
+			if (access.resource == r)
+				state->write_stages = image_access_stages(access.access);
+		}
+	}
+}
+
+//Records the scheduled passes into a command buffer already begun
+void render_graph_execute(vulkan_info_t *info, render_graph_t *graph, VkCommandBuffer command,
+													uint32_t image, void *frame) {
+	assert(graph->compiled);
+	graph_reset_states(graph, image);
+
+	barrier_batch_t *barriers = &graph->barriers;
+	barrier_batch_begin(barriers, command);
+
+	for (uint32_t p : graph->schedule) {
+		render_graph_pass_t *pass = &graph->passes[p];
+		for (const render_graph_access_t &access : pass->accesses) {
+			render_graph_resource_t *resource = &graph->resources[access.resource];
+			barrier_image(barriers, &resource->states[resource_variant(resource, image)], access.access);
+		}
+		barrier_flush(barriers);
+
+		render_graph_context_t context;
+		context.info = info;
+		context.command = command;
+		context.image = image;
+		context.render_pass = pass->render_pass;
+		context.framebuffer = render_graph_framebuffer(graph, p, image);
+		context.extent = pass->extent;
+		context.user = pass->user;
+		context.frame = frame;
+		pass->record(&context);
+	}
+
+	for (render_graph_resource_t &resource : graph->resources) {
+		if (!resource.imported || resource.first_use == RENDER_GRAPH_NONE
+				|| resource.final_access == IMAGE_ACCESS_UNDEFINED)
+			continue;
+		barrier_image(barriers, &resource.states[resource_variant(&resource, image)], resource.final_access);
+	}
+	barrier_flush(barriers);
+}
+
+VkRenderPass render_graph_render_pass(render_graph_t *graph, uint32_t pass) {
+	assert(graph->compiled);
+	return graph->passes[pass].render_pass;
+}
+
+VkFramebuffer render_graph_framebuffer(render_graph_t *graph, uint32_t pass, uint32_t image) {
+	assert(graph->compiled);
+	const render_graph_pass_t *target = &graph->passes[pass];
+	if (target->framebuffers.empty())
+		return VK_NULL_HANDLE;
+	return target->framebuffers[image % target->framebuffers.size()];
+}
+
+//Clear values follow the order the pass declared its attachments in
+void render_graph_begin_render_pass(render_graph_context_t *context, const VkClearValue *clears,
+																		uint32_t clear_count, VkSubpassContents contents) {
+	assert(context->render_pass != VK_NULL_HANDLE);
+
+	VkRenderPassBeginInfo begin_info = { };
+	begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	begin_info.pNext = NULL;
+	begin_info.renderPass = context->render_pass;
+	begin_info.framebuffer = context->framebuffer;
+	begin_info.renderArea.offset.x = 0;
+	begin_info.renderArea.offset.y = 0;
+	begin_info.renderArea.extent = context->extent;
+	begin_info.clearValueCount = clear_count;
+	begin_info.pClearValues = clears;
+	vkCmdBeginRenderPass(context->command, &begin_info, contents);
+}
+
+void render_graph_destroy(vulkan_info_t *info, render_graph_t *graph) {
+	for (render_graph_pass_t &pass : graph->passes) {
+		for (VkFramebuffer framebuffer : pass.framebuffers)
+			vkDestroyFramebuffer(info->device, framebuffer, NULL);
+		if (pass.render_pass != VK_NULL_HANDLE)
+			vkDestroyRenderPass(info->device, pass.render_pass, NULL);
+	}
+
+	for (render_graph_resource_t &resource : graph->resources) {
+		if (resource.imported)
+			continue;
+		for (VkImageView view : resource.views)
+			vkDestroyImageView(info->device, view, NULL);
+		for (VkImage image : resource.images)
+			vkDestroyImage(info->device, image, NULL);
+	}
+
+	for (render_graph_slot_t &slot : graph->slots)
+		memory_free(info, &slot.allocation);
+
+	render_graph_create(graph);
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "image_state.hh"
+#include "types.hh"
+
+struct vulkan_info_t;
+struct render_graph_context_t;
+
+#define RENDER_GRAPH_NONE (~0u)
+
+typedef void (*render_graph_record_f)(render_graph_context_t *context);
+
+/*
+ * Image owned by the graph or imported from outside. Imported images have a
+ * variant per swapchain image, the variant used is picked at execution.
+ */
+struct render_graph_resource_t {
+	std::string name;
+	VkFormat format;
+	VkExtent2D extent;
+	VkImageUsageFlags usage;
+	bool imported;
+	bool output;
+	//Imported only: layout expected around the graph
+	image_access_e initial_access;
+	image_access_e final_access;
+
+	std::vector<VkImage> images;
+	std::vector<VkImageView> views;
+	std::vector<image_state_t> states;
+
+	//Filled by compilation, positions in the schedule
+	uint32_t first_use;
+	uint32_t last_use;
+	//Graph resources only: memory slot shared with the resources it aliases
+	uint32_t slot;
+	bool transient;
+};
+
+struct render_graph_access_t {
+	uint32_t resource;
+	image_access_e access;
+	bool write;
+	bool clear;
+};
+
+struct render_graph_pass_t {
+	std::string name;
+	render_graph_record_f record;
+	void *user;
+	std::vector<render_graph_access_t> accesses;
+
+	//Filled by compilation
+	bool culled;
+	std::vector<uint32_t> producers;
+	std::vector<uint32_t> dependencies;
+	//Null for passes without attachments
+	VkRenderPass render_pass;
+	//One per variant of the imported attachments, a single one otherwise
+	std::vector<VkFramebuffer> framebuffers;
+	VkExtent2D extent;
+};
+
+/*
+ * Memory shared by graph resources whose lifetimes never overlap. The stages
+ * and accesses of every resource in the slot seed their state at each
+ * execution: a resource waits for whatever used the memory before it.
+ */
+struct render_graph_slot_t {
+	VkMemoryRequirements requirements;
+	bool transient;
+	std::vector<uint32_t> resources;
+	gpu_allocation_t allocation;
+	VkPipelineStageFlags stages;
+	VkAccessFlags writes;
+};
+
+/*
+ * Passes declare the resources they read and write, in submission order.
+ * Compilation culls the passes not contributing to an output, schedules the
+ * rest, aliases the graph resources' memory and builds the render passes.
+ * Execution inserts the barriers between passes and calls their record
+ * callbacks, the same graph being replayed every frame.
+ */
+struct render_graph_t {
+	std::vector<render_graph_resource_t> resources;
+	std::vector<render_graph_pass_t> passes;
+	std::vector<render_graph_slot_t> slots;
+	//Pass indices in execution order
+	std::vector<uint32_t> schedule;
+	//Kept across executions to reuse its storage
+	barrier_batch_t barriers;
+	bool compiled;
+};
+
+struct render_graph_context_t {
+	vulkan_info_t *info;
+	VkCommandBuffer command;
+	//Swapchain image the graph executes for
+	uint32_t image;
+	VkRenderPass render_pass;
+	VkFramebuffer framebuffer;
+	VkExtent2D extent;
+	void *user;
+	//Handed to render_graph_execute
+	void *frame;
+};
+
+void render_graph_create(render_graph_t *graph);
+void render_graph_destroy(vulkan_info_t *info, render_graph_t *graph);
+
+uint32_t render_graph_image(render_graph_t *graph, const char *name, VkFormat format,
+														uint32_t width, uint32_t height);
+uint32_t render_graph_import(render_graph_t *graph, const char *name, uint32_t count,
+														 const VkImage *images, const VkImageView *views, VkFormat format,
+														 uint32_t width, uint32_t height,
+														 image_access_e initial_access, image_access_e final_access);
+void render_graph_output(render_graph_t *graph, uint32_t resource);
+
+uint32_t render_graph_add_pass(render_graph_t *graph, const char *name,
+															 render_graph_record_f record, void *user);
+void render_graph_read(render_graph_t *graph, uint32_t pass, uint32_t resource, image_access_e access);
+void render_graph_write(render_graph_t *graph, uint32_t pass, uint32_t resource,
+												image_access_e access, bool clear);
+
+void render_graph_plan(render_graph_t *graph);
+void render_graph_assign_slots(render_graph_t *graph, const VkMemoryRequirements *requirements);
+void render_graph_compile(vulkan_info_t *info, render_graph_t *graph);
+void render_graph_execute(vulkan_info_t *info, render_graph_t *graph, VkCommandBuffer command,
+													uint32_t image, void *frame);
+
+VkRenderPass render_graph_render_pass(render_graph_t *graph, uint32_t pass);
+VkFramebuffer render_graph_framebuffer(render_graph_t *graph, uint32_t pass, uint32_t image);
+void render_graph_begin_render_pass(render_graph_context_t *context, const VkClearValue *clears,
+																		uint32_t clear_count, VkSubpassContents contents);
@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <cassert>
+
+#include "render_graph.hh"
+
+/*
+ * Declaration and the device independent half of the compilation: culling,
+ * scheduling, lifetimes and memory slots. Nothing here calls the device,
+ * graph_bench runs it alone.
+ */
+
+static VkImageUsageFlags access_usage(image_access_e access) {
+	switch (access) {
+	case IMAGE_ACCESS_TRANSFER_SRC:
+		return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	case IMAGE_ACCESS_TRANSFER_DST:
+		return VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	case IMAGE_ACCESS_COLOR_ATTACHMENT:
+		return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	case IMAGE_ACCESS_DEPTH_ATTACHMENT:
+		return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	case IMAGE_ACCESS_FRAGMENT_SAMPLED:
+		return VK_IMAGE_USAGE_SAMPLED_BIT;
+	default:
+		return 0;
+	}
+}
+
+static void add_unique(std::vector<uint32_t> *list, uint32_t value) {
+	if (std::find(list->begin(), list->end(), value) == list->end())
+		list->push_back(value);
+}
+
+void render_graph_create(render_graph_t *graph) {
+	graph->resources.clear();
+	graph->passes.clear();
+	graph->slots.clear();
+	graph->schedule.clear();
+	graph->compiled = false;
+}
+
+static uint32_t add_resource(render_graph_t *graph, const char *name, VkFormat format,
+														 uint32_t width, uint32_t height) {
+	assert(!graph->compiled);
+	render_graph_resource_t resource = { };
+	resource.name = name;
+	resource.format = format;
+	resource.extent = { width, height };
+	resource.usage = 0;
+	resource.imported = false;
+	resource.output = false;
+	resource.initial_access = IMAGE_ACCESS_UNDEFINED;
+	resource.final_access = IMAGE_ACCESS_UNDEFINED;
+	resource.first_use = RENDER_GRAPH_NONE;
+	resource.last_use = RENDER_GRAPH_NONE;
+	resource.slot = RENDER_GRAPH_NONE;
+	resource.transient = false;
+	graph->resources.push_back(resource);
+	return graph->resources.size() - 1;
+}
+
+//Created and bound at compilation, its contents never outlive an execution
+uint32_t render_graph_image(render_graph_t *graph, const char *name, VkFormat format,
+														uint32_t width, uint32_t height) {
+	return add_resource(graph, name, format, width, height);
+}
+
+//The graph neither owns nor aliases imported images
+uint32_t render_graph_import(render_graph_t *graph, const char *name, uint32_t count,
+														 const VkImage *images, const VkImageView *views, VkFormat format,
+														 uint32_t width, uint32_t height,
+														 image_access_e initial_access, image_access_e final_access) {
+	uint32_t index = add_resource(graph, name, format, width, height);
+	render_graph_resource_t *resource = &graph->resources[index];
+	resource->imported = true;
+	resource->initial_access = initial_access;
+	resource->final_access = final_access;
+	resource->images.assign(images, images + count);
+	resource->views.assign(views, views + count);
+	resource->states.resize(count);
+	return index;
+}
+
+//Passes not contributing to an output are culled
+void render_graph_output(render_graph_t *graph, uint32_t resource) {
+	assert(!graph->compiled);
+	graph->resources[resource].output = true;
+}
+
+uint32_t render_graph_add_pass(render_graph_t *graph, const char *name,
+															 render_graph_record_f record, void *user) {
+	assert(!graph->compiled);
+	render_graph_pass_t pass = { };
+	pass.name = name;
+	pass.record = record;
+	pass.user = user;
+	pass.culled = false;
+	pass.render_pass = VK_NULL_HANDLE;
+	pass.extent = { 0, 0 };
+	graph->passes.push_back(pass);
+	return graph->passes.size() - 1;
+}
+
+static void add_access(render_graph_t *graph, uint32_t pass, uint32_t resource,
+											 image_access_e access, bool write, bool clear) {
+	assert(!graph->compiled);
+	render_graph_pass_t *target = &graph->passes[pass];
+	for (const render_graph_access_t &declared : target->accesses)
+		assert(declared.resource != resource && "A pass accesses a resource once");
+
+	target->accesses.push_back({ resource, access, write, clear });
+	graph->resources[resource].usage |= access_usage(access);
+}
+
+void render_graph_read(render_graph_t *graph, uint32_t pass, uint32_t resource, image_access_e access) {
+	assert(image_access_writes(access) == 0);
+	add_access(graph, pass, resource, access, false, false);
+}
+
+//A write not clearing loads the previous contents: it also depends on their writer
+void render_graph_write(render_graph_t *graph, uint32_t pass, uint32_t resource,
+												image_access_e access, bool clear) {
+	assert(image_access_writes(access) != 0);
+	assert(!clear || image_access_is_attachment(access));
+	add_access(graph, pass, resource, access, true, clear);
+}
+
+/*
+ * Declaration order is submission order: a pass depends on the previous
+ * writer of what it reads or loads, and a write waits for the previous
+ * writer and the readers since.
+ */
+static void graph_build_edges(render_graph_t *graph) {
+	std::vector<uint32_t> writers(graph->resources.size(), RENDER_GRAPH_NONE);
+	std::vector<std::vector<uint32_t>> readers(graph->resources.size());
+
+	for (uint32_t p = 0; p < graph->passes.size(); p++) {
+		render_graph_pass_t *pass = &graph->passes[p];
+		for (const render_graph_access_t &access : pass->accesses) {
+			uint32_t writer = writers[access.resource];
+			if (writer != RENDER_GRAPH_NONE) {
+				if (!access.clear)
+					add_unique(&pass->producers, writer);
+				add_unique(&pass->dependencies, writer);
+			}
+
+			if (!access.write) {
+				readers[access.resource].push_back(p);
+				continue;
+			}
+			for (uint32_t reader : readers[access.resource])
+				add_unique(&pass->dependencies, reader);
+			readers[access.resource].clear();
+			writers[access.resource] = p;
+		}
+	}
+}
+
+//Walks the producers back from the passes writing an output
+static void graph_cull(render_graph_t *graph) {
+	std::vector<uint32_t> stack;
+	for (uint32_t p = 0; p < graph->passes.size(); p++) {
+		render_graph_pass_t *pass = &graph->passes[p];
+		pass->culled = true;
+		for (const render_graph_access_t &access : pass->accesses) {
+			if (access.write && graph->resources[access.resource].output) {
+				stack.push_back(p);
+				break;
+			}
+		}
+	}
+
+	while (!stack.empty()) {
+		render_graph_pass_t *pass = &graph->passes[stack.back()];
+		stack.pop_back();
+		if (!pass->culled)
+			continue;
+		pass->culled = false;
+		for (uint32_t producer : pass->producers)
+			stack.push_back(producer);
+	}
+}
+
+/*
+ * Topological order of the live passes. Among the ready ones, the pass
+ * consuming the most recently scheduled producer goes first: what a pass
+ * writes is read soon after, keeping lifetimes short and memory aliasable.
+ */
+static void graph_schedule(render_graph_t *graph) {
+	uint32_t count = graph->passes.size();
+	std::vector<uint32_t> waiting(count, 0);
+	std::vector<uint32_t> position(count, RENDER_GRAPH_NONE);
+
+	for (uint32_t p = 0; p < count; p++) {
+		if (graph->passes[p].culled)
+			continue;
+		for (uint32_t dependency : graph->passes[p].dependencies)
+			waiting[p] += graph->passes[dependency].culled ? 0 : 1;
+	}
+
+	graph->schedule.clear();
+	while (true) {
+		uint32_t best = RENDER_GRAPH_NONE;
+		int64_t best_recency = -2;
+		for (uint32_t p = 0; p < count; p++) {
+			if (graph->passes[p].culled || position[p] != RENDER_GRAPH_NONE || waiting[p] > 0)
+				continue;
+			int64_t recency = -1;
+			for (uint32_t producer : graph->passes[p].producers)
+				recency = std::max(recency, (int64_t)position[producer]);
+			if (recency > best_recency) {
+				best = p;
+				best_recency = recency;
+			}
+		}
+		if (best == RENDER_GRAPH_NONE)
+			break;
+
+		position[best] = graph->schedule.size();
+		graph->schedule.push_back(best);
+		for (uint32_t p = 0; p < count; p++) {
+			if (graph->passes[p].culled || position[p] != RENDER_GRAPH_NONE)
+				continue;
+			const std::vector<uint32_t> &dependencies = graph->passes[p].dependencies;
+			if (std::find(dependencies.begin(), dependencies.end(), best) != dependencies.end())
+				waiting[p]--;
+		}
+	}
+}
+
+/*
+ * A resource used by a single pass, as an attachment only, is neither loaded
+ * nor stored: it can live in lazily allocated memory.
+ */
+static void graph_compute_lifetimes(render_graph_t *graph) {
+	for (uint32_t i = 0; i < graph->schedule.size(); i++) {
+		for (const render_graph_access_t &access : graph->passes[graph->schedule[i]].accesses) {
+			render_graph_resource_t *resource = &graph->resources[access.resource];
+			if (resource->first_use == RENDER_GRAPH_NONE) {
+				resource->first_use = i;
+				resource->transient = true;
+			}
+			resource->last_use = i;
+			resource->transient &= image_access_is_attachment(access.access) && access.clear;
+		}
+	}
+
+	for (render_graph_resource_t &resource : graph->resources) {
+		resource.transient &= !resource.imported && !resource.output
+			&& resource.first_use == resource.last_use;
+	}
+}
+
+static bool slot_overlaps(render_graph_t *graph, const render_graph_slot_t *slot,
+													const render_graph_resource_t *resource) {
+	for (uint32_t other : slot->resources) {
+		const render_graph_resource_t *used = &graph->resources[other];
+		if (resource->first_use <= used->last_use && used->first_use <= resource->last_use)
+			return true;
+	}
+	return false;
+}
+
+//Culls, schedules and computes the lifetimes, the graph resources in use get first_use set
+void render_graph_plan(render_graph_t *graph) {
+	assert(!graph->compiled);
+	graph_build_edges(graph);
+	graph_cull(graph);
+	graph_schedule(graph);
+	graph_compute_lifetimes(graph);
+}
+
+/*
+ * Largest resources first, each into the first slot it fits: same memory
+ * type, same transience and no lifetime overlap. A slot is sized for its
+ * largest resource. Requirements are indexed by resource, only the graph
+ * resources in use are read.
+ */
+void render_graph_assign_slots(render_graph_t *graph, const VkMemoryRequirements *requirements) {
+	std::vector<uint32_t> order;
+	for (uint32_t r = 0; r < graph->resources.size(); r++) {
+		const render_graph_resource_t *resource = &graph->resources[r];
+		if (!resource->imported && resource->first_use != RENDER_GRAPH_NONE)
+			order.push_back(r);
+	}
+
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return requirements[a].size > requirements[b].size;
+	});
+
+	for (uint32_t r : order) {
+		render_graph_resource_t *resource = &graph->resources[r];
+		const VkMemoryRequirements *needed = &requirements[r];
+
+		for (uint32_t s = 0; s < graph->slots.size() && resource->slot == RENDER_GRAPH_NONE; s++) {
+			render_graph_slot_t *slot = &graph->slots[s];
+			if (slot->transient != resource->transient
+					|| (slot->requirements.memoryTypeBits & needed->memoryTypeBits) == 0
+					|| slot_overlaps(graph, slot, resource))
+				continue;
+			slot->requirements.size = std::max(slot->requirements.size, needed->size);
+			slot->requirements.alignment = std::max(slot->requirements.alignment, needed->alignment);
+			slot->requirements.memoryTypeBits &= needed->memoryTypeBits;
+			resource->slot = s;
+		}
+
+		if (resource->slot == RENDER_GRAPH_NONE) {
+			render_graph_slot_t slot = { };
+			slot.requirements = *needed;
+			slot.transient = resource->transient;
+			slot.stages = 0;
+			slot.writes = 0;
+			resource->slot = graph->slots.size();
+			graph->slots.push_back(slot);
+		}
+		graph->slots[resource->slot].resources.push_back(r);
+	}
+
+	//Every access made to the slot's memory, seeding the state of each resource at execution
+	for (uint32_t p : graph->schedule) {
+		for (const render_graph_access_t &access : graph->passes[p].accesses) {
+			render_graph_resource_t *resource = &graph->resources[access.resource];
+			if (resource->imported)
+				continue;
+			graph->slots[resource->slot].stages |= image_access_stages(access.access);
+			graph->slots[resource->slot].writes |= image_access_writes(access.access);
+		}
+	}
+}
@@ -0,0 +1,182 @@
+#include "render_pass.hh"
+#include "vulkan.hh"
+#include "vulkan_exception.hh"
+#include "vulkan_wrappers.hh"
+
+static bool format_has_stencil(VkFormat format) {
+	return format == VK_FORMAT_S8_UINT
+		|| format == VK_FORMAT_D16_UNORM_S8_UINT
+		|| format == VK_FORMAT_D24_UNORM_S8_UINT
+		|| format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+static VkAttachmentLoadOp load_op(uint32_t usage) {
+	if (usage & ATTACHMENT_READ_BEFORE)
+		return VK_ATTACHMENT_LOAD_OP_LOAD;
+	if (usage & ATTACHMENT_CLEARED)
+		return VK_ATTACHMENT_LOAD_OP_CLEAR;
+	return VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+}
+
+static VkAttachmentStoreOp store_op(uint32_t usage) {
+	return usage & ATTACHMENT_READ_AFTER ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+}
+
+//Contents not loaded may start UNDEFINED, contents not stored may stay in the pass layout
+static VkAttachmentDescription attachment_describe(VkFormat format, uint32_t usage, VkImageLayout pass_layout,
+																									 VkImageLayout final_layout, bool stencil) {
+	VkAttachmentDescription attachment = { };
+	attachment.flags = 0;
+	attachment.format = format;
+	attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	attachment.loadOp = load_op(usage);
+	attachment.storeOp = store_op(usage);
+	attachment.stencilLoadOp = stencil ? load_op(usage) : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachment.stencilStoreOp = stencil ? store_op(usage) : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachment.initialLayout = usage & ATTACHMENT_READ_BEFORE ? pass_layout : VK_IMAGE_LAYOUT_UNDEFINED;
+	attachment.finalLayout = usage & ATTACHMENT_READ_AFTER ? final_layout : pass_layout;
+	return attachment;
+}
+
+void render_pass_begin(render_pass_builder_t *builder) {
+	builder->attachments.clear();
+	builder->colors.clear();
+	builder->depth = { };
+	builder->has_depth = false;
+}
+
+uint32_t render_pass_add_color(render_pass_builder_t *builder, VkFormat format, uint32_t usage,
+															 VkImageLayout final_layout) {
+	uint32_t index = builder->attachments.size();
+	builder->attachments.push_back(attachment_describe(format, usage, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+																										 final_layout, false));
+	builder->colors.push_back({ index, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+	return index;
+}
+
+uint32_t render_pass_add_depth(render_pass_builder_t *builder, VkFormat format, uint32_t usage,
+															 VkImageLayout final_layout) {
+	assert(!builder->has_depth && "A subpass has a single depth attachment");
+	uint32_t index = builder->attachments.size();
+	builder->attachments.push_back(attachment_describe(format, usage,
+																										 VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+																										 final_layout, format_has_stencil(format)));
+	builder->depth = { index, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+	builder->has_depth = true;
+	return index;
+}
+
+/*
+ * Single subpass. The external dependency orders the attachment writes after
+ * the previous frame's, the depth buffer being shared by the frames in flight.
+ */
+void render_pass_build(vulkan_info_t *info, render_pass_builder_t *builder, VkRenderPass *pass) {
+	VkSubpassDescription subpass = { };
+	subpass.flags = 0;
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.inputAttachmentCount = 0;
+	subpass.pInputAttachments = NULL;
+	subpass.colorAttachmentCount = builder->colors.size();
+	subpass.pColorAttachments = builder->colors.data();
+	subpass.pResolveAttachments = NULL;
+	subpass.pDepthStencilAttachment = builder->has_depth ? &builder->depth : NULL;
+	subpass.preserveAttachmentCount = 0;
+	subpass.pPreserveAttachments = NULL;
+
+	VkSubpassDependency dependency = { };
+	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependency.dstSubpass = 0;
+	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+		| VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+		| VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependency.dependencyFlags = 0;
+
+	VkRenderPassCreateInfo pass_info = { };
+	pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	pass_info.pNext = NULL;
+	pass_info.flags = 0;
+	pass_info.attachmentCount = builder->attachments.size();
+	pass_info.pAttachments = builder->attachments.data();
+	pass_info.subpassCount = 1;
+	pass_info.pSubpasses = &subpass;
+	pass_info.dependencyCount = 1;
+	pass_info.pDependencies = &dependency;
+
+	VkResult res = vkCreateRenderPass(info->device, &pass_info, NULL, pass);
+	if (res != VK_SUCCESS)
+		throw VkException(res);
+}
+
+bool attachment_is_transient(uint32_t usage) {
+	return !(usage & (ATTACHMENT_READ_BEFORE | ATTACHMENT_READ_AFTER));
+}
+
+/*
+ * Attachments living only inside a pass are transient: on tilers the lazily
+ * allocated memory is never committed. Desktop GPUs rarely expose such a type,
+ * the image then falls back to plain device local memory. The caller binds
+ * the memory, with MEMORY_USAGE_TRANSIENT for those.
+ */
+void attachment_image_create(vulkan_info_t *info, uint32_t w, uint32_t h, VkFormat format,
+														 VkImageUsageFlags usage, bool transient, VkImage *image) {
+	VkImageCreateInfo image_info = { };
+	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.pNext = NULL;
+	image_info.flags = 0;
+	image_info.imageType = VK_IMAGE_TYPE_2D;
+	image_info.format = format;
+	image_info.extent.width = w;
+	image_info.extent.height = h;
+	image_info.extent.depth = 1;
+	image_info.mipLevels = 1;
+	image_info.arrayLayers = 1;
+	image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	image_info.usage = usage | (transient ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : 0);
+	image_info.queueFamilyIndexCount = 0;
+	image_info.pQueueFamilyIndices = NULL;
+	image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkResult res = vkCreateImage(info->device, &image_info, NULL, image);
+	if (res != VK_SUCCESS)
+		throw VkException(res);
+}
+
+VkImageAspectFlags attachment_aspect(VkFormat format, VkImageUsageFlags usage) {
+	if (!(usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT))
+		return VK_IMAGE_ASPECT_COLOR_BIT;
+	if (format_has_stencil(format))
+		return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	return VK_IMAGE_ASPECT_DEPTH_BIT;
+}
+
+void attachment_view_create(vulkan_info_t *info, VkImage image, VkFormat format,
+														VkImageUsageFlags usage, VkImageView *view) {
+	VkImageViewCreateInfo view_info = { };
+	view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_info.pNext = NULL;
+	view_info.flags = 0;
+	view_info.image = image;
+	view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	view_info.format = format;
+	view_info.components.r = VK_COMPONENT_SWIZZLE_R;
+	view_info.components.g = VK_COMPONENT_SWIZZLE_G;
+	view_info.components.b = VK_COMPONENT_SWIZZLE_B;
+	view_info.components.a = VK_COMPONENT_SWIZZLE_A;
+	view_info.subresourceRange.aspectMask = attachment_aspect(format, usage);
+	view_info.subresourceRange.baseMipLevel = 0;
+	view_info.subresourceRange.levelCount = 1;
+	view_info.subresourceRange.baseArrayLayer = 0;
+	view_info.subresourceRange.layerCount = 1;
+
+	VkResult res = vkCreateImageView(info->device, &view_info, NULL, view);
+	if (res != VK_SUCCESS)
+		throw VkException(res);
+}
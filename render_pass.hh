@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "types.hh"
+
+struct vulkan_info_t;
+
+/*
+ * How an attachment is used around the pass, the load and store ops follow:
+ * only READ_BEFORE loads, only READ_AFTER stores, CLEARED clears.
+ * An attachment neither loaded nor stored never needs to leave the tile memory.
+ */
+enum attachment_usage_bits_e {
+	ATTACHMENT_CLEARED = 1 << 0,
+	ATTACHMENT_READ_BEFORE = 1 << 1,
+	ATTACHMENT_READ_AFTER = 1 << 2,
+};
+
+struct render_pass_builder_t {
+	std::vector<VkAttachmentDescription> attachments;
+	std::vector<VkAttachmentReference> colors;
+	VkAttachmentReference depth;
+	bool has_depth;
+};
+
+void render_pass_begin(render_pass_builder_t *builder);
+uint32_t render_pass_add_color(render_pass_builder_t *builder, VkFormat format, uint32_t usage,
+															 VkImageLayout final_layout);
+uint32_t render_pass_add_depth(render_pass_builder_t *builder, VkFormat format, uint32_t usage,
+															 VkImageLayout final_layout);
+void render_pass_build(vulkan_info_t *info, render_pass_builder_t *builder, VkRenderPass *pass);
+
+bool attachment_is_transient(uint32_t usage);
+void attachment_image_create(vulkan_info_t *info, uint32_t w, uint32_t h, VkFormat format,
+														 VkImageUsageFlags usage, bool transient, VkImage *image);
+VkImageAspectFlags attachment_aspect(VkFormat format, VkImageUsageFlags usage);
+void attachment_view_create(vulkan_info_t *info, VkImage image, VkFormat format,
+														VkImageUsageFlags usage, VkImageView *view);
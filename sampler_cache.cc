@@ -0,0 +1,157 @@
+#include <algorithm>
+
+#include "sampler_cache.hh"
+#include "vulkan.hh"
+#include "vulkan_exception.hh"
+
+#define FNV_OFFSET (14695981039346656037ull)
+#define FNV_PRIME (1099511628211ull)
+
+template<typename T>
+static void hash_field(uint64_t *hash, const T &value) {
+	const uint8_t *bytes = reinterpret_cast<const uint8_t*>(&value);
+	for (size_t i = 0; i < sizeof(T); i++)
+		*hash = (*hash ^ bytes[i]) * FNV_PRIME;
+}
+
+//sType and pNext are left out: chained structures are not cached
+static uint64_t sampler_hash(const VkSamplerCreateInfo *s) {
+	uint64_t hash = FNV_OFFSET;
+	hash_field(&hash, s->flags);
+	hash_field(&hash, s->magFilter);
+	hash_field(&hash, s->minFilter);
+	hash_field(&hash, s->mipmapMode);
+	hash_field(&hash, s->addressModeU);
+	hash_field(&hash, s->addressModeV);
+	hash_field(&hash, s->addressModeW);
+	hash_field(&hash, s->mipLodBias);
+	hash_field(&hash, s->anisotropyEnable);
+	hash_field(&hash, s->maxAnisotropy);
+	hash_field(&hash, s->compareEnable);
+	hash_field(&hash, s->compareOp);
+	hash_field(&hash, s->minLod);
+	hash_field(&hash, s->maxLod);
+	hash_field(&hash, s->borderColor);
+	hash_field(&hash, s->unnormalizedCoordinates);
+	return hash;
+}
+
+static bool sampler_equal(const VkSamplerCreateInfo *a, const VkSamplerCreateInfo *b) {
+	return a->flags == b->flags
+		&& a->magFilter == b->magFilter
+		&& a->minFilter == b->minFilter
+		&& a->mipmapMode == b->mipmapMode
+		&& a->addressModeU == b->addressModeU
+		&& a->addressModeV == b->addressModeV
+		&& a->addressModeW == b->addressModeW
+		&& a->mipLodBias == b->mipLodBias
+		&& a->anisotropyEnable == b->anisotropyEnable
+		&& a->maxAnisotropy == b->maxAnisotropy
+		&& a->compareEnable == b->compareEnable
+		&& a->compareOp == b->compareOp
+		&& a->minLod == b->minLod
+		&& a->maxLod == b->maxLod
+		&& a->borderColor == b->borderColor
+		&& a->unnormalizedCoordinates == b->unnormalizedCoordinates;
+}
+
+//Requests differing only past the device limits end up on the same sampler
+static VkSamplerCreateInfo sampler_clamp(vulkan_info_t *info, const VkSamplerCreateInfo *create_info) {
+	VkSamplerCreateInfo state = *create_info;
+	state.pNext = NULL;
+
+	if (!info->device_features.samplerAnisotropy)
+		state.anisotropyEnable = VK_FALSE;
+
+	if (state.anisotropyEnable)
+		state.maxAnisotropy = std::min(std::max(state.maxAnisotropy, 1.0f),
+																	 info->device_properties.limits.maxSamplerAnisotropy);
+	else
+		state.maxAnisotropy = 1.0f;
+
+	float max_bias = info->device_properties.limits.maxSamplerLodBias;
+	state.mipLodBias = std::min(std::max(state.mipLodBias, -max_bias), max_bias);
+	return state;
+}
+
+VkSampler sampler_cache_acquire(vulkan_info_t *info, const VkSamplerCreateInfo *create_info) {
+	assert(create_info->pNext == NULL);
+	sampler_cache_t *cache = &info->sampler_cache;
+	VkSamplerCreateInfo state = sampler_clamp(info, create_info);
+	uint64_t hash = sampler_hash(&state);
+
+	std::vector<sampler_entry_t> &bucket = cache->buckets[hash];
+	for (sampler_entry_t &entry : bucket) {
+		if (sampler_equal(&entry.state, &state)) {
+			entry.refs++;
+			cache->stats.references++;
+			cache->stats.hits++;
+			return entry.sampler;
+		}
+	}
+
+	if (cache->stats.live >= info->device_properties.limits.maxSamplerAllocationCount)
+		throw VkException(VK_ERROR_TOO_MANY_OBJECTS);
+
+	sampler_entry_t entry;
+	entry.state = state;
+	entry.refs = 1;
+	VkResult res = vkCreateSampler(info->device, &entry.state, NULL, &entry.sampler);
+	if (res != VK_SUCCESS)
+		throw VkException(res);
+
+	bucket.push_back(entry);
+	cache->owners[entry.sampler] = hash;
+	cache->stats.live++;
+	cache->stats.peak = std::max(cache->stats.peak, cache->stats.live);
+	cache->stats.references++;
+	cache->stats.misses++;
+	return entry.sampler;
+}
+
+void sampler_cache_release(vulkan_info_t *info, VkSampler sampler) {
+	sampler_cache_t *cache = &info->sampler_cache;
+	auto owner = cache->owners.find(sampler);
+	assert(owner != cache->owners.end());
+
+	std::vector<sampler_entry_t> &bucket = cache->buckets[owner->second];
+	for (auto it = bucket.begin(); it != bucket.end(); ++it) {
+		if (it->sampler != sampler)
+			continue;
+
+		cache->stats.references--;
+		if (--it->refs > 0)
+			return;
+
+		vkDestroySampler(info->device, sampler, NULL);
+		bucket.erase(it);
+		if (bucket.empty())
+			cache->buckets.erase(owner->second);
+		cache->owners.erase(owner);
+		cache->stats.live--;
+		return;
+	}
+	assert(0 && "Sampler missing from its bucket");
+}
+
+void sampler_cache_print_stats(vulkan_info_t *info) {
+	const sampler_stats_t *stats = &info->sampler_cache.stats;
+	printf("[INFO] Samplers: %u live (peak %u, limit %u), %u references, %llu hits, %llu misses\n",
+				 stats->live, stats->peak, info->device_properties.limits.maxSamplerAllocationCount,
+				 stats->references, (unsigned long long)stats->hits, (unsigned long long)stats->misses);
+}
+
+void sampler_cache_destroy(vulkan_info_t *info) {
+	sampler_cache_t *cache = &info->sampler_cache;
+	if (cache->stats.references > 0)
+		fprintf(stderr, "[WARNING] %u sampler references still held\n", cache->stats.references);
+
+	for (auto &bucket : cache->buckets) {
+		for (sampler_entry_t &entry : bucket.second)
+			vkDestroySampler(info->device, entry.sampler, NULL);
+	}
+	cache->buckets.clear();
+	cache->owners.clear();
+	cache->stats.live = 0;
+	cache->stats.references = 0;
+}
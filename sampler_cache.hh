@@ -0,0 +1,38 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+struct vulkan_info_t;
+
+struct sampler_entry_t {
+	VkSamplerCreateInfo state;
+	VkSampler sampler;
+	uint32_t refs;
+};
+
+struct sampler_stats_t {
+	uint32_t live;
+	uint32_t peak;
+	uint32_t references;
+	uint64_t hits;
+	uint64_t misses;
+};
+
+/*
+ * Samplers are shared between every texture asking for the same state.
+ * Entries are bucketed by a hash of the create info and refcounted,
+ * the VkSampler is destroyed with its last reference.
+ */
+struct sampler_cache_t {
+	std::unordered_map<uint64_t, std::vector<sampler_entry_t>> buckets;
+	std::unordered_map<VkSampler, uint64_t> owners;
+	sampler_stats_t stats;
+};
+
+VkSampler sampler_cache_acquire(vulkan_info_t *info, const VkSamplerCreateInfo *create_info);
+void sampler_cache_release(vulkan_info_t *info, VkSampler sampler);
+void sampler_cache_print_stats(vulkan_info_t *info);
+void sampler_cache_destroy(vulkan_info_t *info);
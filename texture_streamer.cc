@@ -0,0 +1,681 @@
+#include <algorithm>
+#include <cmath>
+
+#include "image_import.hh"
+#include "texture_streamer.hh"
+#include "vulkan_exception.hh"
+#include "vulkan_wrappers.hh"
+
+//White reads the same in any format, the placeholder serves both roles
+#define PLACEHOLDER_FORMAT VK_FORMAT_R8G8B8A8_UNORM
+//Transfer source for the next upload and for defragmentation moves
+#define STREAMED_IMAGE_USAGE (VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT \
+															| VK_IMAGE_USAGE_SAMPLED_BIT)
+#define SRGB_ENCODE_STEPS (4096)
+
+static uint32_t mip_width(streamed_texture_t *t, uint32_t mip) {
+	return std::max(1u, t->texture.width >> mip);
+}
+
+static uint32_t mip_height(streamed_texture_t *t, uint32_t mip) {
+	return std::max(1u, t->texture.height >> mip);
+}
+
+//Bytes needed by the mips [first, last)
+static VkDeviceSize chain_size(streamed_texture_t *t, uint32_t first, uint32_t last) {
+	VkDeviceSize size = 0;
+	for (uint32_t i = first; i < last; i++)
+		size += mip_width(t, i) * mip_height(t, i) * 4;
+	return size;
+}
+
+static VkImageCreateInfo chain_image_info(streamed_texture_t *t, uint32_t first_mip) {
+	VkImageCreateInfo image_info = { };
+	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.pNext = NULL;
+	image_info.flags = 0;
+	image_info.imageType = VK_IMAGE_TYPE_2D;
+	image_info.extent.width = mip_width(t, first_mip);
+	image_info.extent.height = mip_height(t, first_mip);
+	image_info.extent.depth = 1;
+	image_info.mipLevels = t->mip_count - first_mip;
+	image_info.arrayLayers = 1;
+	image_info.format = t->texture.format;
+	image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	image_info.usage = STREAMED_IMAGE_USAGE;
+	image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	return image_info;
+}
+
+/*
+ * What the image holding [first_mip, mip_count) allocates, tiling and
+ * alignment included: resident_bytes are charged in this unit, so the
+ * budget checks must be too. Probed with an unbound image, once per mip.
+ */
+static VkDeviceSize chain_image_size(vulkan_info_t *info, streamed_texture_t *t, uint32_t first_mip) {
+	if (t->image_bytes[first_mip] != 0)
+		return t->image_bytes[first_mip];
+
+	VkImageCreateInfo image_info = chain_image_info(t, first_mip);
+	VkImage image;
+	VkResult res = vkCreateImage(info->device, &image_info, NULL, &image);
+	if (res != VK_SUCCESS)
+		throw VkException(res);
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(info->device, image, &requirements);
+	vkDestroyImage(info->device, image, NULL);
+
+	t->image_bytes[first_mip] = requirements.size;
+	return requirements.size;
+}
+
+//Smallest mip kept resident no matter the usage or the budget
+static uint32_t tail_mip(streamed_texture_t *t) {
+	uint32_t mip = 0;
+	while (mip + 1 < t->mip_count
+				 && std::max(mip_width(t, mip), mip_height(t, mip)) > STREAMER_TAIL_SIZE)
+		mip++;
+	return mip;
+}
+
+//=========== LOADER THREAD
+
+struct srgb_tables_t {
+	float decode[256];
+	uint8_t encode[SRGB_ENCODE_STEPS];
+};
+
+static const srgb_tables_t* srgb_tables() {
+	static srgb_tables_t tables = [] {
+		srgb_tables_t t;
+		for (uint32_t i = 0; i < 256; i++) {
+			float c = i / 255.0f;
+			t.decode[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (uint32_t i = 0; i < SRGB_ENCODE_STEPS; i++) {
+			float l = i / (float)(SRGB_ENCODE_STEPS - 1);
+			float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+			t.encode[i] = (uint8_t)(c * 255.0f + 0.5f);
+		}
+		return t;
+	}();
+	return &tables;
+}
+
+static void streamer_build_mips(streamed_texture_t *t) {
+	//sRGB texels are averaged in linear space, or the mips darken
+	const srgb_tables_t *srgb = t->texture.format == VK_FORMAT_R8G8B8A8_SRGB ? srgb_tables() : NULL;
+
+	for (uint32_t i = 1; i < t->mip_count; i++) {
+		uint32_t sw = mip_width(t, i - 1);
+		uint32_t sh = mip_height(t, i - 1);
+		uint32_t dw = mip_width(t, i);
+		uint32_t dh = mip_height(t, i);
+		const uint8_t *src = t->pixels[i - 1];
+		uint8_t *dst = new uint8_t[dw * dh * 4];
+
+		//2x2 box filter, edges are clamped for odd sizes
+		for (uint32_t y = 0; y < dh; y++) {
+			uint32_t y0 = std::min(y * 2, sh - 1);
+			uint32_t y1 = std::min(y * 2 + 1, sh - 1);
+			for (uint32_t x = 0; x < dw; x++) {
+				uint32_t x0 = std::min(x * 2, sw - 1);
+				uint32_t x1 = std::min(x * 2 + 1, sw - 1);
+				for (uint32_t c = 0; c < 4; c++) {
+					uint8_t a = src[(y0 * sw + x0) * 4 + c], b = src[(y0 * sw + x1) * 4 + c];
+					uint8_t d = src[(y1 * sw + x0) * 4 + c], e = src[(y1 * sw + x1) * 4 + c];
+					if (srgb != NULL && c < 3) {
+						float l = (srgb->decode[a] + srgb->decode[b] + srgb->decode[d] + srgb->decode[e]) / 4.0f;
+						dst[(y * dw + x) * 4 + c] = srgb->encode[(uint32_t)(l * (SRGB_ENCODE_STEPS - 1) + 0.5f)];
+					} else
+						dst[(y * dw + x) * 4 + c] = (a + b + d + e + 2) / 4;
+				}
+			}
+		}
+		t->pixels[i] = dst;
+	}
+}
+
+static void streamer_load(streamed_texture_t *t) {
+	uint32_t w, h;
+	if (!image_import_info(t->path.c_str(), &w, &h)) {
+		fprintf(stderr, "[ERROR] Unable to stream %s\n", t->path.c_str());
+		return;
+	}
+
+	/*
+	 * Decoded through a sink like the other imports, but into the host chain
+	 * rather than a staging buffer: the mips are built from this level and
+	 * every later upload of it is copied from here, so it has to outlive any
+	 * single staging allocation.
+	 */
+	uint8_t *pixels = new uint8_t[w * h * 4];
+	image_sink_t sink = { pixels, w * 4, w, h };
+	if (!image_import(t->path.c_str(), &sink)) {
+		delete[] pixels;
+		return;
+	}
+
+	t->texture.width = w;
+	t->texture.height = h;
+	t->texture.channels = 4;
+	t->mip_count = 1;
+	while (t->mip_count < STREAMER_MAX_MIPS && (std::max(w, h) >> t->mip_count) > 0)
+		t->mip_count++;
+
+	t->pixels[0] = pixels;
+	streamer_build_mips(t);
+	t->loaded.store(true, std::memory_order_release);
+}
+
+static void streamer_loader_main(texture_streamer_t *streamer) {
+	while (true) {
+		streamed_texture_t *t = NULL;
+		{
+			std::unique_lock<std::mutex> guard(streamer->lock);
+			streamer->wake.wait(guard, [streamer] {
+				return streamer->quit || !streamer->queue.empty();
+			});
+			if (streamer->quit)
+				return;
+			t = streamer->queue.front();
+			streamer->queue.pop_front();
+		}
+		streamer_load(t);
+	}
+}
+
+//=========== UPLOADS
+
+static void image_barrier(VkCommandBuffer command, VkImage image, uint32_t levels,
+													VkImageLayout old_layout, VkImageLayout new_layout,
+													VkAccessFlags src_access, VkAccessFlags dst_access,
+													VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage,
+													uint32_t src_family = VK_QUEUE_FAMILY_IGNORED,
+													uint32_t dst_family = VK_QUEUE_FAMILY_IGNORED) {
+	VkImageMemoryBarrier barrier = { };
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.pNext = NULL;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+	barrier.oldLayout = old_layout;
+	barrier.newLayout = new_layout;
+	barrier.srcQueueFamilyIndex = src_family;
+	barrier.dstQueueFamilyIndex = dst_family;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = levels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+
+	vkCmdPipelineBarrier(command, src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+static bool has_transfer_queue(vulkan_info_t *info) {
+	return info->transfer_queue_family_index != info->graphic_queue_family_index;
+}
+
+static VkCommandBuffer begin_command(vulkan_info_t *info, VkCommandPool pool) {
+	VkCommandBuffer command = create_command_buffer(info, pool);
+	VkCommandBufferBeginInfo begin_info = {};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.pNext = NULL;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	begin_info.pInheritanceInfo = NULL;
+	VkResult res = vkBeginCommandBuffer(command, &begin_info);
+	if (res != VK_SUCCESS)
+		throw VkException(res);
+	return command;
+}
+
+//Bytes the upload adds to its texture, none for an eviction
+static VkDeviceSize upload_growth(streamer_upload_t *u) {
+	return u->size > u->target->resident_bytes ? u->size - u->target->resident_bytes : 0;
+}
+
+//Staging, commands and semaphore go once the upload's submissions retired
+static void streamer_release_upload(vulkan_info_t *info, streamer_upload_t *u) {
+	if (u->staging.buffer != VK_NULL_HANDLE)
+		deferred_destroy_buffer(info, &u->staging, u->uploaded);
+	deferred_free_command(info, info->cmd_pool, u->command, u->uploaded);
+	if (u->transfer_command != VK_NULL_HANDLE)
+		deferred_free_command(info, info->transfer_cmd_pool, u->transfer_command, u->uploaded);
+	if (u->transferred != VK_NULL_HANDLE)
+		deferred_destroy_semaphore(info, u->transferred, u->uploaded);
+	delete u;
+}
+
+/*
+ * Builds a new image holding [first_mip, mip_count). Mips already resident
+ * are copied from the current image, the missing ones come from the host.
+ *
+ * With a dedicated transfer queue, the host copies run there while the
+ * graphic queue keeps rendering. The image is then released to the graphic
+ * family, and the graphic side of the upload waits on `transferred` before
+ * acquiring it, copying the resident mips and making it shader readable.
+ */
+static streamer_upload_t* streamer_begin_upload(vulkan_info_t *info, streamed_texture_t *t,
+																								uint32_t first_mip) {
+	streamer_upload_t *u = new streamer_upload_t();
+	uint32_t levels = t->mip_count - first_mip;
+	uint32_t staged_end = std::max(first_mip, std::min(t->resident_mip, t->mip_count));
+	bool has_old = t->resident_mip < t->mip_count;
+
+	//The upload reads the current image and replaces it: it must not move meanwhile
+	defrag_unregister(info, &t->relocation);
+
+	t->uploading = true;
+	u->target = t;
+	u->first_mip = first_mip;
+	image_create_optimal(info, mip_width(t, first_mip), mip_height(t, first_mip), levels,
+											 &u->image, &u->allocation, &u->size, t->texture.format,
+											 STREAMED_IMAGE_USAGE, MEMORY_CATEGORY_TEXTURE);
+
+	u->staging.buffer = VK_NULL_HANDLE;
+	VkDeviceSize staging_size = chain_size(t, first_mip, staged_end);
+	if (staging_size > 0) {
+		buffer_create(info, staging_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MEMORY_USAGE_UPLOAD,
+									MEMORY_CATEGORY_STAGING, &u->staging);
+
+		uint8_t *ptr = u->staging.allocation.mapped;
+		for (uint32_t i = first_mip; i < staged_end; i++) {
+			VkDeviceSize size = chain_size(t, i, i + 1);
+			memcpy(ptr, t->pixels[i], size);
+			ptr += size;
+		}
+	}
+
+	bool transfer = staging_size > 0 && has_transfer_queue(info);
+	u->command = begin_command(info, info->cmd_pool);
+	u->transfer_command = transfer ? begin_command(info, info->transfer_cmd_pool) : VK_NULL_HANDLE;
+	VkCommandBuffer copy_command = transfer ? u->transfer_command : u->command;
+
+	u->transferred = VK_NULL_HANDLE;
+	if (transfer && !info->timeline_semaphore) {
+		VkSemaphoreCreateInfo semaphore_info;
+		semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphore_info.pNext = NULL;
+		semaphore_info.flags = 0;
+		VkResult res = vkCreateSemaphore(info->device, &semaphore_info, NULL, &u->transferred);
+		if (res != VK_SUCCESS)
+			throw VkException(res);
+	}
+
+	image_barrier(copy_command, u->image, levels,
+								VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+								0, VK_ACCESS_TRANSFER_WRITE_BIT,
+								VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+	VkDeviceSize offset = 0;
+	for (uint32_t i = first_mip; i < staged_end; i++) {
+		VkBufferImageCopy region = { };
+		region.bufferOffset = offset;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = i - first_mip;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { mip_width(t, i), mip_height(t, i), 1 };
+
+		vkCmdCopyBufferToImage(copy_command, u->staging.buffer, u->image,
+													 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+		offset += chain_size(t, i, i + 1);
+	}
+
+	VkResult res;
+	uint64_t transfer_value = 0;
+	if (transfer) {
+		//Release and acquire halves of the ownership transfer, the layout is kept
+		image_barrier(u->transfer_command, u->image, levels,
+									VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+									VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+									VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+									info->transfer_queue_family_index, info->graphic_queue_family_index);
+		image_barrier(u->command, u->image, levels,
+									VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+									0, VK_ACCESS_TRANSFER_WRITE_BIT,
+									VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+									info->transfer_queue_family_index, info->graphic_queue_family_index);
+
+		res = vkEndCommandBuffer(u->transfer_command);
+		if (res != VK_SUCCESS)
+			throw VkException(res);
+
+		VkSubmitInfo submission = { };
+		submission.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submission.commandBufferCount = 1;
+		submission.pCommandBuffers = &u->transfer_command;
+		submission.signalSemaphoreCount = info->timeline_semaphore ? 0 : 1;
+		submission.pSignalSemaphores = &u->transferred;
+		transfer_value = timeline_submit(info, &info->transfer_timeline, &submission);
+	}
+
+	if (has_old) {
+		uint32_t old_levels = t->mip_count - t->resident_mip;
+		image_barrier(u->command, t->texture.texture_image, old_levels,
+									VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+									VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+									VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+		for (uint32_t i = staged_end; i < t->mip_count; i++) {
+			VkImageCopy region = { };
+			region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.srcSubresource.mipLevel = i - t->resident_mip;
+			region.srcSubresource.baseArrayLayer = 0;
+			region.srcSubresource.layerCount = 1;
+			region.dstSubresource = region.srcSubresource;
+			region.dstSubresource.mipLevel = i - first_mip;
+			region.srcOffset = { 0, 0, 0 };
+			region.dstOffset = { 0, 0, 0 };
+			region.extent = { mip_width(t, i), mip_height(t, i), 1 };
+
+			vkCmdCopyImage(u->command, t->texture.texture_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+										 u->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+		}
+
+		//Frames recorded before the swap still sample the old image
+		image_barrier(u->command, t->texture.texture_image, old_levels,
+									VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+									VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+									VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+
+	image_barrier(u->command, u->image, levels,
+								VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+								VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+								VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+	res = vkEndCommandBuffer(u->command);
+	assert(res == VK_SUCCESS);
+
+	//The graphic side waits on the transfer timeline value, or on the binary semaphore without timelines
+	bool timeline_dependency = transfer && info->timeline_semaphore;
+	timeline_wait_t transfer_wait = { &info->transfer_timeline, transfer_value, VK_PIPELINE_STAGE_TRANSFER_BIT };
+
+	VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	VkSubmitInfo submission = { };
+	submission.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submission.waitSemaphoreCount = transfer && !timeline_dependency ? 1 : 0;
+	submission.pWaitSemaphores = &u->transferred;
+	submission.pWaitDstStageMask = &wait_stage;
+	submission.commandBufferCount = 1;
+	submission.pCommandBuffers = &u->command;
+
+	u->uploaded = timeline_submit(info, &info->graphic_timeline, &submission,
+																&transfer_wait, timeline_dependency ? 1 : 0);
+	return u;
+}
+
+//Frames recorded until now may still sample the image: it goes with the next frame submitted
+static void streamer_release_image(vulkan_info_t *info, texture_streamer_t *streamer,
+																	 streamed_texture_t *t) {
+	defrag_unregister(info, &t->relocation);
+	if (t->texture.texture_image != VK_NULL_HANDLE) {
+		deferred_destroy_image(info, t->texture.texture_image, t->texture.view,
+																												 &t->texture.texture_allocation, DEFERRED_NEXT_FRAME);
+	}
+
+	streamer->resident_bytes -= t->resident_bytes;
+	t->texture.view = VK_NULL_HANDLE;
+	t->texture.texture_image = VK_NULL_HANDLE;
+	t->texture.texture_allocation = { };
+	t->resident_bytes = 0;
+}
+
+//The defragmenter moved the image: the view and the slot still point to the old one
+static void streamer_relocated(vulkan_info_t *info, defrag_resource_t *resource) {
+	streamed_texture_t *t = (streamed_texture_t*)resource->user;
+	deferred_destroy_image(info, VK_NULL_HANDLE, t->texture.view, NULL, DEFERRED_NEXT_FRAME);
+	image_view_create(info, t->texture.texture_image, t->texture.format, &t->texture.view,
+										t->mip_count - t->resident_mip);
+	vulkan_update_texture_slot(info, &t->texture);
+}
+
+static void streamer_track_image(vulkan_info_t *info, streamed_texture_t *t) {
+	VkImageCreateInfo image_info = chain_image_info(t, t->resident_mip);
+	defrag_register_image(info, &t->relocation, &t->texture.texture_image, &t->texture.texture_allocation,
+												&image_info, VK_IMAGE_ASPECT_COLOR_BIT, IMAGE_ACCESS_FRAGMENT_SAMPLED,
+												streamer_relocated, t);
+}
+
+/*
+ * Swaps the freshly built image in once the upload retired. Frames only see
+ * the new slot from their next start, the old image is released with the
+ * frame being recorded rather than waited for.
+ */
+static void streamer_finish_upload(vulkan_info_t *info, texture_streamer_t *streamer,
+																	 streamer_upload_t *u) {
+	streamed_texture_t *t = u->target;
+
+	streamer->uploading_bytes -= upload_growth(u);
+	streamer_release_image(info, streamer, t);
+	t->texture.texture_image = u->image;
+	t->texture.texture_allocation = u->allocation;
+	t->texture.size = u->size;
+	t->resident_mip = u->first_mip;
+	t->resident_bytes = u->size;
+	streamer->resident_bytes += u->size;
+	t->uploading = false;
+
+	image_view_create(info, u->image, t->texture.format, &t->texture.view, t->mip_count - u->first_mip);
+	vulkan_update_texture_slot(info, &t->texture);
+	streamer_track_image(info, t);
+	streamer_release_upload(info, u);
+}
+
+//=========== RESIDENCY
+
+static uint32_t streamer_desired_mip(streamed_texture_t *t) {
+	uint32_t tail = tail_mip(t);
+	if (t->screen_size <= 0.0f)
+		return tail;
+
+	float size = std::max(t->texture.width, t->texture.height);
+	float level = std::floor(std::log2(std::max(1.0f, size / t->screen_size)));
+	return std::min((uint32_t)level, tail);
+}
+
+//Coarsens the least visible textures first until the chains fit the budget
+static void streamer_fit_budget(vulkan_info_t *info, texture_streamer_t *streamer,
+																std::vector<streamed_texture_t*> &ready) {
+	VkDeviceSize total = 0;
+	for (streamed_texture_t *t : ready) {
+		t->desired_mip = streamer_desired_mip(t);
+		total += chain_image_size(info, t, t->desired_mip);
+	}
+
+	std::sort(ready.begin(), ready.end(), [](streamed_texture_t *a, streamed_texture_t *b) {
+		return a->screen_size < b->screen_size;
+	});
+
+	for (streamed_texture_t *t : ready) {
+		uint32_t tail = tail_mip(t);
+		while (total > streamer->budget && t->desired_mip < tail) {
+			total -= chain_image_size(info, t, t->desired_mip);
+			t->desired_mip++;
+			total += chain_image_size(info, t, t->desired_mip);
+		}
+	}
+}
+
+static void streamer_start_upload(vulkan_info_t *info, texture_streamer_t *streamer,
+																	streamed_texture_t *t, uint32_t first_mip) {
+	streamer_upload_t *u = streamer_begin_upload(info, t, first_mip);
+	streamer->uploads.push_back(u);
+	streamer->uploading_bytes += upload_growth(u);
+}
+
+//Starts uploads for textures not already being rebuilt, up to STREAMER_MAX_UPLOADS in flight
+static void streamer_schedule(vulkan_info_t *info, texture_streamer_t *streamer) {
+	if (streamer->uploads.size() >= STREAMER_MAX_UPLOADS)
+		return;
+	uint32_t free_uploads = STREAMER_MAX_UPLOADS - streamer->uploads.size();
+
+	std::vector<streamed_texture_t*> ready;
+	for (streamed_texture_t *t : streamer->textures)
+		if (t->loaded.load(std::memory_order_acquire))
+			ready.push_back(t);
+	if (ready.empty())
+		return;
+
+	streamer_fit_budget(info, streamer, ready);
+
+	//Evictions first: they give memory back for the promotions
+	for (streamed_texture_t *t : ready) {
+		if (free_uploads == 0)
+			return;
+		if (!t->uploading && t->resident_mip < t->mip_count && t->desired_mip > t->resident_mip) {
+			streamer_start_upload(info, streamer, t, t->desired_mip);
+			free_uploads--;
+		}
+	}
+
+	//Nothing resident yet: upload the small tail, then refine a mip at a time
+	for (auto it = ready.rbegin(); it != ready.rend(); ++it) {
+		streamed_texture_t *t = *it;
+		if (free_uploads == 0)
+			return;
+		if (!t->uploading && t->resident_mip >= t->mip_count) {
+			streamer_start_upload(info, streamer, t, tail_mip(t));
+			free_uploads--;
+		}
+	}
+
+	for (auto it = ready.rbegin(); it != ready.rend(); ++it) {
+		streamed_texture_t *t = *it;
+		if (free_uploads == 0)
+			return;
+		if (t->uploading || t->desired_mip >= t->resident_mip)
+			continue;
+
+		//Promotions in flight count before they land
+		VkDeviceSize extra = chain_image_size(info, t, t->resident_mip - 1) - t->resident_bytes;
+		if (streamer->resident_bytes + streamer->uploading_bytes + extra > streamer->budget)
+			continue;
+		streamer_start_upload(info, streamer, t, t->resident_mip - 1);
+		free_uploads--;
+	}
+}
+
+//=========== API
+
+void streamer_create(vulkan_info_t *info, texture_streamer_t *streamer, VkDeviceSize budget) {
+	streamer->budget = budget;
+	streamer->resident_bytes = 0;
+	streamer->quit = false;
+	streamer->uploading_bytes = 0;
+
+	//1x1 white texture shown until the real mips arrive
+	streamed_texture_t placeholder = { };
+	placeholder.texture.width = 1;
+	placeholder.texture.height = 1;
+	placeholder.texture.format = PLACEHOLDER_FORMAT;
+	placeholder.mip_count = 1;
+	placeholder.resident_mip = STREAMER_MAX_MIPS;
+	placeholder.resident_bytes = 0;
+	uint8_t white[4] = { 255, 255, 255, 255 };
+	placeholder.pixels[0] = white;
+
+	//Frames are submitted after the upload on the same queue, its barrier covers their reads
+	streamer_upload_t *u = streamer_begin_upload(info, &placeholder, 0);
+	streamer->placeholder = placeholder.texture;
+	streamer->placeholder.texture_image = u->image;
+	streamer->placeholder.texture_allocation = u->allocation;
+	image_view_create(info, streamer->placeholder.texture_image, PLACEHOLDER_FORMAT,
+																														 &streamer->placeholder.view);
+	streamer_release_upload(info, u);
+
+	streamer->loader = std::thread(streamer_loader_main, streamer);
+}
+
+streamed_texture_t* streamer_add(vulkan_info_t *info, texture_streamer_t *streamer,
+																 const char *path, texture_role_e role) {
+	streamed_texture_t *t = new streamed_texture_t();
+	t->texture = { };
+	t->texture.format = info->texture_formats[role];
+	t->path = path;
+	t->mip_count = 0;
+	t->resident_mip = STREAMER_MAX_MIPS;
+	t->desired_mip = 0;
+	t->resident_bytes = 0;
+	t->screen_size = 0.0f;
+	t->uploading = false;
+	t->loaded.store(false);
+	for (uint32_t i = 0; i < STREAMER_MAX_MIPS; i++) {
+		t->pixels[i] = NULL;
+		t->image_bytes[i] = 0;
+	}
+
+	image_sampler_create(info, &t->texture.sampler);
+	t->texture.view = streamer->placeholder.view;
+	vulkan_register_texture(info, &t->texture);
+	t->texture.view = VK_NULL_HANDLE;
+
+	streamer->textures.push_back(t);
+	{
+		std::lock_guard<std::mutex> guard(streamer->lock);
+		streamer->queue.push_back(t);
+	}
+	streamer->wake.notify_one();
+	return t;
+}
+
+void streamer_set_usage(streamed_texture_t *texture, float screen_size) {
+	texture->screen_size = screen_size;
+}
+
+/*
+ * Called once per frame, never waits on the GPU. Swaps in the uploads that
+ * retired and starts new ones. Returns true when a texture slot was rewritten.
+ */
+bool streamer_update(vulkan_info_t *info, texture_streamer_t *streamer) {
+	bool swapped = false;
+
+	std::vector<streamer_upload_t*> &uploads = streamer->uploads;
+	for (size_t i = 0; i < uploads.size();) {
+		if (!timeline_reached(info, &info->graphic_timeline, uploads[i]->uploaded)) {
+			i++;
+			continue;
+		}
+		streamer_finish_upload(info, streamer, uploads[i]);
+		uploads.erase(uploads.begin() + i);
+		swapped = true;
+	}
+
+	streamer_schedule(info, streamer);
+	return swapped;
+}
+
+void streamer_destroy(vulkan_info_t *info, texture_streamer_t *streamer) {
+	{
+		std::lock_guard<std::mutex> guard(streamer->lock);
+		streamer->quit = true;
+	}
+	streamer->wake.notify_all();
+	streamer->loader.join();
+
+	//Called with the device idle: what is released goes with vulkan_cleanup
+	for (streamer_upload_t *u : streamer->uploads) {
+		deferred_destroy_image(info, u->image, VK_NULL_HANDLE, &u->allocation, u->uploaded);
+		streamer_release_upload(info, u);
+	}
+	streamer->uploads.clear();
+
+	for (streamed_texture_t *t : streamer->textures) {
+		streamer_release_image(info, streamer, t);
+		image_sampler_release(info, t->texture.sampler);
+		for (uint32_t i = 0; i < t->mip_count; i++)
+			delete[] t->pixels[i];
+		delete t;
+	}
+	streamer->textures.clear();
+
+	vkDestroyImageView(info->device, streamer->placeholder.view, NULL);
+	vkDestroyImage(info->device, streamer->placeholder.texture_image, NULL);
+	memory_free(info, &streamer->placeholder.texture_allocation);
+}
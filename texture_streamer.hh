@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "types.hh"
+#include "vulkan.hh"
+
+#define STREAMER_MAX_MIPS (16)
+//Mips up to this size are uploaded as soon as the file is decoded
+#define STREAMER_TAIL_SIZE (64)
+//Uploads in flight at once, each building the next image of a different texture
+#define STREAMER_MAX_UPLOADS (4)
+
+/*
+ * A texture whose GPU image only holds the mips [resident_mip, mip_count),
+ * resident_mip is STREAMER_MAX_MIPS while nothing is uploaded.
+ * The whole chain is kept decoded in host memory, so promotions and
+ * evictions never touch the disk again.
+ */
+struct streamed_texture_t {
+	texture_t texture;
+	std::string path;
+
+	uint32_t mip_count;
+	uint8_t *pixels[STREAMER_MAX_MIPS];
+	std::atomic<bool> loaded;
+
+	uint32_t resident_mip;
+	uint32_t desired_mip;
+	//Allocation size of the resident image, the unit the budget is counted in
+	VkDeviceSize resident_bytes;
+	//Image size per first mip, queried from the driver on first use
+	VkDeviceSize image_bytes[STREAMER_MAX_MIPS];
+	float screen_size;
+	defrag_resource_t relocation;
+	//An upload is building its next image
+	bool uploading;
+};
+
+struct streamer_upload_t {
+	streamed_texture_t *target;
+	uint32_t first_mip;
+	VkImage image;
+	gpu_allocation_t allocation;
+	VkDeviceSize size;
+	data_buffer_t staging;
+	VkCommandBuffer command;
+	//Host mips copied on the transfer queue, null when they go through `command`
+	VkCommandBuffer transfer_command;
+	//Fence path only: transfer queue copies done, waited by the graphic side of the upload
+	VkSemaphore transferred;
+	//Graphic timeline value of the upload's last submission
+	uint64_t uploaded;
+};
+
+struct texture_streamer_t {
+	VkDeviceSize budget;
+	VkDeviceSize resident_bytes;
+	std::vector<streamed_texture_t*> textures;
+
+	//Placeholder bound to slots whose file is not decoded yet
+	texture_t placeholder;
+
+	std::thread loader;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::deque<streamed_texture_t*> queue;
+	bool quit;
+
+	//Polled on the graphic timeline, in no particular order
+	std::vector<streamer_upload_t*> uploads;
+	//What the uploads add to their textures, counted against the budget before it lands
+	VkDeviceSize uploading_bytes;
+};
+
+void streamer_create(vulkan_info_t *info, texture_streamer_t *streamer, VkDeviceSize budget);
+streamed_texture_t* streamer_add(vulkan_info_t *info, texture_streamer_t *streamer,
+																 const char *path, texture_role_e role);
+void streamer_set_usage(streamed_texture_t *texture, float screen_size);
+bool streamer_update(vulkan_info_t *info, texture_streamer_t *streamer);
+void streamer_destroy(vulkan_info_t *info, texture_streamer_t *streamer);
@@ -0,0 +1,223 @@
+#include <algorithm>
+
+#include "timeline.hh"
+#include "vulkan.hh"
+#include "vulkan_exception.hh"
+
+void timeline_create(vulkan_info_t *info, timeline_t *timeline, VkQueue queue) {
+	timeline->queue = queue;
+	timeline->semaphore = VK_NULL_HANDLE;
+	timeline->submitted = 0;
+	timeline->completed = 0;
+
+#ifdef VK_KHR_timeline_semaphore
+	if (!info->timeline_semaphore)
+		return;
+
+	timeline->get_value = (PFN_vkGetSemaphoreCounterValueKHR)
+		vkGetDeviceProcAddr(info->device, "vkGetSemaphoreCounterValueKHR");
+	timeline->wait_semaphores = (PFN_vkWaitSemaphoresKHR)
+		vkGetDeviceProcAddr(info->device, "vkWaitSemaphoresKHR");
+	if (timeline->get_value == NULL || timeline->wait_semaphores == NULL)
+		throw VkException(VK_ERROR_EXTENSION_NOT_PRESENT);
+
+	VkSemaphoreTypeCreateInfoKHR type_info = { };
+	type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+	type_info.pNext = NULL;
+	type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+	type_info.initialValue = 0;
+
+	VkSemaphoreCreateInfo create_info = { };
+	create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	create_info.pNext = &type_info;
+	create_info.flags = 0;
+	VkResult res = vkCreateSemaphore(info->device, &create_info, NULL, &timeline->semaphore);
+	if (res != VK_SUCCESS)
+		throw VkException(res);
+#endif
+}
+
+void timeline_destroy(vulkan_info_t *info, timeline_t *timeline) {
+	timeline_wait(info, timeline, timeline->submitted);
+
+	for (VkFence fence : timeline->free_fences)
+		vkDestroyFence(info->device, fence, NULL);
+	timeline->free_fences.clear();
+	if (timeline->semaphore != VK_NULL_HANDLE)
+		vkDestroySemaphore(info->device, timeline->semaphore, NULL);
+}
+
+//Fence path: recycles the fences of every submission up to the value
+static void timeline_retire(vulkan_info_t *info, timeline_t *timeline, uint64_t value) {
+	while (!timeline->pending.empty() && timeline->pending.front().value <= value) {
+		VkFence fence = timeline->pending.front().fence;
+		VkResult res = vkResetFences(info->device, 1, &fence);
+		if (res != VK_SUCCESS)
+			throw VkException(res);
+		timeline->free_fences.push_back(fence);
+		timeline->pending.pop_front();
+	}
+	timeline->completed = std::max(timeline->completed, value);
+}
+
+//Fence path: recycles the fences already signaled, never blocks
+static void timeline_poll(vulkan_info_t *info, timeline_t *timeline) {
+	//A fence also covers every earlier submission to the queue
+	uint64_t reached = timeline->completed;
+	for (const timeline_fence_t &pending : timeline->pending) {
+		if (vkGetFenceStatus(info->device, pending.fence) != VK_SUCCESS)
+			break;
+		reached = pending.value;
+	}
+	timeline_retire(info, timeline, reached);
+}
+
+#ifdef VK_KHR_timeline_semaphore
+/*
+ * The timeline semaphore is appended to the signals, the waits to the wait
+ * semaphores. Binary semaphores already in the submission take a value of 0,
+ * which the driver ignores.
+ */
+static void timeline_submit_semaphore(vulkan_info_t *info, timeline_t *timeline,
+																			const VkSubmitInfo *submit, uint64_t value,
+																			const timeline_wait_t *waits, uint32_t wait_count) {
+	std::vector<VkSemaphore> wait_semaphores(submit->pWaitSemaphores,
+																					 submit->pWaitSemaphores + submit->waitSemaphoreCount);
+	std::vector<VkPipelineStageFlags> wait_stages(submit->pWaitDstStageMask,
+																								submit->pWaitDstStageMask + submit->waitSemaphoreCount);
+	std::vector<uint64_t> wait_values(submit->waitSemaphoreCount, 0);
+	for (uint32_t i = 0; i < wait_count; i++) {
+		wait_semaphores.push_back(waits[i].timeline->semaphore);
+		wait_stages.push_back(waits[i].stage);
+		wait_values.push_back(waits[i].value);
+	}
+
+	std::vector<VkSemaphore> signal_semaphores(submit->pSignalSemaphores,
+																						 submit->pSignalSemaphores + submit->signalSemaphoreCount);
+	std::vector<uint64_t> signal_values(submit->signalSemaphoreCount, 0);
+	signal_semaphores.push_back(timeline->semaphore);
+	signal_values.push_back(value);
+
+	VkTimelineSemaphoreSubmitInfoKHR values = { };
+	values.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+	values.pNext = submit->pNext;
+	values.waitSemaphoreValueCount = wait_values.size();
+	values.pWaitSemaphoreValues = wait_values.data();
+	values.signalSemaphoreValueCount = signal_values.size();
+	values.pSignalSemaphoreValues = signal_values.data();
+
+	VkSubmitInfo submission = *submit;
+	submission.pNext = &values;
+	submission.waitSemaphoreCount = wait_semaphores.size();
+	submission.pWaitSemaphores = wait_semaphores.data();
+	submission.pWaitDstStageMask = wait_stages.data();
+	submission.signalSemaphoreCount = signal_semaphores.size();
+	submission.pSignalSemaphores = signal_semaphores.data();
+
+	VkResult res = vkQueueSubmit(timeline->queue, 1, &submission, VK_NULL_HANDLE);
+	if (res != VK_SUCCESS)
+		throw VkException(res);
+}
+#endif
+
+/*
+ * Returns the value the submission signals once complete.
+ * On the fence path a wait cannot be handed to the GPU: the CPU waits for the
+ * value before submitting. Binary semaphores keep working on both paths.
+ */
+uint64_t timeline_submit(vulkan_info_t *info, timeline_t *timeline, const VkSubmitInfo *submit,
+												 const timeline_wait_t *waits, uint32_t wait_count) {
+	uint64_t value = timeline->submitted + 1;
+
+#ifdef VK_KHR_timeline_semaphore
+	if (timeline->semaphore != VK_NULL_HANDLE) {
+		timeline_submit_semaphore(info, timeline, submit, value, waits, wait_count);
+		timeline->submitted = value;
+		return value;
+	}
+#endif
+
+	for (uint32_t i = 0; i < wait_count; i++)
+		timeline_wait(info, waits[i].timeline, waits[i].value);
+
+	//A timeline only submitted to is never polled otherwise, its fences would pile up
+	if (timeline->free_fences.empty())
+		timeline_poll(info, timeline);
+
+	VkFence fence;
+	if (timeline->free_fences.empty()) {
+		VkFenceCreateInfo fence_info;
+		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fence_info.pNext = NULL;
+		fence_info.flags = 0;
+		VkResult res = vkCreateFence(info->device, &fence_info, NULL, &fence);
+		if (res != VK_SUCCESS)
+			throw VkException(res);
+	} else {
+		fence = timeline->free_fences.back();
+		timeline->free_fences.pop_back();
+	}
+
+	VkResult res = vkQueueSubmit(timeline->queue, 1, submit, fence);
+	if (res != VK_SUCCESS) {
+		timeline->free_fences.push_back(fence);
+		throw VkException(res);
+	}
+	timeline->pending.push_back({ value, fence });
+	timeline->submitted = value;
+	return value;
+}
+
+bool timeline_reached(vulkan_info_t *info, timeline_t *timeline, uint64_t value) {
+	assert(value <= timeline->submitted);
+	if (value <= timeline->completed)
+		return true;
+
+#ifdef VK_KHR_timeline_semaphore
+	if (timeline->semaphore != VK_NULL_HANDLE) {
+		uint64_t current = 0;
+		VkResult res = timeline->get_value(info->device, timeline->semaphore, &current);
+		if (res != VK_SUCCESS)
+			throw VkException(res);
+		timeline->completed = std::max(timeline->completed, current);
+		return value <= timeline->completed;
+	}
+#endif
+
+	timeline_poll(info, timeline);
+	return value <= timeline->completed;
+}
+
+void timeline_wait(vulkan_info_t *info, timeline_t *timeline, uint64_t value) {
+	assert(value <= timeline->submitted);
+	if (value <= timeline->completed)
+		return;
+
+#ifdef VK_KHR_timeline_semaphore
+	if (timeline->semaphore != VK_NULL_HANDLE) {
+		VkSemaphoreWaitInfoKHR wait_info = { };
+		wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+		wait_info.pNext = NULL;
+		wait_info.flags = 0;
+		wait_info.semaphoreCount = 1;
+		wait_info.pSemaphores = &timeline->semaphore;
+		wait_info.pValues = &value;
+		VkResult res = timeline->wait_semaphores(info->device, &wait_info, UINT64_MAX);
+		if (res != VK_SUCCESS)
+			throw VkException(res);
+		timeline->completed = value;
+		return;
+	}
+#endif
+
+	//Pending values are consecutive: the first one at or past the value is the one to wait
+	for (const timeline_fence_t &pending : timeline->pending) {
+		if (pending.value < value)
+			continue;
+		VkResult res = vkWaitForFences(info->device, 1, &pending.fence, VK_TRUE, UINT64_MAX);
+		if (res != VK_SUCCESS)
+			throw VkException(res);
+		timeline_retire(info, timeline, pending.value);
+		return;
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+struct vulkan_info_t;
+
+struct timeline_fence_t {
+	uint64_t value;
+	VkFence fence;
+};
+
+/*
+ * Monotonic counter of the submissions made to one queue: every submission
+ * signals the next value, and waits target a value instead of a fence.
+ * Backed by a timeline semaphore with VK_KHR_timeline_semaphore. Otherwise a
+ * fence per pending submission stands in, recycled once its value is reached.
+ * Value 0 is never signaled and counts as reached.
+ */
+struct timeline_t {
+	VkQueue queue;
+	//Null on the fence path
+	VkSemaphore semaphore;
+	//Last value handed out to a submission
+	uint64_t submitted;
+	//Highest value known to be reached
+	uint64_t completed;
+
+	//Fence path: submissions in flight, oldest first, and reset fences for reuse
+	std::deque<timeline_fence_t> pending;
+	std::vector<VkFence> free_fences;
+
+#ifdef VK_KHR_timeline_semaphore
+	PFN_vkGetSemaphoreCounterValueKHR get_value;
+	PFN_vkWaitSemaphoresKHR wait_semaphores;
+#endif
+};
+
+//A GPU wait on another timeline, added to a submission
+struct timeline_wait_t {
+	timeline_t *timeline;
+	uint64_t value;
+	VkPipelineStageFlags stage;
+};
+
+void timeline_create(vulkan_info_t *info, timeline_t *timeline, VkQueue queue);
+void timeline_destroy(vulkan_info_t *info, timeline_t *timeline);
+
+uint64_t timeline_submit(vulkan_info_t *info, timeline_t *timeline, const VkSubmitInfo *submit,
+												 const timeline_wait_t *waits = NULL, uint32_t wait_count = 0);
+bool timeline_reached(vulkan_info_t *info, timeline_t *timeline, uint64_t value);
+void timeline_wait(vulkan_info_t *info, timeline_t *timeline, uint64_t value);
@@ -4,6 +4,8 @@
 #include <glm/vec4.hpp>
 #include <vulkan/vulkan.hpp>
 
+#include "image_state.hh"
+
 struct scene_info_t {
 	glm::mat4 clip;
 	glm::mat4 model;
@@ -25,9 +27,44 @@ struct vertex_t {
 	v2_t uv;
 };
 
+//Per-instance vertex attributes, the transform takes locations 3 to 6
+struct instance_t {
+	glm::mat4 transform;
+};
+
+enum vertex_binding_e {
+	VERTEX_BINDING_GEOMETRY,
+	VERTEX_BINDING_INSTANCE,
+	VERTEX_BINDING_COUNT
+};
+
 struct model_t {
 	vertex_t *vertices;
 	uint32_t count;
+	uint32_t *indices;
+	uint32_t index_count;
+};
+
+struct memory_block_t;
+
+//Range of a VkDeviceMemory handed out by memory_alloc, block is NULL when dedicated
+struct gpu_allocation_t {
+	VkDeviceMemory memory;
+	VkDeviceSize offset;
+	VkDeviceSize size;
+	uint8_t *mapped;
+	uint32_t memory_type;
+	uint32_t kind;
+	uint32_t category;
+	memory_block_t *block;
+	uint32_t order;
+};
+
+//Color maps are sampled through sRGB formats, data maps (normals, roughness...) stay linear
+enum texture_role_e {
+	TEXTURE_ROLE_COLOR,
+	TEXTURE_ROLE_DATA,
+	TEXTURE_ROLE_COUNT
 };
 
 struct texture_t {
@@ -35,10 +72,30 @@ struct texture_t {
 	uint32_t height;
 	uint32_t channels;
 	VkDeviceSize size;
+	VkFormat format;
 	VkImage storage_image;
-	VkDeviceMemory storage_memory;
+	gpu_allocation_t storage_allocation;
 	VkImage texture_image;
-	VkDeviceMemory texture_memory;
+	gpu_allocation_t texture_allocation;
+	//Layouts tracked across commits
+	image_state_t storage_state;
+	image_state_t texture_state;
+	//Batch of the last commit, completed before the host writes the staging image again: it must outlive the next map
+	struct upload_batch_t *committed;
+	VkImageView view;
+	VkSampler sampler;
+	uint32_t index;
+};
+
+//Pushed before each draw, read by the fragment shader
+struct draw_constants_t {
+	uint32_t texture_index;
+};
+
+//Specialization constants of the fragment shader, ids in declaration order
+struct texture_specialization_t {
+	VkBool32 table;
+	uint32_t slots;
 };
 
 //unused
@@ -51,21 +108,39 @@ struct swapchain_buffer_t {
 	VkImage image;
 	VkImageView view;
 	VkFramebuffer framebuffer;
-	VkCommandBuffer command;
 	VkCommandBuffer present_transition_cmd;
-	VkFence fence;
+	//Signaled by the last submission rendering the image, waited by its presentation
+	VkSemaphore rendered;
+};
+
+/*
+ * One slot of the frames in flight ring. Reaching the retire value on the
+ * graphic timeline frees everything the slot owns: its acquire semaphore,
+ * its uniform slice and its command buffers.
+ * Commands are recorded per swapchain image since the framebuffer differs.
+ */
+struct render_frame_t {
+	//Graphic timeline value of the slot's last submission
+	uint64_t retire;
+	VkSemaphore acquired;
+	//Indexed by swapchain image
+	VkCommandBuffer *commands;
+	//Scene version each command buffer was recorded against
+	uint64_t *recorded_versions;
+};
+
+//Static buffers live in device local memory and are filled through a staging copy,
+//dynamic ones stay host visible to be rewritten from the CPU
+enum buffer_mode_e {
+	BUFFER_MODE_STATIC,
+	BUFFER_MODE_DYNAMIC
 };
 
 struct data_buffer_t {
 	VkDescriptorBufferInfo descriptor;
-	VkDeviceMemory memory;
+	gpu_allocation_t allocation;
 	VkBuffer buffer;
-};
-
-struct image_buffer_t {
-	VkFormat format;
-	VkImage image;
-	VkDeviceMemory memory;
-	VkImageView view;
+	//As created, a replacement must match it
+	VkBufferUsageFlags usage;
 };
 
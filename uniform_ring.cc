@@ -0,0 +1,60 @@
+#include <algorithm>
+#include <cstring>
+
+#include "uniform_ring.hh"
+#include "vulkan.hh"
+#include "vulkan_exception.hh"
+#include "vulkan_wrappers.hh"
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+void uniform_ring_create(vulkan_info_t *info, uniform_ring_t *ring, uint32_t frame_count,
+												 VkDeviceSize frame_budget, VkDeviceSize range) {
+	const VkPhysicalDeviceLimits *limits = &info->device_properties.limits;
+	assert(range <= frame_budget);
+	if (range > limits->maxUniformBufferRange)
+		throw VkException(VK_ERROR_FEATURE_NOT_PRESENT);
+
+	ring->alignment = std::max(limits->minUniformBufferOffsetAlignment, (VkDeviceSize)1);
+	ring->frame_size = align_up(frame_budget, ring->alignment);
+	ring->frame_count = frame_count;
+	ring->frame = 0;
+	ring->head = 0;
+
+	buffer_create(info, ring->frame_size * frame_count, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+								MEMORY_USAGE_DYNAMIC, MEMORY_CATEGORY_UNIFORM, &ring->buffer);
+	ring->buffer.descriptor.range = range;
+}
+
+void uniform_ring_destroy(vulkan_info_t *info, uniform_ring_t *ring) {
+	buffer_destroy(info, &ring->buffer);
+}
+
+//The caller guarantees the frame that last used this slice has retired
+void uniform_ring_begin_frame(uniform_ring_t *ring, uint32_t frame) {
+	assert(frame < ring->frame_count);
+	ring->frame = frame;
+	ring->head = 0;
+}
+
+/*
+ * Returns the dynamic offset to bind the pushed data with. Past the budget,
+ * the write would land in the next slice, maybe still read by its frame.
+ */
+uint32_t uniform_ring_push(uniform_ring_t *ring, const void *data, VkDeviceSize size) {
+	assert(size <= ring->buffer.descriptor.range && "Push larger than the descriptor window");
+	VkDeviceSize offset = align_up(ring->head, ring->alignment);
+	if (offset + size > ring->frame_size)
+		throw VkException(VK_ERROR_OUT_OF_DEVICE_MEMORY);
+
+	offset += ring->frame_size * ring->frame;
+	memcpy(ring->buffer.allocation.mapped + offset, data, size);
+	ring->head = offset - ring->frame_size * ring->frame + size;
+	return (uint32_t)offset;
+}
+
+uint32_t uniform_ring_frame_offset(const uniform_ring_t *ring, uint32_t frame) {
+	return (uint32_t)(ring->frame_size * frame);
+}
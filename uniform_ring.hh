@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include "types.hh"
+
+struct vulkan_info_t;
+
+//Uniform bytes one frame may push, rounded up to minUniformBufferOffsetAlignment
+#define UNIFORM_FRAME_BUDGET (16 << 10)
+
+/*
+ * One persistently mapped buffer split in a slice per frame in flight.
+ * Pushes are sub-allocated inside the current slice and addressed with
+ * dynamic offsets, so a slice is only rewritten once the frame that read it
+ * has retired. The descriptor exposes a window of `range` bytes.
+ */
+struct uniform_ring_t {
+	data_buffer_t buffer;
+	VkDeviceSize alignment;
+	VkDeviceSize frame_size;
+	uint32_t frame_count;
+	uint32_t frame;
+	VkDeviceSize head;
+};
+
+void uniform_ring_create(vulkan_info_t *info, uniform_ring_t *ring, uint32_t frame_count,
+												 VkDeviceSize frame_budget, VkDeviceSize range);
+void uniform_ring_destroy(vulkan_info_t *info, uniform_ring_t *ring);
+
+void uniform_ring_begin_frame(uniform_ring_t *ring, uint32_t frame);
+uint32_t uniform_ring_push(uniform_ring_t *ring, const void *data, VkDeviceSize size);
+uint32_t uniform_ring_frame_offset(const uniform_ring_t *ring, uint32_t frame);
@@ -0,0 +1,130 @@
+#include <cstring>
+
+#include "upload_batch.hh"
+#include "vulkan.hh"
+#include "vulkan_exception.hh"
+#include "vulkan_wrappers.hh"
+
+void upload_batch_create(vulkan_info_t *info, upload_batch_t *batch) {
+	batch->command = VK_NULL_HANDLE;
+	batch->value = 0;
+	batch->pending = false;
+	batch->staging.clear();
+}
+
+//Whatever is still recorded is flushed first
+void upload_batch_destroy(vulkan_info_t *info, upload_batch_t *batch) {
+	if (!batch->pending)
+		upload_batch_submit(info, batch);
+	upload_batch_wait(info, batch);
+}
+
+VkCommandBuffer upload_batch_command(vulkan_info_t *info, upload_batch_t *batch) {
+	assert(!batch->pending && "The batch must complete before recording again");
+	if (batch->command != VK_NULL_HANDLE)
+		return batch->command;
+
+	batch->command = create_command_buffer(info, info->cmd_pool);
+	VkCommandBufferBeginInfo begin_info = {};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.pNext = NULL;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	begin_info.pInheritanceInfo = NULL;
+
+	VkResult res = vkBeginCommandBuffer(batch->command, &begin_info);
+	if (res != VK_SUCCESS)
+		throw VkException(res);
+	return batch->command;
+}
+
+/*
+ * Coherent mapped memory is written in place (dynamic buffers, UMA devices).
+ * Anything else goes through a staging buffer and a copy, the barrier makes
+ * the copy visible to the stage reading the buffer.
+ */
+void upload_batch_buffer(vulkan_info_t *info, upload_batch_t *batch, data_buffer_t *buffer,
+												 const void *data, VkDeviceSize size,
+												 VkAccessFlags dst_access, VkPipelineStageFlags dst_stage) {
+	assert(size <= buffer->descriptor.range);
+
+	VkMemoryPropertyFlags flags =
+		info->memory_properties.memoryTypes[buffer->allocation.memory_type].propertyFlags;
+	if (buffer->allocation.mapped != NULL && (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+		memcpy(buffer->allocation.mapped, data, size);
+		return;
+	}
+
+	VkCommandBuffer command = upload_batch_command(info, batch);
+
+	data_buffer_t staging = { };
+	buffer_create(info, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MEMORY_USAGE_UPLOAD,
+								MEMORY_CATEGORY_STAGING, &staging);
+	memcpy(staging.allocation.mapped, data, size);
+	batch->staging.push_back(staging);
+
+	VkBufferCopy region = { };
+	region.srcOffset = 0;
+	region.dstOffset = 0;
+	region.size = size;
+	vkCmdCopyBuffer(command, staging.buffer, buffer->buffer, 1, &region);
+
+	VkBufferMemoryBarrier barrier = { };
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.pNext = NULL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = dst_access;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = buffer->buffer;
+	barrier.offset = 0;
+	barrier.size = size;
+
+	vkCmdPipelineBarrier(command, VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage,
+											 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+//Nothing recorded, nothing submitted: the batch stays complete
+void upload_batch_submit(vulkan_info_t *info, upload_batch_t *batch) {
+	assert(!batch->pending);
+	if (batch->command == VK_NULL_HANDLE)
+		return;
+
+	VkResult res = vkEndCommandBuffer(batch->command);
+	if (res != VK_SUCCESS)
+		throw VkException(res);
+
+	VkSubmitInfo submission = { };
+	submission.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submission.commandBufferCount = 1;
+	submission.pCommandBuffers = &batch->command;
+
+	batch->value = timeline_submit(info, &info->graphic_timeline, &submission);
+	batch->pending = true;
+}
+
+static void upload_batch_release(vulkan_info_t *info, upload_batch_t *batch) {
+	for (data_buffer_t &staging : batch->staging)
+		buffer_destroy(info, &staging);
+	batch->staging.clear();
+
+	vkFreeCommandBuffers(info->device, info->cmd_pool, 1, &batch->command);
+	batch->command = VK_NULL_HANDLE;
+	batch->pending = false;
+}
+
+//True once the submitted work completed, or when nothing was submitted
+bool upload_batch_poll(vulkan_info_t *info, upload_batch_t *batch) {
+	if (!batch->pending)
+		return true;
+	if (!timeline_reached(info, &info->graphic_timeline, batch->value))
+		return false;
+	upload_batch_release(info, batch);
+	return true;
+}
+
+void upload_batch_wait(vulkan_info_t *info, upload_batch_t *batch) {
+	if (!batch->pending)
+		return;
+	timeline_wait(info, &info->graphic_timeline, batch->value);
+	upload_batch_release(info, batch);
+}
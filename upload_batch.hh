@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "types.hh"
+
+struct vulkan_info_t;
+
+/*
+ * Uploads recorded into a single command buffer and submitted once on the
+ * graphic timeline. Loading a scene costs one submission and one wait however
+ * many copies and transitions it needs. Staging buffers are kept alive until
+ * the timeline reaches the submission, the batch can then record again.
+ */
+struct upload_batch_t {
+	VkCommandBuffer command;
+	//Graphic timeline value signaled once the copies completed
+	uint64_t value;
+	bool pending;
+	std::vector<data_buffer_t> staging;
+};
+
+void upload_batch_create(vulkan_info_t *info, upload_batch_t *batch);
+void upload_batch_destroy(vulkan_info_t *info, upload_batch_t *batch);
+
+//Command buffer being recorded, begun on first use
+VkCommandBuffer upload_batch_command(vulkan_info_t *info, upload_batch_t *batch);
+void upload_batch_buffer(vulkan_info_t *info, upload_batch_t *batch, data_buffer_t *buffer,
+												 const void *data, VkDeviceSize size,
+												 VkAccessFlags dst_access, VkPipelineStageFlags dst_stage);
+
+void upload_batch_submit(vulkan_info_t *info, upload_batch_t *batch);
+bool upload_batch_poll(vulkan_info_t *info, upload_batch_t *batch);
+void upload_batch_wait(vulkan_info_t *info, upload_batch_t *batch);
@@ -1,6 +1,7 @@
 #include <vector>
 #include <sstream>
 #include <chrono>
+#include <csignal>
 #include <inttypes.h>
 
 #include "helpers.hh"
@@ -10,6 +11,9 @@
 #include "vulkan_render.hh"
 #include "vulkan_wrappers.hh"
 #include "assets_loader.hh"
+#include "culling.hh"
+#include "job_system.hh"
+#include "texture_streamer.hh"
 
 #define MESH_PATH "assets/r5d4/model.obj"
 #define MESH_DIFFUSE "assets/r5d4/tex_albedo.jpg"
@@ -23,14 +27,176 @@
 #define CLOCKS_PER_FRAME ((long int)((1.0F / FRAMERATE) * CLOCKS_PER_SEC))
 #define DEG2RAD (0.20943951023f)
 
-//This main is used as a draft, don't worry
+#define TEXTURE_STREAMING 1
+#define STREAMING_BUDGET (256ull << 20)
+#define FOV_Y 45.0f
+#define DEFRAG_BUDGET_US (500)
+//Frames the CPU may record ahead of the GPU, whatever the swapchain image count
+#define FRAMES_IN_FLIGHT (2)
+//Copies of the model laid on a grid, in model diameters
+#define INSTANCE_SPACING (1.25f)
+#define GOLDEN_ANGLE (2.39996323f)
+//Indirect commands per frame for the runs of visible instances
+#define MAX_VISIBLE_RUNS (4096)
+
+//kill -USR1 <pid> prints the per-heap memory usage and budget, and the sampler cache hits
+static volatile sig_atomic_t memory_report_requested = 0;
+
+static void request_memory_report(int) {
+	memory_report_requested = 1;
+}
+
+//The draw keeps its own copy of the buffer handle
+static void vertex_buffer_relocated(vulkan_info_t *info, defrag_resource_t *resource) {
+	render_draw_t *draw = (render_draw_t*)resource->user;
+	info->vertex_buffer.descriptor.buffer = info->vertex_buffer.buffer;
+	draw->vertex_buffer = info->vertex_buffer;
+}
+
+static void index_buffer_relocated(vulkan_info_t *info, defrag_resource_t *resource) {
+	render_draw_t *draw = (render_draw_t*)resource->user;
+	info->index_buffer.descriptor.buffer = info->index_buffer.buffer;
+	draw->index_buffer = info->index_buffer;
+}
+
+static void instance_buffer_relocated(vulkan_info_t *info, defrag_resource_t *resource) {
+	render_draw_t *draw = (render_draw_t*)resource->user;
+	info->instance_buffer.descriptor.buffer = info->instance_buffer.buffer;
+	draw->instance_buffer = info->instance_buffer;
+}
+
+//Square grid centered on the origin, each copy turned differently
+static void layout_instances(instance_t *instances, uint32_t count, uint32_t side, float spacing) {
+	float offset = (side - 1) * spacing * 0.5f;
+	for (uint32_t i = 0; i < count; i++) {
+		glm::vec3 position = glm::vec3((i % side) * spacing - offset, 0.0f, (i / side) * spacing - offset);
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+		instances[i].transform = glm::rotate(transform, i * GOLDEN_ANGLE, glm::vec3(0, 1, 0));
+	}
+}
+
+/*
+ * Visible instances are drawn as runs of consecutive indices, a command
+ * each. Past the last command, the last run stretches over the culled
+ * instances in between. Returns the number of commands.
+ */
+static uint32_t write_visible_runs(vulkan_info_t *info, vulkan_frame_info_t *frame, uint32_t slot,
+																	 const cull_result_t *visible) {
+	render_draw_t *draw = &frame->draws[0];
+	VkDrawIndexedIndirectCommand *commands = render_draw_commands(frame, slot, 0);
+	uint32_t runs = 0;
+	for (uint32_t i = 0; i < visible->count; i++) {
+		uint32_t instance = visible->visible[i];
+		if (runs == 0) {
+			//Without a first instance, the single run starts at the first instance
+			uint32_t first = info->device_features.drawIndirectFirstInstance ? instance : 0;
+			commands[runs++] = { draw->index_count, instance + 1 - first, 0, 0, first };
+			continue;
+		}
+		VkDrawIndexedIndirectCommand *last = &commands[runs - 1];
+		if (instance == last->firstInstance + last->instanceCount || runs == draw->max_commands)
+			last->instanceCount = instance + 1 - last->firstInstance;
+		else
+			commands[runs++] = { draw->index_count, 1, 0, 0, instance };
+	}
+	render_set_draw_count(info, frame, slot, 0, runs);
+	return runs;
+}
+
+struct model_bounds_t {
+	const vertex_t *vertices;
+	std::mutex lock;
+	float radius;
+};
+
+static void model_bounds_range(void *data, uint32_t first, uint32_t last) {
+	model_bounds_t *bounds = (model_bounds_t*)data;
+	float radius = 0.0f;
+	for (uint32_t i = first; i < last; i++) {
+		v3_t p = bounds->vertices[i].pos;
+		radius = std::max(radius, sqrtf(p.x * p.x + p.y * p.y + p.z * p.z));
+	}
+	std::lock_guard<std::mutex> guard(bounds->lock);
+	bounds->radius = std::max(bounds->radius, radius);
+}
+
+/*
+ * Time to record the main pass commands of draw_count copies of the draw,
+ * on the calling thread then from 1 to N workers. Nothing is submitted,
+ * speedups are against the calling thread.
+ */
+static void record_bench(vulkan_info_t *info, const render_draw_t *model_draw, uint32_t draw_count,
+												 uint32_t iterations) {
+	std::vector<render_draw_t> draws(draw_count, *model_draw);
+	//One command each: the cost measured is the recording of the draws
+	for (render_draw_t &draw : draws)
+		draw.max_commands = 1;
+	vulkan_frame_info_t bench = { };
+	bench.draws = draws.data();
+	bench.draw_count = draw_count;
+	bench.recording = RENDER_RECORDING_PER_FRAME;
+	render_draw_lists_create(info, &bench);
+
+	uint32_t max_workers = std::min(std::thread::hardware_concurrency(), (uint32_t)RENDER_MAX_WORKERS);
+	printf("%u draws, %u iterations\n", draw_count, iterations);
+	printf("%8s %10s %8s\n", "workers", "ms", "speedup");
+	double base = 0.0;
+	//0 records on the calling thread
+	for (uint32_t count = 0; count <= max_workers; count++) {
+		render_workers_t workers;
+		if (count > 0) {
+			render_workers_create(info, &workers, count);
+			bench.workers = &workers;
+		}
+
+		//Warm up the pools and the workers before timing
+		render_create_cmd(info, &bench, 0, 0);
+		auto start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < iterations; i++)
+			render_create_cmd(info, &bench, 0, 0);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		double ms = elapsed.count() / iterations;
+		if (count == 0)
+			base = ms;
+		printf("%8u %10.3f %8.2f\n", count, ms, base / ms);
+
+		if (count > 0)
+			render_workers_destroy(info, &workers);
+		bench.workers = NULL;
+	}
+	render_draw_lists_destroy(info, &bench);
+}
+
+/*
+ * This main is used as a draft, don't worry
+ *   usage: viewer [-n instances] [-s] [-r draws]
+ * -s is the stress mode: no frame limit, visible instances drawn per second reported.
+ * -r is the recording bench: the commands of that many draws are recorded
+ * from 1 to N workers, the viewer exits once done.
+ */
 int main(int argc, char** argv) {
+	uint32_t instance_count = 1;
+	bool stress = false;
+	uint32_t bench_draws = 0;
+	for (int32_t i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			instance_count = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "-s") == 0)
+			stress = true;
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			bench_draws = std::max(RENDER_PARALLEL_MIN_DRAWS, atoi(argv[++i]));
+		else {
+			fprintf(stderr, "usage: %s [-n instances] [-s] [-r draws]\n", argv[0]);
+			return 1;
+		}
+	}
 
 //=========== VULKAN INITIALIZATION
 
 	vulkan_info_t vulkan_info = { 0 };
 	vulkan_info.width = 500;
 	vulkan_info.height = 500;
+	vulkan_info.frames_in_flight = FRAMES_IN_FLIGHT;
 	try {
 	vulkan_initialize(&vulkan_info);
 	} catch (VkException e) {
@@ -39,18 +205,32 @@ int main(int argc, char** argv) {
 	}
 
 //=========== ASSETS LOADING
-	
+
+	//The main thread is worker 0, it runs jobs while waiting on them
+	job_system_t jobs;
+	job_system_create(&jobs, std::thread::hardware_concurrency());
+
 	model_t model = { 0 };
 	bool success = load_model(MESH_PATH, &model);
 	assert(success);
 
+	model_bounds_t bounds;
+	bounds.vertices = model.vertices;
+	bounds.radius = 0.0f;
+	job_parallel_for(&jobs, model.count, 0, model_bounds_range, &bounds);
+
+#if !TEXTURE_STREAMING
 	texture_t texture = { 0 };
-	stbi_uc *pixels = stbi_load(MESH_DIFFUSE, (int32_t*)&texture.width, (int32_t*)&texture.height,
-															(int32_t*)&texture.channels, STBI_rgb_alpha);
-	assert(pixels);
+	success = image_import_info(MESH_DIFFUSE, &texture.width, &texture.height);
+	assert(success);
+	texture.channels = 4;
 	printf("[INFO] Loading a texture %dx%d\n", texture.width, texture.height);
+#endif
 
-	glm::vec3 camera = glm::vec3(2, 0.4f, 2);
+	//The camera backs away as the grid grows
+	uint32_t grid_side = (uint32_t)ceilf(sqrtf((float)instance_count));
+	float instance_spacing = 2.0f * bounds.radius * INSTANCE_SPACING;
+	glm::vec3 camera = glm::vec3(2, 0.4f, 2) * (1.0f + (grid_side - 1) * INSTANCE_SPACING);
 	glm::vec3 origin = glm::vec3(0, 0, 0);
 	glm::vec3 up = glm::vec3(0, 1, 0);
 
@@ -64,39 +244,117 @@ int main(int argc, char** argv) {
 
 	scene.model = glm::mat4(1.0f);
 	scene.view = glm::lookAt(camera, origin, up);
-	scene.projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 1000.0f);
+	scene.projection = glm::perspective(glm::radians(FOV_Y), 1.0f, 0.1f, 1000.0f);
 
 //============ INIT RENDERING
-	vulkan_frame_info_t frame_info = { 0 };
+	vulkan_frame_info_t frame_info = { };
+	render_workers_t workers;
+	render_draw_t draw = { };
+	defrag_resource_t vertex_relocation;
+	defrag_resource_t index_relocation;
+	defrag_resource_t instance_relocation;
+	cull_bounds_t instance_bounds;
+	cull_result_t visible;
+#if TEXTURE_STREAMING
+	texture_streamer_t streamer;
+	streamed_texture_t *albedo = NULL;
+#endif
 	try {
-		VkCommandBuffer command = command_begin_disposable(&vulkan_info);
-		vulkan_create_texture(&vulkan_info, &texture);
-		vulkan_update_texture(&vulkan_info, &texture, pixels);
+		//Every load-time copy goes in one submission
+		upload_batch_t uploads;
+		upload_batch_create(&vulkan_info, &uploads);
+#if TEXTURE_STREAMING
+		streamer_create(&vulkan_info, &streamer, STREAMING_BUDGET);
+		albedo = streamer_add(&vulkan_info, &streamer, MESH_DIFFUSE, TEXTURE_ROLE_COLOR);
+#else
+		//Decoded straight into the mapped staging image
+		image_sink_t sink;
+		vulkan_create_texture(&vulkan_info, &texture, TEXTURE_ROLE_COLOR);
+		vulkan_map_texture(&vulkan_info, &texture, &sink);
+		if (!image_import(MESH_DIFFUSE, &sink))
+			throw VkException(VK_INCOMPLETE);
+		vulkan_commit_texture(&vulkan_info, &uploads, &texture);
+#endif
 
 		const char *shaders_paths[SHADER_COUNT] = { VERT_SHADER, FRAG_SHADER };
 		VkShaderStageFlagBits shaders_flags[SHADER_COUNT] = { VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT };
 		vulkan_load_shaders(&vulkan_info, SHADER_COUNT, shaders_paths, shaders_flags);
 		printf("[INFO] %d shaders loaded.\n", SHADER_COUNT);
 
-		vulkan_create_vertex_buffer(&vulkan_info, model.count * sizeof(vertex_t), &vulkan_info.vertex_buffer);
-		vulkan_update_vertex_buffer(&vulkan_info, &vulkan_info.vertex_buffer, model.vertices, model.count);
+		vulkan_create_vertex_buffer(&vulkan_info, model.count * sizeof(vertex_t), BUFFER_MODE_STATIC,
+																&vulkan_info.vertex_buffer);
+		vulkan_update_vertex_buffer(&vulkan_info, &uploads, &vulkan_info.vertex_buffer,
+																model.vertices, model.count);
+		vulkan_create_index_buffer(&vulkan_info, model.index_count, &vulkan_info.index_buffer);
+		vulkan_update_index_buffer(&vulkan_info, &uploads, &vulkan_info.index_buffer,
+															 model.indices, model.index_count);
+		free_model(&model);
+
+		std::vector<instance_t> instances(instance_count);
+		layout_instances(instances.data(), instance_count, grid_side, instance_spacing);
+		vulkan_create_instance_buffer(&vulkan_info, instance_count, &vulkan_info.instance_buffer);
+		vulkan_update_instance_buffer(&vulkan_info, &uploads, &vulkan_info.instance_buffer,
+																	instances.data(), instance_count);
+		printf("[INFO] %u instances of %u vertices\n", instance_count, model.count);
+
+		//Rotated in place by the scene model matrix: the spheres stay valid
+		cull_bounds_create(&instance_bounds, instance_count, false);
+		for (uint32_t i = 0; i < instance_count; i++)
+			cull_bounds_set_sphere(&instance_bounds, i, glm::vec3(instances[i].transform[3]), bounds.radius);
+		cull_result_create(&visible, instance_count);
 
 		vulkan_create_rendering_pipeline(&vulkan_info);
 		render_init_fences(&vulkan_info);
+		//The main thread only waits while they record
+		render_workers_create(&vulkan_info, &workers, std::thread::hardware_concurrency());
 
 		vulkan_update_uniform_buffer(&vulkan_info, &scene);
 
+		draw.vertex_buffer = vulkan_info.vertex_buffer;
+		draw.index_count = vulkan_info.index_count;
+		draw.index_buffer = vulkan_info.index_buffer;
+		draw.max_commands = 1;
+		if (vulkan_info.device_features.drawIndirectFirstInstance)
+			draw.max_commands = std::min(instance_count, (uint32_t)MAX_VISIBLE_RUNS);
+		if (vulkan_info.device_features.multiDrawIndirect)
+			draw.max_commands = std::min(draw.max_commands,
+																	 vulkan_info.device_properties.limits.maxDrawIndirectCount);
+		draw.instance_count = vulkan_info.instance_count;
+		draw.instance_buffer = vulkan_info.instance_buffer;
+		defrag_register_buffer(&vulkan_info, &vertex_relocation, &vulkan_info.vertex_buffer,
+													 vertex_buffer_relocated, &draw);
+		defrag_register_buffer(&vulkan_info, &index_relocation, &vulkan_info.index_buffer,
+													 index_buffer_relocated, &draw);
+		defrag_register_buffer(&vulkan_info, &instance_relocation, &vulkan_info.instance_buffer,
+													 instance_buffer_relocated, &draw);
+#if TEXTURE_STREAMING
+		draw.texture_index = albedo->texture.index;
+#else
+		draw.texture_index = texture.index;
+#endif
+
 		frame_info.clear_color = { 0.0, 0.0, 0.0 };
-		frame_info.vertex_count = vulkan_info.vertex_count;
-		frame_info.vertex_buffer = vulkan_info.vertex_buffer;
+		frame_info.draws = &draw;
+		frame_info.draw_count = 1;
 		frame_info.command = vulkan_info.cmd_buffer;
+		frame_info.workers = &workers;
+		//One static model: commands are only re-recorded on invalidation
+		frame_info.recording = RENDER_RECORDING_PREBAKED;
+		//Commands read their draws from these, rewriting them needs no re-recording
+		render_draw_lists_create(&vulkan_info, &frame_info);
 
 		for (uint32_t i = 0; i < vulkan_info.swapchain_images_count; i++) {
-			render_create_cmd(&vulkan_info, &frame_info, i);
+			for (uint32_t slot = 0; slot < vulkan_info.frames_in_flight; slot++)
+				render_create_cmd(&vulkan_info, &frame_info, slot, i);
 			render_create_transition_commands(&vulkan_info, i);
 		}
 
-		command_submit_disposable(&vulkan_info, command);
+		upload_batch_submit(&vulkan_info, &uploads);
+		upload_batch_wait(&vulkan_info, &uploads);
+		upload_batch_destroy(&vulkan_info, &uploads);
+
+		if (bench_draws > 0)
+			record_bench(&vulkan_info, &draw, bench_draws, 100);
 
 	} catch (VkException e) {
 		printf("Exception: %s\n", vktostring(e.what()));
@@ -108,9 +366,13 @@ int main(int argc, char** argv) {
 	float delta_time = 1.0f / 1000.0;
 	auto start_time = std::chrono::steady_clock::now();
 	uint64_t frame_count = 0;
+	double cull_ms = 0.0;
+	uint64_t visible_count = 0;
+	signal(SIGUSR1, request_memory_report);
 	printf("FPS:\n");
 
-	for (uint32_t i = 0; ; i++) {
+	//The recording bench already ran, straight to the cleanup
+	for (uint32_t i = 0; bench_draws == 0; i++) {
 
 		render_get_frame(&vulkan_info);
 
@@ -119,13 +381,48 @@ int main(int argc, char** argv) {
 		scene.model = glm::rotate(scene.model, angle * delta_time * DEG2RAD, glm::vec3(0,1,0));
 		vulkan_update_uniform_buffer(&vulkan_info, &scene);
 
+		//Culled against the scene just updated
+		//The slot's draw list was retired with its fence, the commands read it as they are
+		auto cull_start = std::chrono::steady_clock::now();
+		cull_frustum_t frustum;
+		cull_frustum_from_scene(&scene, &frustum);
+		cull_frustum(&jobs, &frustum, &instance_bounds, &visible);
+		visible_count += visible.count;
+		write_visible_runs(&vulkan_info, &frame_info, vulkan_info.frame_index, &visible);
+		cull_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cull_start).count();
+
+		if (memory_report_requested) {
+			memory_report_requested = 0;
+			memory_print_stats(&vulkan_info);
+			defrag_print_fragmentation(&vulkan_info);
+			sampler_cache_print_stats(&vulkan_info);
+		}
+
+		//Relocated vertex buffers are baked in the recorded commands
+		bool stale_commands = defrag_step(&vulkan_info, DEFRAG_BUDGET_US);
+
+#if TEXTURE_STREAMING
+		//Projected diameter of the model bounding sphere, in pixels
+		float distance = glm::length(camera - origin);
+		float coverage = bounds.radius / (distance * tanf(glm::radians(FOV_Y) * 0.5f));
+		streamer_set_usage(albedo, coverage * vulkan_info.height);
+
+		//Slot rewrites reach each frame's sets when it starts, render_get_frame re-records as needed
+		streamer_update(&vulkan_info, &streamer);
+#endif
+
+		if (stale_commands)
+			render_invalidate(&frame_info);
+		render_record_frame(&vulkan_info, &frame_info);
+
 		render_submit(&vulkan_info, &frame_info);
 
 		clock_t frame_end = clock();
 		clock_t early_time = CLOCKS_PER_FRAME - (frame_end - frame_start);
 
 #if LIMIT_FRAMERATE
-		usleep(early_time);
+		if (!stress)
+			usleep(early_time);
 #else
 		(void)early_time;
 #endif
@@ -136,8 +433,16 @@ int main(int argc, char** argv) {
 		auto diff = cur_time - start_time;
 
 		if (std::chrono::duration_cast<std::chrono::milliseconds>(diff).count() > 1000.0f) {
-			printf("\b\rFPS: %zu     \n", frame_count);
+			double seconds = std::chrono::duration<double>(diff).count();
+			if (stress)
+				printf("\b\rFPS: %zu, %.2f M visible instances/s, %u of %u visible, culled in %.3f ms     \n",
+							 frame_count, visible_count / seconds * 1e-6, visible.count, instance_count,
+							 cull_ms / frame_count);
+			else
+				printf("\b\rFPS: %zu     \n", frame_count);
 			frame_count = 0;
+			cull_ms = 0.0;
+			visible_count = 0;
 			start_time = cur_time;
 		}
 	}
@@ -145,10 +450,21 @@ int main(int argc, char** argv) {
 	printf("\n\n\n");
 	vkDeviceWaitIdle(vulkan_info.device);
 	render_destroy(&vulkan_info, &frame_info);
+	render_workers_destroy(&vulkan_info, &workers);
+	render_draw_lists_destroy(&vulkan_info, &frame_info);
+	cull_result_destroy(&visible);
+	cull_bounds_destroy(&instance_bounds);
 
 	vulkan_unload_shaders(&vulkan_info, SHADER_COUNT);
+	defrag_unregister(&vulkan_info, &vertex_relocation);
+	defrag_unregister(&vulkan_info, &index_relocation);
+	defrag_unregister(&vulkan_info, &instance_relocation);
+#if TEXTURE_STREAMING
+	streamer_destroy(&vulkan_info, &streamer);
+#else
 	vulkan_unload_texture(&vulkan_info, &texture);
+#endif
 	vulkan_cleanup(&vulkan_info);
-	stbi_image_free(pixels);
+	job_system_destroy(&jobs);
 	return 0;
 }
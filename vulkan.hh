@@ -29,15 +29,50 @@
 #include <glm/mat4x4.hpp>
 #include <glm/vec4.hpp>
 
+#include "deferred.hh"
+#include "image_import.hh"
+#include "memory_allocator.hh"
+#include "memory_defrag.hh"
+#include "render_graph.hh"
+#include "sampler_cache.hh"
 #include "stb_image.h"
+#include "timeline.hh"
 #include "types.hh"
+#include "uniform_ring.hh"
+#include "upload_batch.hh"
 #include "window.hh"
 
 #define CHECK_VK(res) 																			\
 	if (res != VK_SUCCESS)   																	\
 		return res;
 
-#define NUM_DESCRIPTORS (1)
+#define NUM_DESCRIPTORS (2)
+//Dynamic uniform buffers cannot live in an update-after-bind layout
+#define DESCRIPTOR_SET_UNIFORMS (0)
+#define DESCRIPTOR_SET_TEXTURES (1)
+//Must match the sampler array size declared in the fragment shader
+#define MAX_TEXTURES (64)
+//Used when vulkan_info_t.frames_in_flight is left at 0: more overlaps CPU and GPU, less cuts latency
+#define DEFAULT_FRAMES_IN_FLIGHT (2)
+
+/*
+ * Each frame in flight binds its own sets: a rewritten slot reaches a frame's
+ * sets when the frame starts, once its previous submission retired, so no
+ * pending command buffer sees its descriptors change.
+ */
+struct texture_table_t {
+	VkDescriptorImageInfo slots[MAX_TEXTURES];
+	uint32_t count;
+	//A table per frame, or without dynamic indexing, a set per slot and frame holding that texture alone
+	VkDescriptorSet *sets;
+	//Per frame, a bit per slot rewritten since its sets were last written
+	uint64_t *dirty;
+	//Without partially bound arrays, what the slots no texture holds sample: a white texel
+	VkImage placeholder_image;
+	gpu_allocation_t placeholder_allocation;
+	VkImageView placeholder_view;
+	VkSampler placeholder_sampler;
+};
 
 struct vulkan_info_t {
 	uint32_t width;
@@ -47,6 +82,25 @@ struct vulkan_info_t {
 	VkPhysicalDevice physical_device;
 	VkPhysicalDeviceMemoryProperties memory_properties;
 	VkPhysicalDeviceProperties device_properties;
+	VkPhysicalDeviceFeatures device_features;
+	bool has_properties2;
+	//The shader indexes the texture table, otherwise each draw binds its texture's set
+	bool dynamic_indexing;
+	bool descriptor_indexing;
+	bool memory_budget;
+	//Timelines use timeline semaphores rather than fences
+	bool timeline_semaphore;
+	//Draw lists carry their draw count in a GPU buffer
+	bool draw_indirect_count;
+#ifdef VK_KHR_draw_indirect_count
+	PFN_vkCmdDrawIndexedIndirectCountKHR cmd_draw_indexed_indirect_count;
+#endif
+	//Resources the driver prefers alone get their own VkDeviceMemory
+	bool dedicated_allocation;
+#if defined(VK_KHR_dedicated_allocation) && defined(VK_KHR_get_memory_requirements2)
+	PFN_vkGetBufferMemoryRequirements2KHR get_buffer_memory_requirements2;
+	PFN_vkGetImageMemoryRequirements2KHR get_image_memory_requirements2;
+#endif
 	VkDevice device;
 
 	window_t window;
@@ -56,25 +110,32 @@ struct vulkan_info_t {
 	VkQueue present_queue;
 	uint32_t graphic_queue_family_index;
 	uint32_t present_queue_family_index;
+	//Transfer only family when the device has one, the graphic queue otherwise
+	VkQueue transfer_queue;
+	uint32_t transfer_queue_family_index;
+	//Every submission signals the timeline of the queue it goes to
+	timeline_t graphic_timeline;
+	timeline_t transfer_timeline;
 
 	VkCommandPool cmd_pool;
+	//Null without a dedicated transfer family
+	VkCommandPool transfer_cmd_pool;
 	VkCommandBuffer cmd_buffer;
 
 	VkFormat image_format;
 	VkColorSpaceKHR color_space;
+	VkFormat texture_formats[TEXTURE_ROLE_COUNT];
 
 	VkSwapchainKHR swapchain;
 	VkImage *swapchain_images;
-	VkSemaphore *semaphore_acquired;
-	VkSemaphore *semaphore_drawing;
-	VkSemaphore *semaphore_ownership;
-	VkFence *fences;
 	uint32_t swapchain_images_count;
 
-	image_buffer_t depth_buffer;
-	data_buffer_t uniform_buffer;
+	uniform_ring_t uniform_ring;
 	swapchain_buffer_t *swapchain_buffers;
 	uint32_t current_buffer;
+	//Ring of frames recorded ahead of the GPU, sized apart from the swapchain
+	render_frame_t *frames;
+	uint32_t frames_in_flight;
 	uint32_t frame_index;
 
 	VkDescriptorSetLayout *descriptor_layouts;
@@ -82,34 +143,57 @@ struct vulkan_info_t {
 	VkDescriptorPool descriptor_pool;
 	
 	VkPipelineLayout pipeline_layout;
+	//Passes, attachments and their synchronization. The pipeline targets the main pass
+	render_graph_t graph;
+	uint32_t main_pass;
 	VkRenderPass render_pass;
 	VkPipelineShaderStageCreateInfo *shader_stages;
 	uint32_t shader_stages_count;
-	VkFramebuffer *framebuffers;
 	VkPipeline pipeline;
 	VkViewport viewport;
 
 	uint32_t vertex_count;
 	data_buffer_t vertex_buffer;
-	VkVertexInputBindingDescription vertex_binding;
+	uint32_t index_count;
+	data_buffer_t index_buffer;
+	uint32_t instance_count;
+	data_buffer_t instance_buffer;
+	VkVertexInputBindingDescription vertex_bindings[VERTEX_BINDING_COUNT];
 	VkVertexInputAttributeDescription *vertex_attribute;
+	uint32_t vertex_attribute_count;
 	VkRect2D scissor;
 	
-	VkImageView texture_view;
-	VkSampler texture_sampler;
+	texture_table_t texture_table;
+	sampler_cache_t sampler_cache;
+	memory_allocator_t allocator;
+	memory_defrag_t defrag;
+	deferred_queue_t deferred;
 };
 
 void vulkan_initialize(vulkan_info_t *info);
 void vulkan_create_rendering_pipeline(vulkan_info_t *info);
 
-void vulkan_create_texture(vulkan_info_t *info, texture_t *tex);
-void vulkan_update_texture(vulkan_info_t *info, texture_t *tex, stbi_uc* data);
+void vulkan_create_texture(vulkan_info_t *info, texture_t *tex, texture_role_e role);
+void vulkan_update_texture(vulkan_info_t *info, upload_batch_t *batch, texture_t *tex, stbi_uc* data);
+void vulkan_map_texture(vulkan_info_t *info, texture_t *tex, image_sink_t *sink);
+void vulkan_commit_texture(vulkan_info_t *info, upload_batch_t *batch, texture_t *tex);
+uint32_t vulkan_register_texture(vulkan_info_t *info, texture_t *tex);
+void vulkan_update_texture_slot(vulkan_info_t *info, texture_t *tex);
+bool vulkan_flush_texture_slots(vulkan_info_t *info, uint32_t frame);
+VkDescriptorSet vulkan_texture_set(vulkan_info_t *info, uint32_t frame, uint32_t slot);
 
 void vulkan_load_shaders(vulkan_info_t *info, uint32_t count,
 														 const char **paths, VkShaderStageFlagBits *flags);
 
-void vulkan_create_vertex_buffer(vulkan_info_t *i, uint32_t size, data_buffer_t *b);
-void vulkan_update_vertex_buffer(vulkan_info_t *i, data_buffer_t *b, vertex_t *vtx, uint32_t count);
+void vulkan_create_vertex_buffer(vulkan_info_t *i, uint32_t size, buffer_mode_e mode, data_buffer_t *b);
+void vulkan_update_vertex_buffer(vulkan_info_t *i, upload_batch_t *u, data_buffer_t *b,
+																 vertex_t *vtx, uint32_t count);
+void vulkan_create_index_buffer(vulkan_info_t *i, uint32_t count, data_buffer_t *b);
+void vulkan_update_index_buffer(vulkan_info_t *i, upload_batch_t *u, data_buffer_t *b,
+																const uint32_t *indices, uint32_t count);
+void vulkan_create_instance_buffer(vulkan_info_t *i, uint32_t count, data_buffer_t *b);
+void vulkan_update_instance_buffer(vulkan_info_t *i, upload_batch_t *u, data_buffer_t *b,
+																	 const instance_t *instances, uint32_t count);
 
 void vulkan_update_uniform_buffer(vulkan_info_t *info, scene_info_t *payload);
 
@@ -7,6 +7,7 @@
 #include <X11/Xutil.h>
 
 #include <cassert>
+#include <cstddef>
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
@@ -30,6 +31,8 @@
 #include "vulkan.hh"
 #include "window.hh"
 #include "helpers.hh"
+#include "render_graph.hh"
+#include "vulkan_render.hh"
 #include "vulkan_wrappers.hh"
 #include "vulkan_exception.hh"
 
@@ -57,6 +60,13 @@ static void vulkan_startup(vulkan_info_t *info) {
 	extension_names.push_back(VK_KHR_XCB_SURFACE_EXTENSION_NAME);
 	extension_names.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
 
+#ifdef VK_KHR_get_physical_device_properties2
+	if (has_instance_extension(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)) {
+		extension_names.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+		info->has_properties2 = true;
+	}
+#endif
+
 #ifdef DEBUG
 	printf("[INFO] Validation layers enabled.\n");
 	validation_layers.push_back("VK_LAYER_LUNARG_standard_validation");
@@ -103,26 +113,102 @@ static void vulkan_initialize_devices(vulkan_info_t *info) {
 
 	vkGetPhysicalDeviceMemoryProperties(info->physical_device, &info->memory_properties);
 	vkGetPhysicalDeviceProperties(info->physical_device, &info->device_properties);
+	vkGetPhysicalDeviceFeatures(info->physical_device, &info->device_features);
 }
 
-static void vulkan_create_command_pool(vulkan_info_t *info, uint32_t graphic_queue) {
+#ifdef VK_EXT_descriptor_indexing
+//The texture table only needs partially bound, update-after-bind arrays
+static bool vulkan_query_descriptor_indexing(vulkan_info_t *info) {
+	if (!info->has_properties2)
+		return false;
+	if (!has_device_extension(info, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+		return false;
+	//Required by descriptor indexing
+	if (!has_device_extension(info, VK_KHR_MAINTENANCE3_EXTENSION_NAME))
+		return false;
+
+	PFN_vkGetPhysicalDeviceFeatures2KHR get_features2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)
+		vkGetInstanceProcAddr(info->instance, "vkGetPhysicalDeviceFeatures2KHR");
+	if (get_features2 == NULL)
+		return false;
+
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing = { };
+	indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	indexing.pNext = NULL;
+
+	VkPhysicalDeviceFeatures2KHR features = { };
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+	features.pNext = &indexing;
+	get_features2(info->physical_device, &features);
+
+	return indexing.descriptorBindingPartiallyBound
+			&& indexing.descriptorBindingSampledImageUpdateAfterBind
+			&& indexing.descriptorBindingUpdateUnusedWhilePending;
+}
+#endif
+
+#ifdef VK_KHR_timeline_semaphore
+static bool vulkan_query_timeline_semaphore(vulkan_info_t *info) {
+	if (!info->has_properties2)
+		return false;
+	if (!has_device_extension(info, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME))
+		return false;
+
+	PFN_vkGetPhysicalDeviceFeatures2KHR get_features2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)
+		vkGetInstanceProcAddr(info->instance, "vkGetPhysicalDeviceFeatures2KHR");
+	if (get_features2 == NULL)
+		return false;
+
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline = { };
+	timeline.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+	timeline.pNext = NULL;
+
+	VkPhysicalDeviceFeatures2KHR features = { };
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+	features.pNext = &timeline;
+	get_features2(info->physical_device, &features);
+
+	return timeline.timelineSemaphore;
+}
+#endif
+
+static void vulkan_create_command_pool(vulkan_info_t *info, uint32_t family, VkCommandPool *pool) {
 	VkResult res;
 
 	VkCommandPoolCreateInfo cmd_pool_info = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
 		.pNext = NULL,
 		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-		.queueFamilyIndex = graphic_queue,
+		.queueFamilyIndex = family,
 	};
 
-	res = vkCreateCommandPool(info->device, &cmd_pool_info, NULL, &info->cmd_pool);
+	res = vkCreateCommandPool(info->device, &cmd_pool_info, NULL, pool);
 	assert(res == VK_SUCCESS);
 }
 
+/*
+ * A family with TRANSFER but without GRAPHICS is usually a DMA engine copying
+ * alongside rendering. Without COMPUTE either is the best match.
+ */
+static uint32_t find_transfer_family(uint32_t count, VkQueueFamilyProperties *props) {
+	uint32_t found = UINT32_MAX;
+	for (uint32_t i = 0; i < count; i++) {
+		VkQueueFlags flags = props[i].queueFlags;
+		if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT) || props[i].queueCount == 0)
+			continue;
+		if (!(flags & VK_QUEUE_COMPUTE_BIT))
+			return i;
+		if (found == UINT32_MAX)
+			found = i;
+	}
+	return found;
+}
+
 struct queue_creation_info_t {
 	uint32_t count;
 	uint32_t present_family_index;
 	uint32_t graphic_family_index;
+	uint32_t transfer_family_index;
 
 	VkQueueFamilyProperties *family_props;
 };
@@ -145,8 +231,86 @@ static void vulkan_create_device(vulkan_info_t *info, queue_creation_info_t *que
 
 	uint32_t queue_id = get_queue_family_index(VK_QUEUE_GRAPHICS_BIT, queue_info->count, queue_info->family_props);
 
+	VkPhysicalDeviceFeatures enabled_features = { };
+	//Optional, draws then bind a descriptor set per texture
+	enabled_features.shaderSampledImageArrayDynamicIndexing =
+		info->device_features.shaderSampledImageArrayDynamicIndexing;
+	info->dynamic_indexing = enabled_features.shaderSampledImageArrayDynamicIndexing;
+	if (!info->dynamic_indexing)
+		LOG("No dynamic sampler indexing: textures bound per draw.");
+	//Optional, the sampler cache drops anisotropy when missing
+	enabled_features.samplerAnisotropy = info->device_features.samplerAnisotropy;
+	//Optional, draw lists are then issued a command at a time
+	enabled_features.multiDrawIndirect = info->device_features.multiDrawIndirect;
+	//Optional, culled instances are then drawn as a single range from the first one
+	enabled_features.drawIndirectFirstInstance = info->device_features.drawIndirectFirstInstance;
+
+	const void *device_next = NULL;
+
+#ifdef VK_EXT_descriptor_indexing
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = { };
+	indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	indexing_features.pNext = NULL;
+
+	if (info->dynamic_indexing && vulkan_query_descriptor_indexing(info)) {
+		indexing_features.descriptorBindingPartiallyBound = VK_TRUE;
+		indexing_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+		indexing_features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+		device_extension_names.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+		device_extension_names.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+		device_next = &indexing_features;
+		info->descriptor_indexing = true;
+		LOG("Descriptor indexing enabled.");
+	}
+#endif
+
+#ifdef VK_KHR_timeline_semaphore
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = { };
+	timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+	timeline_features.pNext = NULL;
+
+	if (vulkan_query_timeline_semaphore(info)) {
+		timeline_features.timelineSemaphore = VK_TRUE;
+		timeline_features.pNext = (void*)device_next;
+		device_extension_names.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+		device_next = &timeline_features;
+		info->timeline_semaphore = true;
+		LOG("Timeline semaphores enabled.");
+	}
+#endif
+
+#ifdef VK_KHR_draw_indirect_count
+	//Needs multi draw: the count only trims a multi draw
+	if (enabled_features.multiDrawIndirect
+			&& has_device_extension(info, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+		device_extension_names.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		info->draw_indirect_count = true;
+		LOG("Draw indirect count enabled.");
+	}
+#endif
+
+#ifdef VK_EXT_memory_budget
+	//Queried through vkGetPhysicalDeviceMemoryProperties2KHR when printing the stats
+	if (info->has_properties2 && has_device_extension(info, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+		device_extension_names.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		info->memory_budget = true;
+		LOG("Memory budget enabled.");
+	}
+#endif
+
+	#if defined(VK_KHR_dedicated_allocation) && defined(VK_KHR_get_memory_requirements2)
+	if (has_device_extension(info, VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME)
+			&& has_device_extension(info, VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME)) {
+		device_extension_names.push_back(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME);
+		device_extension_names.push_back(VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME);
+		info->dedicated_allocation = true;
+		LOG("Dedicated allocations enabled.");
+	}
+#endif
+
 	float queue_priorities[1] = { 0.0f };
-	VkDeviceQueueCreateInfo queue_creation_info {
+	VkDeviceQueueCreateInfo queue_creation_info[2];
+	queue_creation_info[0] = {
 		.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
 		.pNext = NULL,
 		.flags = 0,
@@ -154,24 +318,55 @@ static void vulkan_create_device(vulkan_info_t *info, queue_creation_info_t *que
 		.queueCount = 1,
 		.pQueuePriorities = queue_priorities,
 	};
+	uint32_t queue_creation_count = 1;
+
+	queue_info->transfer_family_index = find_transfer_family(queue_info->count, queue_info->family_props);
+	if (queue_info->transfer_family_index != UINT32_MAX) {
+		queue_creation_info[1] = queue_creation_info[0];
+		queue_creation_info[1].queueFamilyIndex = queue_info->transfer_family_index;
+		queue_creation_count++;
+		LOG("Dedicated transfer queue enabled.");
+	}
 
 	VkDeviceCreateInfo create_info = {
 		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-		.pNext = NULL,
+		.pNext = device_next,
 		.flags = 0,
-		.queueCreateInfoCount = 1,
-		.pQueueCreateInfos = &queue_creation_info,
+		.queueCreateInfoCount = queue_creation_count,
+		.pQueueCreateInfos = queue_creation_info,
 		.enabledLayerCount = 0,
 		.ppEnabledLayerNames = NULL,
 		.enabledExtensionCount = static_cast<uint32_t>(device_extension_names.size()),
 		.ppEnabledExtensionNames = device_extension_names.data(),
-		.pEnabledFeatures = NULL,
+		.pEnabledFeatures = &enabled_features,
 	};
 
 	res = vkCreateDevice(info->physical_device, &create_info, NULL, &info->device);
 	assert(res == VK_SUCCESS);
 
-	vulkan_create_command_pool(info, queue_id);
+#ifdef VK_KHR_draw_indirect_count
+	if (info->draw_indirect_count) {
+		info->cmd_draw_indexed_indirect_count = (PFN_vkCmdDrawIndexedIndirectCountKHR)
+			vkGetDeviceProcAddr(info->device, "vkCmdDrawIndexedIndirectCountKHR");
+		info->draw_indirect_count = info->cmd_draw_indexed_indirect_count != NULL;
+	}
+#endif
+
+#if defined(VK_KHR_dedicated_allocation) && defined(VK_KHR_get_memory_requirements2)
+	if (info->dedicated_allocation) {
+		info->get_buffer_memory_requirements2 = (PFN_vkGetBufferMemoryRequirements2KHR)
+			vkGetDeviceProcAddr(info->device, "vkGetBufferMemoryRequirements2KHR");
+		info->get_image_memory_requirements2 = (PFN_vkGetImageMemoryRequirements2KHR)
+			vkGetDeviceProcAddr(info->device, "vkGetImageMemoryRequirements2KHR");
+		info->dedicated_allocation = info->get_buffer_memory_requirements2 != NULL
+			&& info->get_image_memory_requirements2 != NULL;
+	}
+#endif
+
+	vulkan_create_command_pool(info, queue_id, &info->cmd_pool);
+	info->transfer_cmd_pool = VK_NULL_HANDLE;
+	if (queue_info->transfer_family_index != UINT32_MAX)
+		vulkan_create_command_pool(info, queue_info->transfer_family_index, &info->transfer_cmd_pool);
 }
 
 static void vulkan_create_queues(vulkan_info_t *info, queue_creation_info_t *queues) {
@@ -204,6 +399,14 @@ static void vulkan_create_queues(vulkan_info_t *info, queue_creation_info_t *que
 
 	info->graphic_queue_family_index = queues->graphic_family_index;
 	info->present_queue_family_index = queues->present_family_index;
+
+	if (queues->transfer_family_index != UINT32_MAX) {
+		vkGetDeviceQueue(info->device, queues->transfer_family_index, 0, &info->transfer_queue);
+		info->transfer_queue_family_index = queues->transfer_family_index;
+	} else {
+		info->transfer_queue = info->graphic_queue;
+		info->transfer_queue_family_index = info->graphic_queue_family_index;
+	}
 }
 
 static void vulkan_create_KHR_surface(vulkan_info_t *info) {
@@ -271,8 +474,19 @@ static void vulkan_create_swapchain(vulkan_info_t *info) {
 			present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
 	}
 
-	info->color_space = supported_formats[0].colorSpace;
-	info->image_format = supported_formats[0].format;
+	//Shaders output linear colors, an sRGB surface lets the hardware encode them
+	VkSurfaceFormatKHR surface_format = supported_formats[0];
+	for (uint32_t i = 0; i < nbr_formats; i++) {
+		VkFormat f = supported_formats[i].format;
+		if ((f == VK_FORMAT_B8G8R8A8_SRGB || f == VK_FORMAT_R8G8B8A8_SRGB)
+				&& supported_formats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+			surface_format = supported_formats[i];
+			break;
+		}
+	}
+
+	info->color_space = surface_format.colorSpace;
+	info->image_format = surface_format.format;
 
 	swapchain_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
 	swapchain_info.pNext = NULL;
@@ -314,6 +528,31 @@ static VkResult vulkan_create_command_buffer(vulkan_info_t *info)
 	return vkAllocateCommandBuffers(info->device, &cmd, &info->cmd_buffer);
 }
 
+static bool vulkan_is_srgb(VkFormat format) {
+	return format == VK_FORMAT_B8G8R8A8_SRGB || format == VK_FORMAT_R8G8B8A8_SRGB;
+}
+
+static void vulkan_select_texture_formats(vulkan_info_t *info) {
+	const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
+																			| VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	VkFormatProperties props;
+
+	info->texture_formats[TEXTURE_ROLE_DATA] = VK_FORMAT_R8G8B8A8_UNORM;
+	info->texture_formats[TEXTURE_ROLE_COLOR] = VK_FORMAT_R8G8B8A8_UNORM;
+
+	//Decoding to linear only pays off if the output is encoded back on write
+	if (!vulkan_is_srgb(info->image_format)) {
+		LOG("No sRGB swapchain, color textures are sampled as UNORM.");
+		return;
+	}
+
+	vkGetPhysicalDeviceFormatProperties(info->physical_device, VK_FORMAT_R8G8B8A8_SRGB, &props);
+	if ((props.optimalTilingFeatures & required) == required)
+		info->texture_formats[TEXTURE_ROLE_COLOR] = VK_FORMAT_R8G8B8A8_SRGB;
+	else
+		LOG("R8G8B8A8_SRGB cannot be filtered, color textures are sampled as UNORM.");
+}
+
 static void vulkan_initialize_swapchain_images(vulkan_info_t *info) {
 	VkResult res;
 	uint32_t image_count = 0;
@@ -324,14 +563,23 @@ static void vulkan_initialize_swapchain_images(vulkan_info_t *info) {
 	res = vkGetSwapchainImagesKHR(info->device, info->swapchain, &image_count, images.data());
 	assert(res == VK_SUCCESS);
 
-	info->swapchain_buffers = new swapchain_buffer_t[image_count];
+	info->swapchain_buffers = new swapchain_buffer_t[image_count]();
 	if (info->swapchain_buffers == NULL)
 		throw VkException(VK_ERROR_OUT_OF_HOST_MEMORY);
 
+	//Every image transitioned by a single barrier
+	upload_batch_t batch;
+	upload_batch_create(info, &batch);
+	barrier_batch_t barriers;
+	barrier_batch_begin(&barriers, upload_batch_command(info, &batch));
 	for (uint32_t i = 0; i < image_count ; i++) {
 		info->swapchain_buffers[i].image = images[i];
-		image_layout_transition(info, images[i], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		image_state_t state;
+		image_state_init(&state, images[i], VK_IMAGE_ASPECT_COLOR_BIT, 1, IMAGE_ACCESS_UNDEFINED);
+		barrier_image(&barriers, &state, IMAGE_ACCESS_COLOR_ATTACHMENT);
 	}
+	barrier_flush(&barriers);
+	upload_batch_destroy(info, &batch);
 
 	for (uint32_t i = 0; i < image_count ; i++)
 		image_view_create(info, info->swapchain_buffers[i].image, info->image_format, &info->swapchain_buffers[i].view);
@@ -340,130 +588,19 @@ static void vulkan_initialize_swapchain_images(vulkan_info_t *info) {
 	info->swapchain_images_count = image_count;
 }
 
-static void vulkan_create_depth_buffer(vulkan_info_t *info) {
-	VkResult res = VK_SUCCESS;
-
-	VkImageCreateInfo image_info = {};
-	const VkFormat depth_format = VK_FORMAT_D16_UNORM;
-
-	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-	image_info.pNext = NULL;
-	image_info.flags = 0;
-	image_info.imageType = VK_IMAGE_TYPE_2D;
-	image_info.format = depth_format;
-	image_info.extent.width = info->width;
-	image_info.extent.height = info->height;
-	image_info.extent.depth = 1;
-	image_info.mipLevels = 1;
-	image_info.arrayLayers = 1;
-	image_info.samples = VK_SAMPLE_COUNT_1_BIT;
-	image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
-	image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-	image_info.queueFamilyIndexCount = 0;
-	image_info.pQueueFamilyIndices = NULL;
-	image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-	VkMemoryAllocateInfo alloc_info = {};
-	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc_info.pNext = NULL;
-	alloc_info.allocationSize = 0;
-	alloc_info.memoryTypeIndex = 0;
-
-	VkImageViewCreateInfo view_info = {};
-	view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	view_info.pNext = NULL;
-	view_info.flags = 0;
-	view_info.image = VK_NULL_HANDLE;
-	view_info.format = depth_format;
-	view_info.components.r = VK_COMPONENT_SWIZZLE_R;
-	view_info.components.g = VK_COMPONENT_SWIZZLE_G;
-	view_info.components.b = VK_COMPONENT_SWIZZLE_B;
-	view_info.components.a = VK_COMPONENT_SWIZZLE_A;
-	view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-	view_info.subresourceRange.baseMipLevel = 0;
-	view_info.subresourceRange.levelCount = 1;
-	view_info.subresourceRange.baseArrayLayer = 0;
-	view_info.subresourceRange.layerCount = 1;
-	view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-
-	VkMemoryRequirements mem_reqs;
-	info->depth_buffer.format = depth_format;
-	res = vkCreateImage(info->device, &image_info, NULL, &info->depth_buffer.image);
-	assert(res == VK_SUCCESS);
-
-	vkGetImageMemoryRequirements(info->device, info->depth_buffer.image, &mem_reqs);
-
-	alloc_info.allocationSize = mem_reqs.size;
-	res = vkAllocateMemory(info->device, &alloc_info, NULL,
-												 &info->depth_buffer.memory);
-	if (res != VK_SUCCESS)
-		throw VkException(res);
-
-	res = vkBindImageMemory(info->device, info->depth_buffer.image,
-													info->depth_buffer.memory, 0);
-	assert(res == VK_SUCCESS);
-
-	view_info.image = info->depth_buffer.image;
-	res = vkCreateImageView(info->device, &view_info, NULL, &info->depth_buffer.view);
-	assert(res == VK_SUCCESS);
-}
-
+//Each frame in flight records its draws against its own slice of the ring
 static void vulkan_create_uniform_buffer(vulkan_info_t *info, uint32_t size) {
-	VkResult res = VK_SUCCESS;
-
-	VkBufferCreateInfo buf_info = {};
-	buf_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	buf_info.pNext = NULL;
-	buf_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-	buf_info.size = size;
-	buf_info.queueFamilyIndexCount = 0;
-	buf_info.pQueueFamilyIndices = NULL;
-	buf_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	buf_info.flags = 0;
-
-	res = vkCreateBuffer(info->device, &buf_info, NULL, &info->uniform_buffer.buffer);
-	assert(res == VK_SUCCESS);
-	
-	VkMemoryRequirements mem_reqs;
-	vkGetBufferMemoryRequirements(info->device, info->uniform_buffer.buffer, &mem_reqs);
-
-	VkMemoryAllocateInfo alloc_info = {};
-	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc_info.pNext = NULL;
-	alloc_info.memoryTypeIndex = 0;
-	
-	alloc_info.allocationSize = mem_reqs.size;
-	bool success = find_memory_type_index(info, mem_reqs.memoryTypeBits,
-																				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-																				 | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-																				&alloc_info.memoryTypeIndex);
-	if (!success)
-		throw VkException(VK_INCOMPLETE);
-
-	res = vkAllocateMemory(info->device, &alloc_info, NULL, &info->uniform_buffer.memory);
-	if (res != VK_SUCCESS)
-		throw VkException(res);
-
-	info->uniform_buffer.descriptor.buffer = info->uniform_buffer.buffer;
-	info->uniform_buffer.descriptor.offset = 0;
-  info->uniform_buffer.descriptor.range = size; 
-	res = vkBindBufferMemory(info->device, info->uniform_buffer.buffer,
-													 	info->uniform_buffer.memory, 0);
-	assert(res == VK_SUCCESS);
+	uniform_ring_create(info, &info->uniform_ring, info->frames_in_flight,
+											UNIFORM_FRAME_BUDGET, size);
 }
 
+//The scene block is the first push of the frame: it sits at the slice start the commands were recorded with
 void vulkan_update_uniform_buffer(vulkan_info_t *info, scene_info_t *payload) {
-	VkResult res = VK_SUCCESS;
-	vkWaitForFences(info->device, 1, &info->swapchain_buffers[info->current_buffer].fence, VK_TRUE, UINT64_MAX);
-
-	void *data = NULL;
-	res = vkMapMemory(info->device, info->uniform_buffer.memory, 0, sizeof(payload), 0,
-										(void**)&data);
-	if (res != VK_SUCCESS)
-		throw VkException(res);
-	memcpy(data, payload, info->uniform_buffer.descriptor.range);
-	vkUnmapMemory(info->device, info->uniform_buffer.memory);
+	timeline_wait(info, &info->graphic_timeline, info->frames[info->frame_index].retire);
+	uniform_ring_begin_frame(&info->uniform_ring, info->frame_index);
+	uint32_t offset = uniform_ring_push(&info->uniform_ring, payload, sizeof(*payload));
+	assert(offset == uniform_ring_frame_offset(&info->uniform_ring, info->frame_index));
+	(void)offset;
 }
 
 static void vulkan_create_pipeline_layout(vulkan_info_t *info) {
@@ -471,38 +608,69 @@ static void vulkan_create_pipeline_layout(vulkan_info_t *info) {
 
 	VkDescriptorSetLayoutBinding uniform_binding = {};
 	uniform_binding.binding = 0;
-	uniform_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uniform_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	uniform_binding.descriptorCount = 1;
 	uniform_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 	uniform_binding.pImmutableSamplers = NULL;
 
 	VkDescriptorSetLayoutBinding sampler_binding = {};
-	sampler_binding.binding = 1;
+	sampler_binding.binding = 0;
 	sampler_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	sampler_binding.descriptorCount = 1;
+	sampler_binding.descriptorCount = info->dynamic_indexing ? MAX_TEXTURES : 1;
 	sampler_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 	sampler_binding.pImmutableSamplers = NULL;
 
-	VkDescriptorSetLayoutBinding bindings[] = { uniform_binding, sampler_binding };
-
-	VkDescriptorSetLayoutCreateInfo descriptor_layout = {};
-	descriptor_layout.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	descriptor_layout.pNext = NULL;
-	descriptor_layout.bindingCount = 2;
-	descriptor_layout.pBindings = bindings;
+	VkDescriptorSetLayoutCreateInfo descriptor_layout[NUM_DESCRIPTORS] = {};
+	descriptor_layout[DESCRIPTOR_SET_UNIFORMS].sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	descriptor_layout[DESCRIPTOR_SET_UNIFORMS].pNext = NULL;
+	descriptor_layout[DESCRIPTOR_SET_UNIFORMS].flags = 0;
+	descriptor_layout[DESCRIPTOR_SET_UNIFORMS].bindingCount = 1;
+	descriptor_layout[DESCRIPTOR_SET_UNIFORMS].pBindings = &uniform_binding;
+
+	descriptor_layout[DESCRIPTOR_SET_TEXTURES].sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	descriptor_layout[DESCRIPTOR_SET_TEXTURES].pNext = NULL;
+	descriptor_layout[DESCRIPTOR_SET_TEXTURES].flags = 0;
+	descriptor_layout[DESCRIPTOR_SET_TEXTURES].bindingCount = 1;
+	descriptor_layout[DESCRIPTOR_SET_TEXTURES].pBindings = &sampler_binding;
+
+#ifdef VK_EXT_descriptor_indexing
+	//Unused slots may stay empty, and textures can be added after recording
+	VkDescriptorBindingFlagsEXT binding_flags =
+		VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT
+		| VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT
+		| VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flags_info = {};
+	flags_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+	flags_info.pNext = NULL;
+	flags_info.bindingCount = 1;
+	flags_info.pBindingFlags = &binding_flags;
+
+	if (info->descriptor_indexing) {
+		descriptor_layout[DESCRIPTOR_SET_TEXTURES].pNext = &flags_info;
+		descriptor_layout[DESCRIPTOR_SET_TEXTURES].flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+	}
+#endif
 
 	info->descriptor_layouts = new VkDescriptorSetLayout[NUM_DESCRIPTORS];
 	if (info->descriptor_layouts == NULL)
 		throw VkException(VK_ERROR_OUT_OF_HOST_MEMORY);
-	res = vkCreateDescriptorSetLayout(info->device, &descriptor_layout, NULL, info->descriptor_layouts);
-	assert(res == VK_SUCCESS);
+	for (uint32_t i = 0; i < NUM_DESCRIPTORS; i++) {
+		res = vkCreateDescriptorSetLayout(info->device, &descriptor_layout[i], NULL, &info->descriptor_layouts[i]);
+		assert(res == VK_SUCCESS);
+	}
 	
+	VkPushConstantRange push_range = {};
+	push_range.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	push_range.offset = 0;
+	push_range.size = sizeof(draw_constants_t);
+
 	VkPipelineLayoutCreateInfo pipeline_layout = {};
 	pipeline_layout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipeline_layout.pNext = NULL;
 	pipeline_layout.flags = 0;
-	pipeline_layout.pushConstantRangeCount = 0;
-	pipeline_layout.pPushConstantRanges = NULL;
+	pipeline_layout.pushConstantRangeCount = 1;
+	pipeline_layout.pPushConstantRanges = &push_range;
 	pipeline_layout.setLayoutCount = NUM_DESCRIPTORS;	
 	pipeline_layout.pSetLayouts = info->descriptor_layouts;
 
@@ -512,15 +680,21 @@ static void vulkan_create_pipeline_layout(vulkan_info_t *info) {
 
 static void vulkan_create_descriptor_pool(vulkan_info_t *info) {
 	VkDescriptorPoolSize type_count[2];
-	type_count[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	type_count[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	type_count[0].descriptorCount = 1;
 	type_count[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	type_count[1].descriptorCount = 1;
+	type_count[1].descriptorCount = MAX_TEXTURES * info->frames_in_flight;
 
 	VkDescriptorPoolCreateInfo pool_info = {};
 	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	pool_info.pNext = NULL;
-	pool_info.maxSets = 2;
+	pool_info.flags = 0;
+#ifdef VK_EXT_descriptor_indexing
+	if (info->descriptor_indexing)
+		pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+#endif
+	//The uniform set, then the texture sets of every frame
+	pool_info.maxSets = 1 + info->frames_in_flight * (info->dynamic_indexing ? 1 : MAX_TEXTURES);
 	pool_info.poolSizeCount = 2;
 	pool_info.pPoolSizes = type_count;
 
@@ -528,6 +702,45 @@ static void vulkan_create_descriptor_pool(vulkan_info_t *info) {
 	assert(res == VK_SUCCESS);
 }
 
+/*
+ * Owned by the table rather than borrowed from a registered texture: a slot
+ * is rewritten or its texture released while the empty slots still sample.
+ */
+static void vulkan_create_texture_placeholder(vulkan_info_t *info) {
+	texture_table_t *table = &info->texture_table;
+	VkDeviceSize size;
+	image_create_optimal(info, 1, 1, 1, &table->placeholder_image, &table->placeholder_allocation,
+											 &size, VK_FORMAT_R8G8B8A8_UNORM,
+											 VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+											 MEMORY_CATEGORY_TEXTURE);
+	image_view_create(info, table->placeholder_image, VK_FORMAT_R8G8B8A8_UNORM,
+										&table->placeholder_view);
+	image_sampler_create(info, &table->placeholder_sampler);
+
+	upload_batch_t batch;
+	upload_batch_create(info, &batch);
+	VkCommandBuffer command = upload_batch_command(info, &batch);
+
+	image_state_t state;
+	image_state_init(&state, table->placeholder_image, VK_IMAGE_ASPECT_COLOR_BIT, 1,
+									 IMAGE_ACCESS_UNDEFINED);
+	barrier_batch_t barriers;
+	barrier_batch_begin(&barriers, command);
+	barrier_image(&barriers, &state, IMAGE_ACCESS_TRANSFER_DST);
+	barrier_flush(&barriers);
+
+	VkClearColorValue white = { { 1.0f, 1.0f, 1.0f, 1.0f } };
+	vkCmdClearColorImage(command, table->placeholder_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+											 &white, 1, &state.range);
+
+	barrier_image(&barriers, &state, IMAGE_ACCESS_FRAGMENT_SAMPLED);
+	barrier_flush(&barriers);
+
+	upload_batch_submit(info, &batch);
+	upload_batch_wait(info, &batch);
+	upload_batch_destroy(info, &batch);
+}
+
 static VkResult vulkan_create_descriptors(vulkan_info_t *info) {
 	VkResult res = VK_SUCCESS;
 
@@ -535,100 +748,82 @@ static VkResult vulkan_create_descriptors(vulkan_info_t *info) {
 	alloc_info[0].sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	alloc_info[0].pNext = NULL;
 	alloc_info[0].descriptorPool = info->descriptor_pool;
-	alloc_info[0].descriptorSetCount = NUM_DESCRIPTORS;
-	alloc_info[0].pSetLayouts = info->descriptor_layouts;
-	
-	info->descriptor_sets = new VkDescriptorSet[NUM_DESCRIPTORS];
-	res = vkAllocateDescriptorSets(info->device, alloc_info, info->descriptor_sets);
+	alloc_info[0].descriptorSetCount = 1;
+	alloc_info[0].pSetLayouts = &info->descriptor_layouts[DESCRIPTOR_SET_UNIFORMS];
+
+	//Texture sets are per frame, see vulkan_texture_set
+	info->descriptor_sets = new VkDescriptorSet[NUM_DESCRIPTORS]();
+	res = vkAllocateDescriptorSets(info->device, alloc_info, &info->descriptor_sets[DESCRIPTOR_SET_UNIFORMS]);
 	CHECK_VK(res);
 
-	VkWriteDescriptorSet writes[2];
-
-	writes[0] = {};
-	writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	writes[0].pNext = NULL;
-	writes[0].dstSet = info->descriptor_sets[0];
-	writes[0].descriptorCount = 1;
-	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	writes[0].pBufferInfo = &info->uniform_buffer.descriptor;
-	writes[0].dstArrayElement = 0;
-	writes[0].dstBinding = 0;
-
-	VkDescriptorImageInfo image_info = { };
-	image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	image_info.imageView = info->texture_view;
-	image_info.sampler = info->texture_sampler;
-
-	writes[1] = {};
-	writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	writes[1].pNext = NULL;
-	writes[1].dstSet = info->descriptor_sets[0];
-	writes[1].descriptorCount = 1;
-	writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	writes[1].pImageInfo = &image_info;
-	writes[1].dstArrayElement = 0;
-	writes[1].dstBinding = 1;
-
-	vkUpdateDescriptorSets(info->device, 2, writes, 0, NULL);
+	VkWriteDescriptorSet write = {};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.pNext = NULL;
+	write.dstSet = info->descriptor_sets[DESCRIPTOR_SET_UNIFORMS];
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	write.pBufferInfo = &info->uniform_ring.buffer.descriptor;
+	write.dstArrayElement = 0;
+	write.dstBinding = 0;
+	vkUpdateDescriptorSets(info->device, 1, &write, 0, NULL);
+
+	//Without partially bound arrays, every slot must hold a valid descriptor
+	texture_table_t *table = &info->texture_table;
+	uint32_t slot_count = info->descriptor_indexing ? table->count : MAX_TEXTURES;
+	if (slot_count > table->count)
+		vulkan_create_texture_placeholder(info);
+	for (uint32_t i = table->count; i < slot_count; i++) {
+		table->slots[i].sampler = table->placeholder_sampler;
+		table->slots[i].imageView = table->placeholder_view;
+		table->slots[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+
+	uint32_t set_count = info->frames_in_flight * (info->dynamic_indexing ? 1 : MAX_TEXTURES);
+	std::vector<VkDescriptorSetLayout> layouts(set_count, info->descriptor_layouts[DESCRIPTOR_SET_TEXTURES]);
+	alloc_info[0].descriptorSetCount = set_count;
+	alloc_info[0].pSetLayouts = layouts.data();
+	table->sets = new VkDescriptorSet[set_count];
+	res = vkAllocateDescriptorSets(info->device, alloc_info, table->sets);
+	CHECK_VK(res);
+
+	static_assert(MAX_TEXTURES <= 64, "A dirty mask holds a bit per slot");
+	uint64_t all_slots = slot_count == 64 ? ~0ull : (1ull << slot_count) - 1;
+	table->dirty = new uint64_t[info->frames_in_flight];
+	for (uint32_t i = 0; i < info->frames_in_flight; i++) {
+		table->dirty[i] = all_slots;
+		vulkan_flush_texture_slots(info, i);
+	}
 
 	return VK_SUCCESS;
 }
 
-void vulkan_create_render_pass(vulkan_info_t *info) {
-	VkAttachmentDescription attachments[2];
-	attachments[0].flags = 0;
-	attachments[0].format = info->image_format;
-	attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
-	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-	attachments[1].flags = 0;
-	attachments[1].format = info->depth_buffer.format;
-	attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
-	attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-	VkAttachmentReference color_reference = {};
-	color_reference.attachment = 0;
-	color_reference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-	VkAttachmentReference depth_reference = {};
-	depth_reference.attachment = 1;
-	depth_reference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-	VkSubpassDescription subpass = {};
-	subpass.flags = 0;
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS; 
-	subpass.inputAttachmentCount = 0;
-	subpass.pInputAttachments = NULL;
-	subpass.colorAttachmentCount = 1;
-	subpass.pColorAttachments = &color_reference;
-	subpass.pResolveAttachments = NULL;
-	subpass.pDepthStencilAttachment = &depth_reference;
-	subpass.preserveAttachmentCount = 0;
-	subpass.pPreserveAttachments = NULL;
-
-	VkRenderPassCreateInfo renderPassInfo = {};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassInfo.pNext = NULL;
-	renderPassInfo.flags = 0;
-	renderPassInfo.attachmentCount = 2;
-	renderPassInfo.pAttachments = attachments;
-	renderPassInfo.subpassCount = 1;
-	renderPassInfo.pSubpasses = &subpass;
-	renderPassInfo.dependencyCount = 0;
-	renderPassInfo.pDependencies = NULL;
-
-	VkResult res = vkCreateRenderPass(info->device, &renderPassInfo, NULL, &info->render_pass);
-	assert(res == VK_SUCCESS);
+/*
+ * The backbuffer is imported, presented once the graph ran. The depth buffer
+ * is cleared by the main pass and never stored: the graph keeps it in lazily
+ * allocated memory where available.
+ */
+static void vulkan_create_render_graph(vulkan_info_t *info) {
+	render_graph_t *graph = &info->graph;
+	render_graph_create(graph);
+
+	std::vector<VkImage> images(info->swapchain_images_count);
+	std::vector<VkImageView> views(info->swapchain_images_count);
+	for (uint32_t i = 0; i < info->swapchain_images_count; i++) {
+		images[i] = info->swapchain_buffers[i].image;
+		views[i] = info->swapchain_buffers[i].view;
+	}
+	uint32_t backbuffer = render_graph_import(graph, "backbuffer", images.size(), images.data(),
+																						views.data(), info->image_format, info->width,
+																						info->height, IMAGE_ACCESS_UNDEFINED, IMAGE_ACCESS_PRESENT);
+	render_graph_output(graph, backbuffer);
+	uint32_t depth = render_graph_image(graph, "depth", VK_FORMAT_D16_UNORM, info->width, info->height);
+
+	info->main_pass = render_graph_add_pass(graph, "main", render_record_main_pass, NULL);
+	render_graph_write(graph, info->main_pass, backbuffer, IMAGE_ACCESS_COLOR_ATTACHMENT, true);
+	render_graph_write(graph, info->main_pass, depth, IMAGE_ACCESS_DEPTH_ATTACHMENT, true);
+
+	render_graph_compile(info, graph);
+	info->render_pass = render_graph_render_pass(graph, info->main_pass);
 }
 
 struct shader_t {
@@ -692,40 +887,17 @@ void vulkan_load_shaders(vulkan_info_t *info, uint32_t count,
 	info->shader_stages_count = count;
 }
 
-static void vulkan_create_framebuffers(vulkan_info_t *info) {
-	VkResult res = VK_SUCCESS;
-	VkImageView attachments[2];
-	attachments[1] = info->depth_buffer.view;
-
-	VkFramebufferCreateInfo framebuffer_info = {};
-	framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	framebuffer_info.pNext = NULL;
-	framebuffer_info.flags = 0;
-	framebuffer_info.renderPass = info->render_pass;
-	framebuffer_info.attachmentCount = 2;
-	framebuffer_info.pAttachments = attachments;
-	framebuffer_info.width = info->width;
-	framebuffer_info.height = info->height;
-	framebuffer_info.layers = 1;
-
-	uint32_t i = 0;
-	info->framebuffers = new VkFramebuffer[info->swapchain_images_count];
-	if (info->framebuffers == NULL)
-		throw VkException(VK_ERROR_OUT_OF_HOST_MEMORY);
-
-	for (i = 0; i < info->swapchain_images_count; i++) {
-			attachments[0] = info->swapchain_buffers[i].view;
-			res = vkCreateFramebuffer(info->device, &framebuffer_info, NULL, &info->framebuffers[i]);
-			assert(res == VK_SUCCESS);
-	}
-}
-
 static void vulkan_create_vertex_bindings(vulkan_info_t *info) {
-	info->vertex_binding.binding = 0;
-	info->vertex_binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-	info->vertex_binding.stride = sizeof(vertex_t);
-	
-	info->vertex_attribute = new VkVertexInputAttributeDescription[3];
+	info->vertex_bindings[VERTEX_BINDING_GEOMETRY].binding = VERTEX_BINDING_GEOMETRY;
+	info->vertex_bindings[VERTEX_BINDING_GEOMETRY].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	info->vertex_bindings[VERTEX_BINDING_GEOMETRY].stride = sizeof(vertex_t);
+	//Stepped once per instance: one draw covers every copy of the mesh
+	info->vertex_bindings[VERTEX_BINDING_INSTANCE].binding = VERTEX_BINDING_INSTANCE;
+	info->vertex_bindings[VERTEX_BINDING_INSTANCE].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+	info->vertex_bindings[VERTEX_BINDING_INSTANCE].stride = sizeof(instance_t);
+
+	info->vertex_attribute_count = 7;
+	info->vertex_attribute = new VkVertexInputAttributeDescription[info->vertex_attribute_count];
 	if (info->vertex_attribute == NULL)
 		throw VkException(VK_ERROR_OUT_OF_HOST_MEMORY);
 
@@ -744,60 +916,71 @@ static void vulkan_create_vertex_bindings(vulkan_info_t *info) {
 	info->vertex_attribute[2].binding = 0;
 	info->vertex_attribute[2].format = VK_FORMAT_R32G32_SFLOAT;
 	info->vertex_attribute[2].offset = 4 * 3 + 4 * 3; //Stored as RGBA
+	//TRANSFORM, a column per location
+	for (uint32_t c = 0; c < 4; c++) {
+		info->vertex_attribute[3 + c].location = 3 + c;
+		info->vertex_attribute[3 + c].binding = VERTEX_BINDING_INSTANCE;
+		info->vertex_attribute[3 + c].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		info->vertex_attribute[3 + c].offset = offsetof(instance_t, transform) + c * sizeof(glm::vec4);
+	}
 }
 
-void vulkan_create_vertex_buffer(vulkan_info_t *info, uint32_t size,
-																						data_buffer_t *buffer) {
-	VkResult res = VK_SUCCESS;
-
-	VkBufferCreateInfo buffer_info = {};
-	buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	buffer_info.pNext = NULL;
-	buffer_info.flags = 0; 
-	buffer_info.size = size;
-	buffer_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-	buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE; 
-	buffer_info.queueFamilyIndexCount = 0;
-	buffer_info.pQueueFamilyIndices = NULL;
-
-	res = vkCreateBuffer(info->device, &buffer_info, NULL, &buffer->buffer);
-	if (res != VK_SUCCESS)
-		throw VkException(res);
-
-	VkMemoryRequirements requirements;
-	vkGetBufferMemoryRequirements(info->device, buffer->buffer, &requirements);
-
-	VkMemoryAllocateInfo allocation_info = {};
-	allocation_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocation_info.pNext = NULL;
-	allocation_info.allocationSize = size;
-	allocation_info.memoryTypeIndex = 0;
-	bool success = find_memory_type_index(info, requirements.memoryTypeBits,
-																				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-																				&allocation_info.memoryTypeIndex);
-	assert(success);
-	buffer->descriptor.range = size;
-	res = vkAllocateMemory(info->device, &allocation_info, NULL, &buffer->memory);
-	assert(res == VK_SUCCESS);
+//Static geometry is copied once into device local memory, dynamic geometry stays mapped.
+//Static buffers are also transfer sources so the defragmenter can move them
+void vulkan_create_vertex_buffer(vulkan_info_t *info, uint32_t size, buffer_mode_e mode,
+																 data_buffer_t *buffer) {
+	if (mode == BUFFER_MODE_DYNAMIC)
+		buffer_create(info, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, MEMORY_USAGE_DYNAMIC,
+									MEMORY_CATEGORY_GEOMETRY, buffer);
+	else
+		buffer_create(info, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+									| VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+									MEMORY_USAGE_GPU_ONLY, MEMORY_CATEGORY_GEOMETRY, buffer);
 }
 
-void vulkan_update_vertex_buffer(vulkan_info_t *info, data_buffer_t *buffer, vertex_t *vertices, uint32_t count) {
-	void *ptr = NULL;
+void vulkan_update_vertex_buffer(vulkan_info_t *info, upload_batch_t *batch, data_buffer_t *buffer,
+																 vertex_t *vertices, uint32_t count) {
 	uint32_t data_size = count * sizeof(vertex_t);
-	VkResult res = VK_SUCCESS;
 
 	if (buffer->descriptor.range < data_size)
 		assert(0 && "Tried to write more bytes than there is in a buffer");
 
-	res = vkMapMemory(info->device, info->vertex_buffer.memory, 0, data_size, 0, &ptr);
-	assert(res == VK_SUCCESS);
+	upload_batch_buffer(info, batch, buffer, vertices, data_size, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+											VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+	info->vertex_count = count;
+}
 
-	memcpy(ptr, vertices, data_size);
-	vkUnmapMemory(info->device, buffer->memory);
+void vulkan_create_index_buffer(vulkan_info_t *info, uint32_t count, data_buffer_t *buffer) {
+	buffer_create(info, count * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+								| VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+								MEMORY_USAGE_GPU_ONLY, MEMORY_CATEGORY_GEOMETRY, buffer);
+}
 
-	res = vkBindBufferMemory(info->device, buffer->buffer, buffer->memory, 0);
-	assert(res == VK_SUCCESS);
-	info->vertex_count = count;
+void vulkan_update_index_buffer(vulkan_info_t *info, upload_batch_t *batch, data_buffer_t *buffer,
+																const uint32_t *indices, uint32_t count) {
+	uint32_t data_size = count * sizeof(uint32_t);
+	assert(buffer->descriptor.range >= data_size && "Tried to write more bytes than there is in a buffer");
+
+	upload_batch_buffer(info, batch, buffer, indices, data_size, VK_ACCESS_INDEX_READ_BIT,
+											VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+	info->index_count = count;
+}
+
+//Instance data is static like the geometry, and movable by the defragmenter as well
+void vulkan_create_instance_buffer(vulkan_info_t *info, uint32_t count, data_buffer_t *buffer) {
+	buffer_create(info, count * sizeof(instance_t), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+								| VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+								MEMORY_USAGE_GPU_ONLY, MEMORY_CATEGORY_GEOMETRY, buffer);
+}
+
+void vulkan_update_instance_buffer(vulkan_info_t *info, upload_batch_t *batch, data_buffer_t *buffer,
+																	 const instance_t *instances, uint32_t count) {
+	uint32_t data_size = count * sizeof(instance_t);
+	assert(buffer->descriptor.range >= data_size && "Tried to write more bytes than there is in a buffer");
+
+	upload_batch_buffer(info, batch, buffer, instances, data_size, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+											VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+	info->instance_count = count;
 }
 
 __attribute__((__used__))
@@ -811,8 +994,11 @@ static void vulkan_create_simple_vertex_buffer(vulkan_info_t *info) {
 	uint32_t buffer_size = sizeof(triangle);
 	info->vertex_count += 3;
 
-	vulkan_create_vertex_buffer(info, buffer_size , &info->vertex_buffer);
-	vulkan_update_vertex_buffer(info, &info->vertex_buffer, triangle, 3);
+	upload_batch_t batch;
+	upload_batch_create(info, &batch);
+	vulkan_create_vertex_buffer(info, buffer_size, BUFFER_MODE_STATIC, &info->vertex_buffer);
+	vulkan_update_vertex_buffer(info, &batch, &info->vertex_buffer, triangle, 3);
+	upload_batch_destroy(info, &batch);
 }
 
 static void vulkan_setup_viewport(vulkan_info_t *info) {
@@ -846,9 +1032,9 @@ static void vulkan_create_pipeline(vulkan_info_t *info) {
 	vtx_input.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 	vtx_input.pNext = NULL;
 	vtx_input.flags = 0;
-	vtx_input.vertexBindingDescriptionCount = 1;
-	vtx_input.pVertexBindingDescriptions = &info->vertex_binding;
-	vtx_input.vertexAttributeDescriptionCount = 3;
+	vtx_input.vertexBindingDescriptionCount = VERTEX_BINDING_COUNT;
+	vtx_input.pVertexBindingDescriptions = info->vertex_bindings;
+	vtx_input.vertexAttributeDescriptionCount = info->vertex_attribute_count;
 	vtx_input.pVertexAttributeDescriptions = info->vertex_attribute;
 
 	VkPipelineInputAssemblyStateCreateInfo input_assembly;
@@ -945,6 +1131,18 @@ static void vulkan_create_pipeline(vulkan_info_t *info) {
 	pipeline.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 	pipeline.pNext = NULL;
 	pipeline.flags = 0;
+	//The fragment shader's table size, a single texture per set without dynamic indexing
+	texture_specialization_t constants = { info->dynamic_indexing, info->dynamic_indexing ? MAX_TEXTURES : 1u };
+	VkSpecializationMapEntry entries[2] = {
+		{ 0, offsetof(texture_specialization_t, table), sizeof(constants.table) },
+		{ 1, offsetof(texture_specialization_t, slots), sizeof(constants.slots) },
+	};
+	VkSpecializationInfo specialization = { 2, entries, sizeof(constants), &constants };
+	for (uint32_t i = 0; i < info->shader_stages_count; i++) {
+		if (info->shader_stages[i].stage == VK_SHADER_STAGE_FRAGMENT_BIT)
+			info->shader_stages[i].pSpecializationInfo = &specialization;
+	}
+
 	pipeline.stageCount = info->shader_stages_count;
 	pipeline.pStages = info->shader_stages;
 	pipeline.pVertexInputState = &vtx_input;
@@ -963,6 +1161,8 @@ static void vulkan_create_pipeline(vulkan_info_t *info) {
 	pipeline.basePipelineIndex = 0;
 
 	VkResult res = vkCreateGraphicsPipelines(info->device, VK_NULL_HANDLE, 1, &pipeline, NULL, &info->pipeline);
+	for (uint32_t i = 0; i < info->shader_stages_count; i++)
+		info->shader_stages[i].pSpecializationInfo = NULL;
 	assert(res == VK_SUCCESS);
 }
 
@@ -970,6 +1170,8 @@ void vulkan_initialize(vulkan_info_t *info) {
 	LOG("Initializing Vulkan...");
 	
 	queue_creation_info_t queue_info = { 0 };
+	if (info->frames_in_flight == 0)
+		info->frames_in_flight = DEFAULT_FRAMES_IN_FLIGHT;
 
 	bool success = create_window(&info->window, info->width, info->height);
 	assert(success);
@@ -977,12 +1179,16 @@ void vulkan_initialize(vulkan_info_t *info) {
 	vulkan_startup(info);
 	vulkan_initialize_devices(info);
 	vulkan_create_device(info, &queue_info);
+	memory_allocator_create(info);
+	defrag_create(info);
 	vulkan_create_KHR_surface(info);
 	vulkan_create_queues(info, &queue_info);
+	timeline_create(info, &info->graphic_timeline, info->graphic_queue);
+	timeline_create(info, &info->transfer_timeline, info->transfer_queue);
 	vulkan_create_command_buffer(info);
 	vulkan_create_swapchain(info);
+	vulkan_select_texture_formats(info);
 	vulkan_initialize_swapchain_images(info);
-	vulkan_create_depth_buffer(info);
 	vulkan_create_descriptor_pool(info);
 
 	delete[] queue_info.family_props;
@@ -996,10 +1202,9 @@ void vulkan_create_rendering_pipeline(vulkan_info_t *info) {
 
 	vulkan_create_pipeline_layout(info);
 	vulkan_create_descriptors(info);
-	vulkan_create_render_pass(info);
+	vulkan_create_render_graph(info);
 	vulkan_setup_scissor(info);
 	vulkan_setup_viewport(info);
-	vulkan_create_framebuffers(info);
 	vulkan_create_vertex_bindings(info);
 	
 	vulkan_create_pipeline(info);
@@ -1007,26 +1212,110 @@ void vulkan_create_rendering_pipeline(vulkan_info_t *info) {
 	LOG("Pipeline ready.");
 }
 
-void vulkan_create_texture(vulkan_info_t *info, texture_t *tex) {
+void vulkan_create_texture(vulkan_info_t *info, texture_t *tex, texture_role_e role) {
+	tex->format = info->texture_formats[role];
+
+	//UNORM and SRGB are copy compatible, the staging image never needs the sRGB variant
 	image_create(info, tex->width, tex->height, &tex->storage_image,
-										 &tex->storage_memory, &tex->size,
+										 &tex->storage_allocation, &tex->size,
 										 VK_FORMAT_R8G8B8A8_UNORM,
-										 VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+										 VK_IMAGE_USAGE_TRANSFER_SRC_BIT, MEMORY_CATEGORY_STAGING);
 	image_create(info, tex->width, tex->height, &tex->texture_image,
-										 &tex->texture_memory, &tex->size,
-										 VK_FORMAT_R8G8B8A8_UNORM,
+										 &tex->texture_allocation, &tex->size,
+										 tex->format,
 										 VK_IMAGE_USAGE_TRANSFER_DST_BIT |
-										 VK_IMAGE_USAGE_SAMPLED_BIT);
+										 VK_IMAGE_USAGE_SAMPLED_BIT, MEMORY_CATEGORY_TEXTURE);
+
+	//The staging image is written by the host before the first commit
+	image_state_init(&tex->storage_state, tex->storage_image, VK_IMAGE_ASPECT_COLOR_BIT, 1,
+									 IMAGE_ACCESS_HOST_WRITTEN);
+	image_state_init(&tex->texture_state, tex->texture_image, VK_IMAGE_ASPECT_COLOR_BIT, 1,
+									 IMAGE_ACCESS_UNDEFINED);
+	tex->committed = NULL;
+
+	image_view_create(info, tex->texture_image, tex->format, &tex->view);
+	image_sampler_create(info, &tex->sampler);
+	vulkan_register_texture(info, tex);
+}
 
-	image_view_create(info, tex->texture_image, VK_FORMAT_R8G8B8A8_UNORM, &info->texture_view);
-	image_sampler_create(info, &info->texture_sampler);
+uint32_t vulkan_register_texture(vulkan_info_t *info, texture_t *tex) {
+	texture_table_t *table = &info->texture_table;
+	if (table->count >= MAX_TEXTURES)
+		throw VkException(VK_ERROR_TOO_MANY_OBJECTS);
+
+	tex->index = table->count++;
+	vulkan_update_texture_slot(info, tex);
+	return tex->index;
 }
 
-void vulkan_update_texture(vulkan_info_t *info, texture_t *tex, stbi_uc* data) {
-	void *ptr = NULL;
-	VkResult res = vkMapMemory(info->device, tex->storage_memory, 0, tex->size, 0, &ptr);
-	assert(res == VK_SUCCESS);
+//Written to each frame's sets when the frame next starts, see vulkan_flush_texture_slots
+void vulkan_update_texture_slot(vulkan_info_t *info, texture_t *tex) {
+	texture_table_t *table = &info->texture_table;
+	assert(tex->index < table->count);
+
+	table->slots[tex->index].sampler = tex->sampler;
+	table->slots[tex->index].imageView = tex->view;
+	table->slots[tex->index].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	if (table->sets == NULL)
+		return;
+	for (uint32_t i = 0; i < info->frames_in_flight; i++)
+		table->dirty[i] |= 1ull << tex->index;
+}
 
+/*
+ * Writes the slots rewritten since the frame's sets were last written. The
+ * frame's previous submission must have retired. Returns true when it wrote
+ * any: without update-after-bind, the frame's recorded commands are invalid.
+ */
+bool vulkan_flush_texture_slots(vulkan_info_t *info, uint32_t frame) {
+	texture_table_t *table = &info->texture_table;
+	if (table->sets == NULL || table->dirty[frame] == 0)
+		return false;
+
+	VkWriteDescriptorSet writes[MAX_TEXTURES];
+	uint32_t count = 0;
+	for (uint32_t slot = 0; slot < MAX_TEXTURES; slot++) {
+		if ((table->dirty[frame] & (1ull << slot)) == 0)
+			continue;
+
+		VkWriteDescriptorSet *write = &writes[count++];
+		*write = {};
+		write->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write->pNext = NULL;
+		write->dstSet = vulkan_texture_set(info, frame, slot);
+		write->dstBinding = 0;
+		write->dstArrayElement = info->dynamic_indexing ? slot : 0;
+		write->descriptorCount = 1;
+		write->descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write->pImageInfo = &table->slots[slot];
+	}
+
+	vkUpdateDescriptorSets(info->device, count, writes, 0, NULL);
+	table->dirty[frame] = 0;
+	return true;
+}
+
+//The set a frame binds to sample the slot
+VkDescriptorSet vulkan_texture_set(vulkan_info_t *info, uint32_t frame, uint32_t slot) {
+	texture_table_t *table = &info->texture_table;
+	if (info->dynamic_indexing)
+		return table->sets[frame];
+	return table->sets[frame * MAX_TEXTURES + slot];
+}
+
+/*
+ * Exposes the linear staging image, so decoders can write straight into it.
+ * After a commit, its batch is flushed and waited: the copy must have read
+ * the image, left in the GENERAL layout for the host.
+ */
+void vulkan_map_texture(vulkan_info_t *info, texture_t *tex, image_sink_t *sink) {
+	if (tex->committed != NULL) {
+		if (!tex->committed->pending)
+			upload_batch_submit(info, tex->committed);
+		upload_batch_wait(info, tex->committed);
+		tex->committed = NULL;
+	}
 	VkImageSubresource subresource = {};
 	subresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	subresource.mipLevel = 0;
@@ -1035,46 +1324,50 @@ void vulkan_update_texture(vulkan_info_t *info, texture_t *tex, stbi_uc* data) {
 	VkSubresourceLayout layout;
 	vkGetImageSubresourceLayout(info->device, tex->storage_image, &subresource, &layout);
 
-	if (layout.rowPitch == tex->width * 4)
-		memcpy(ptr, data, tex->size);
-	else {
-		uint8_t *bytes = reinterpret_cast<uint8_t*>(data);
-		for (uint32_t y = 0; y < tex->height; y++)
-			memcpy(&bytes[y * layout.rowPitch], &data[y * tex->width * 4], tex->width * 4);
-	}
+	//Relative to the image, the allocation is persistently mapped
+	sink->data = tex->storage_allocation.mapped + layout.offset;
+	sink->row_pitch = layout.rowPitch;
+	sink->width = tex->width;
+	sink->height = tex->height;
+}
 
-	vkUnmapMemory(info->device, tex->storage_memory);
+/*
+ * Recorded into the batch, the texture is readable once the batch completed.
+ * The host writes become visible to the copy, then the staging image goes
+ * back to the host.
+ */
+void vulkan_commit_texture(vulkan_info_t *info, upload_batch_t *batch, texture_t *tex) {
+	VkCommandBuffer command = upload_batch_command(info, batch);
+
+	barrier_batch_t barriers;
+	barrier_batch_begin(&barriers, command);
+	barrier_image(&barriers, &tex->storage_state, IMAGE_ACCESS_TRANSFER_SRC);
+	barrier_image(&barriers, &tex->texture_state, IMAGE_ACCESS_TRANSFER_DST);
+	barrier_flush(&barriers);
+
+	image_copy(command, tex->storage_image, tex->texture_image, tex->width, tex->height);
+
+	barrier_image(&barriers, &tex->texture_state, IMAGE_ACCESS_FRAGMENT_SAMPLED);
+	barrier_image(&barriers, &tex->storage_state, IMAGE_ACCESS_HOST_REWRITE);
+	barrier_flush(&barriers);
+	tex->committed = batch;
+}
 
-	image_layout_transition(info, tex->storage_image,
-		VK_IMAGE_LAYOUT_PREINITIALIZED,
-		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
-	);
+void vulkan_update_texture(vulkan_info_t *info, upload_batch_t *batch, texture_t *tex, stbi_uc* data) {
+	image_sink_t sink;
+	vulkan_map_texture(info, tex, &sink);
 
-	image_layout_transition(info, tex->texture_image,
-		VK_IMAGE_LAYOUT_PREINITIALIZED,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-	);
+	for (uint32_t y = 0; y < tex->height; y++)
+		image_sink_write_row(&sink, y, &data[y * tex->width * 4]);
 
-	image_copy(info, tex->storage_image, tex->texture_image, tex->width, tex->height);
+	vulkan_commit_texture(info, batch, tex);
 }
 
 //===== CLEAN FUNCTIONS
 
-static void vulkan_destroy_framebuffers(VkDevice d, VkFramebuffer *b, uint32_t c) {
-	for (uint32_t i = 0; i < c; i++)
-		vkDestroyFramebuffer(d, b[i], NULL);
-	delete[] b;
-}
-
-static void vulkan_destroy_data_buffer(VkDevice device, data_buffer_t buffer) {
-	vkDestroyBuffer(device, buffer.buffer, NULL);
-	vkFreeMemory(device, buffer.memory, NULL);
-}
-
-static void vulkan_destroy_image_buffer(VkDevice device, image_buffer_t buffer) {
-	vkDestroyImageView(device, buffer.view, NULL);
-	vkDestroyImage(device, buffer.image, NULL);
-	vkFreeMemory(device, buffer.memory, NULL);
+static void vulkan_destroy_data_buffer(vulkan_info_t *info, data_buffer_t *buffer) {
+	vkDestroyBuffer(info->device, buffer->buffer, NULL);
+	memory_free(info, &buffer->allocation);
 }
 
 void vulkan_unload_shaders(vulkan_info_t *info, uint32_t count) {
@@ -1084,39 +1377,56 @@ void vulkan_unload_shaders(vulkan_info_t *info, uint32_t count) {
 }
 
 void vulkan_unload_texture(vulkan_info_t *info, texture_t *texture) {
+	vkDestroyImageView(info->device, texture->view, NULL);
+	image_sampler_release(info, texture->sampler);
 	vkDestroyImage(info->device, texture->storage_image, NULL);
 	vkDestroyImage(info->device, texture->texture_image, NULL);
-	vkFreeMemory(info->device, texture->storage_memory, NULL);
-	vkFreeMemory(info->device, texture->texture_memory, NULL);
+	memory_free(info, &texture->storage_allocation);
+	memory_free(info, &texture->texture_allocation);
 }
 
 void vulkan_cleanup(vulkan_info_t *info) {
 	vkDestroyPipeline(info->device, info->pipeline, NULL);
-	vulkan_destroy_data_buffer(info->device, info->vertex_buffer);
-	vulkan_destroy_framebuffers(info->device, info->framebuffers,
-															info->swapchain_images_count);
-
-	vkDestroyImageView(info->device, info->texture_view, NULL);
-	vkDestroySampler(info->device, info->texture_sampler, NULL);
-
-	vkDestroyRenderPass(info->device, info->render_pass, NULL);
+	vulkan_destroy_data_buffer(info, &info->vertex_buffer);
+	vulkan_destroy_data_buffer(info, &info->index_buffer);
+	vulkan_destroy_data_buffer(info, &info->instance_buffer);
+	render_graph_destroy(info, &info->graph);
 	vkDestroyDescriptorPool(info->device, info->descriptor_pool, NULL);
+	delete[] info->descriptor_sets;
+	delete[] info->texture_table.sets;
+	delete[] info->texture_table.dirty;
+	if (info->texture_table.placeholder_view != VK_NULL_HANDLE) {
+		vkDestroyImageView(info->device, info->texture_table.placeholder_view, NULL);
+		image_sampler_release(info, info->texture_table.placeholder_sampler);
+		vkDestroyImage(info->device, info->texture_table.placeholder_image, NULL);
+		memory_free(info, &info->texture_table.placeholder_allocation);
+	}
 	vkDestroyPipelineLayout(info->device, info->pipeline_layout, NULL);
 
 	for (uint32_t i = 0; i < NUM_DESCRIPTORS; i++)
 		vkDestroyDescriptorSetLayout(info->device, info->descriptor_layouts[i], NULL);
 	delete[] info->descriptor_layouts;
 
-	vulkan_destroy_data_buffer(info->device, info->uniform_buffer);
-	vulkan_destroy_image_buffer(info->device, info->depth_buffer);	
+	uniform_ring_destroy(info, &info->uniform_ring);
 
 	for (uint32_t i = 0; i < info->swapchain_images_count; i++)
 		vkDestroyImageView(info->device, info->swapchain_buffers[i].view, NULL);
 	delete[] info->swapchain_buffers;
 
+	sampler_cache_print_stats(info);
+	sampler_cache_destroy(info);
+	deferred_flush(info);
+	memory_print_stats(info);
+	defrag_destroy(info);
+	memory_allocator_destroy(info);
+
+	timeline_destroy(info, &info->transfer_timeline);
+	timeline_destroy(info, &info->graphic_timeline);
 	vkDestroySwapchainKHR(info->device, info->swapchain, NULL);
 	vkFreeCommandBuffers(info->device, info->cmd_pool, 1, &info->cmd_buffer);
 	vkDestroyCommandPool(info->device, info->cmd_pool, NULL);
+	if (info->transfer_cmd_pool != VK_NULL_HANDLE)
+		vkDestroyCommandPool(info->device, info->transfer_cmd_pool, NULL);
 	vkDeviceWaitIdle(info->device);
 	vkDestroyDevice(info->device, NULL);
 	vkDestroySurfaceKHR(info->instance, info->surface, NULL);
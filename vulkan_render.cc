@@ -1,5 +1,6 @@
 #define VULKAN_HPP_NO_EXCEPTIONS
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <memory>
@@ -39,37 +40,295 @@ static void render_create_semaphore(vulkan_info_t *info, VkSemaphore *semaphore)
 }
 
 void render_init_fences(vulkan_info_t *info) {
-	uint32_t count = info->swapchain_images_count;
-
-	info->semaphore_acquired = new VkSemaphore[count];
-	info->semaphore_drawing = new VkSemaphore[count];
-	info->semaphore_ownership = new VkSemaphore[count];
-	info->fences = new VkFence[count];
-
-	for(uint32_t i = 0; i < info->swapchain_images_count; i++) {
-		VkFenceCreateInfo fence_info;
-		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fence_info.pNext = NULL;
-		fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-		VkResult res = vkCreateFence(info->device, &fence_info, NULL, &info->fences[i]);
-		assert(res == VK_SUCCESS);
-		res = vkCreateFence(info->device, &fence_info, NULL, &info->swapchain_buffers[i].fence);
-		assert(res == VK_SUCCESS);
-
-		render_create_semaphore(info, &info->semaphore_acquired[i]);
-		render_create_semaphore(info, &info->semaphore_drawing[i]);
-		render_create_semaphore(info, &info->semaphore_ownership[i]);
+	uint32_t image_count = info->swapchain_images_count;
+
+	info->frames = new render_frame_t[info->frames_in_flight]();
+	info->frame_index = 0;
+
+	for (uint32_t i = 0; i < info->frames_in_flight; i++) {
+		render_frame_t *frame = &info->frames[i];
+
+		//Value 0 is always reached: the first wait on every slot returns at once
+		frame->retire = 0;
+		render_create_semaphore(info, &frame->acquired);
+
+		//Recorded on first use
+		frame->commands = new VkCommandBuffer[image_count]();
+		frame->recorded_versions = new uint64_t[image_count]();
 	}
+
+	/*
+	 * The presentation of an image holds its semaphore until the image is
+	 * acquired again, which the slot's retire value says nothing about:
+	 * one semaphore per image, reused once that image comes back.
+	 */
+	for (uint32_t i = 0; i < image_count; i++)
+		render_create_semaphore(info, &info->swapchain_buffers[i].rendered);
 }
 
-void render_create_cmd(vulkan_info_t *info, vulkan_frame_info_t *frame, int i) {
+/*
+ * Secondary command buffers inherit nothing: every recording starts with the bindings.
+ * Draws are indirect: their commands are read from the slot's draw list at execution.
+ */
+static void render_record_draws(vulkan_info_t *info, VkCommandBuffer command, uint32_t slot,
+																const render_draw_list_t *list, render_draw_t *draws, uint32_t count) {
+	vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_GRAPHICS, info->pipeline);
+	uint32_t uniform_offset = uniform_ring_frame_offset(&info->uniform_ring, slot);
+	VkDescriptorSet sets[NUM_DESCRIPTORS];
+	sets[DESCRIPTOR_SET_UNIFORMS] = info->descriptor_sets[DESCRIPTOR_SET_UNIFORMS];
+	sets[DESCRIPTOR_SET_TEXTURES] = vulkan_texture_set(info, slot, 0);
+	vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_GRAPHICS,
+													info->pipeline_layout, 0, NUM_DESCRIPTORS,
+													sets, 1, &uniform_offset);
+
+	vkCmdSetViewport(command, 0, 1, &info->viewport);
+	vkCmdSetScissor(command, 0, 1, &info->scissor);
+
+	//Textures are picked from the global table: no rebind between materials unless it can't be indexed
+	const VkDeviceSize offsets[VERTEX_BINDING_COUNT] = { 0, 0 };
+	for (uint32_t d = 0; d < count; d++) {
+		render_draw_t *draw = &draws[d];
+		draw_constants_t constants = { };
+		constants.texture_index = draw->texture_index;
+		if (!info->dynamic_indexing) {
+			VkDescriptorSet set = vulkan_texture_set(info, slot, draw->texture_index);
+			vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_GRAPHICS, info->pipeline_layout,
+															DESCRIPTOR_SET_TEXTURES, 1, &set, 0, NULL);
+		}
+
+		vkCmdPushConstants(command, info->pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT,
+											 0, sizeof(constants), &constants);
+		VkBuffer buffers[VERTEX_BINDING_COUNT] = { draw->vertex_buffer.buffer, draw->instance_buffer.buffer };
+		vkCmdBindVertexBuffers(command, 0, VERTEX_BINDING_COUNT, buffers, offsets);
+		vkCmdBindIndexBuffer(command, draw->index_buffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+		const VkDeviceSize stride = sizeof(VkDrawIndexedIndirectCommand);
+		VkDeviceSize offset = draw->first_command * stride;
+#ifdef VK_KHR_draw_indirect_count
+		if (info->draw_indirect_count) {
+			info->cmd_draw_indexed_indirect_count(command, list->commands.buffer, offset, list->counts.buffer,
+																						draw->count_index * sizeof(uint32_t), draw->max_commands, stride);
+			continue;
+		}
+#endif
+		//Without multi draw, each command is its own draw
+		if (info->device_features.multiDrawIndirect)
+			vkCmdDrawIndexedIndirect(command, list->commands.buffer, offset, draw->max_commands, stride);
+		else {
+			for (uint32_t c = 0; c < draw->max_commands; c++)
+				vkCmdDrawIndexedIndirect(command, list->commands.buffer, offset + c * stride, 1, stride);
+		}
+	}
+}
 
-	info->swapchain_buffers[i].command = create_command_buffer(info);
+/*
+ * Assigns each draw its range of commands, then fills every slot with a
+ * single command drawing all the indices and instances.
+ */
+void render_draw_lists_create(vulkan_info_t *info, vulkan_frame_info_t *frame) {
+	frame->command_count = 0;
+	for (uint32_t d = 0; d < frame->draw_count; d++) {
+		render_draw_t *draw = &frame->draws[d];
+		draw->max_commands = std::max(draw->max_commands, 1u);
+		//Issued a command at a time otherwise
+		assert(!info->device_features.multiDrawIndirect
+					 || draw->max_commands <= info->device_properties.limits.maxDrawIndirectCount);
+		draw->first_command = frame->command_count;
+		draw->count_index = d;
+		frame->command_count += draw->max_commands;
+	}
 
-	VkCommandBuffer *command = &info->swapchain_buffers[i].command;
-	render_begin_command(command);
+	VkBufferUsageFlags usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	frame->draw_lists = new render_draw_list_t[info->frames_in_flight];
+	for (uint32_t slot = 0; slot < info->frames_in_flight; slot++) {
+		render_draw_list_t *list = &frame->draw_lists[slot];
+		buffer_create(info, frame->command_count * sizeof(VkDrawIndexedIndirectCommand), usage,
+									MEMORY_USAGE_DYNAMIC, MEMORY_CATEGORY_GEOMETRY, &list->commands);
+		buffer_create(info, frame->draw_count * sizeof(uint32_t), usage,
+									MEMORY_USAGE_DYNAMIC, MEMORY_CATEGORY_GEOMETRY, &list->counts);
+
+		for (uint32_t d = 0; d < frame->draw_count; d++) {
+			render_draw_t *draw = &frame->draws[d];
+			VkDrawIndexedIndirectCommand *commands = render_draw_commands(frame, slot, d);
+			commands[0].indexCount = draw->index_count;
+			commands[0].instanceCount = draw->instance_count;
+			commands[0].firstIndex = 0;
+			commands[0].vertexOffset = 0;
+			commands[0].firstInstance = 0;
+			render_set_draw_count(info, frame, slot, d, 1);
+		}
+	}
+}
+
+void render_draw_lists_destroy(vulkan_info_t *info, vulkan_frame_info_t *frame) {
+	for (uint32_t slot = 0; slot < info->frames_in_flight; slot++) {
+		buffer_destroy(info, &frame->draw_lists[slot].commands);
+		buffer_destroy(info, &frame->draw_lists[slot].counts);
+	}
+	delete[] frame->draw_lists;
+	frame->draw_lists = NULL;
+}
+
+//Writable once the slot's previous submission retired, max_commands entries
+VkDrawIndexedIndirectCommand* render_draw_commands(vulkan_frame_info_t *frame, uint32_t slot, uint32_t draw) {
+	render_draw_list_t *list = &frame->draw_lists[slot];
+	return (VkDrawIndexedIndirectCommand*)list->commands.allocation.mapped + frame->draws[draw].first_command;
+}
+
+void render_set_draw_count(vulkan_info_t *info, vulkan_frame_info_t *frame, uint32_t slot, uint32_t draw,
+													 uint32_t count) {
+	render_draw_t *target = &frame->draws[draw];
+	assert(count <= target->max_commands);
+	((uint32_t*)frame->draw_lists[slot].counts.allocation.mapped)[target->count_index] = count;
+	if (info->draw_indirect_count)
+		return;
+
+	//Every command is drawn: the ones past the count draw nothing
+	VkDrawIndexedIndirectCommand *commands = render_draw_commands(frame, slot, draw);
+	for (uint32_t c = count; c < target->max_commands; c++)
+		commands[c].instanceCount = 0;
+}
+
+static void render_worker_record(render_workers_t *workers, uint32_t worker) {
+	vulkan_info_t *info = workers->info;
+	vulkan_frame_info_t *frame = workers->frame;
+	uint32_t target = workers->slot * info->swapchain_images_count + workers->image;
+	uint32_t index = worker * workers->target_count + target;
+
+	uint32_t slice = (frame->draw_count + workers->count - 1) / workers->count;
+	uint32_t first = std::min(worker * slice, frame->draw_count);
+	uint32_t last = std::min(first + slice, frame->draw_count);
+
+	VkResult res = vkResetCommandPool(info->device, workers->pools[index], 0);
+	assert(res == VK_SUCCESS);
+
+	VkCommandBufferInheritanceInfo inheritance = { };
+	inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritance.pNext = NULL;
+	inheritance.renderPass = render_graph_render_pass(&info->graph, info->main_pass);
+	inheritance.subpass = 0;
+	inheritance.framebuffer = render_graph_framebuffer(&info->graph, info->main_pass, workers->image);
+	inheritance.occlusionQueryEnable = VK_FALSE;
+	inheritance.queryFlags = 0;
+	inheritance.pipelineStatistics = 0;
+
+	VkCommandBufferBeginInfo begin_info = { };
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.pNext = NULL;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	begin_info.pInheritanceInfo = &inheritance;
+
+	VkCommandBuffer command = workers->commands[index];
+	res = vkBeginCommandBuffer(command, &begin_info);
+	assert(res == VK_SUCCESS);
+	//An empty slice still records a valid, empty secondary
+	if (first < last)
+		render_record_draws(info, command, workers->slot, &frame->draw_lists[workers->slot],
+												frame->draws + first, last - first);
+	res = vkEndCommandBuffer(command);
+	assert(res == VK_SUCCESS);
+}
+
+static void render_worker_main(render_workers_t *workers, uint32_t worker) {
+	uint64_t seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard(workers->lock);
+			workers->wake.wait(guard, [workers, seen] {
+				return workers->quit || workers->generation != seen;
+			});
+			if (workers->quit)
+				return;
+			seen = workers->generation;
+		}
+
+		render_worker_record(workers, worker);
+
+		std::lock_guard<std::mutex> guard(workers->lock);
+		if (--workers->pending == 0)
+			workers->finished.notify_one();
+	}
+}
+
+//Returns once every worker recorded its slice for the frame slot and image
+static void render_workers_record(render_workers_t *workers, vulkan_info_t *info,
+																	vulkan_frame_info_t *frame, uint32_t slot, uint32_t image) {
+	std::unique_lock<std::mutex> guard(workers->lock);
+	workers->info = info;
+	workers->frame = frame;
+	workers->slot = slot;
+	workers->image = image;
+	workers->pending = workers->count;
+	workers->generation++;
+	workers->wake.notify_all();
+	workers->finished.wait(guard, [workers] { return workers->pending == 0; });
+}
+
+void render_workers_create(vulkan_info_t *info, render_workers_t *workers, uint32_t count) {
+	workers->count = std::max(1u, std::min(count, (uint32_t)RENDER_MAX_WORKERS));
+	workers->target_count = info->frames_in_flight * info->swapchain_images_count;
+	workers->generation = 0;
+	workers->pending = 0;
+	workers->quit = false;
+
+	uint32_t total = workers->count * workers->target_count;
+	workers->pools.resize(total);
+	workers->commands.resize(total);
+	for (uint32_t i = 0; i < total; i++) {
+		VkCommandPoolCreateInfo pool_info = { };
+		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		pool_info.pNext = NULL;
+		pool_info.flags = 0;
+		pool_info.queueFamilyIndex = info->graphic_queue_family_index;
+		VkResult res = vkCreateCommandPool(info->device, &pool_info, NULL, &workers->pools[i]);
+		if (res != VK_SUCCESS)
+			throw VkException(res);
+
+		VkCommandBufferAllocateInfo alloc_info = { };
+		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		alloc_info.pNext = NULL;
+		alloc_info.commandPool = workers->pools[i];
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		alloc_info.commandBufferCount = 1;
+		res = vkAllocateCommandBuffers(info->device, &alloc_info, &workers->commands[i]);
+		if (res != VK_SUCCESS)
+			throw VkException(res);
+	}
+
+	for (uint32_t i = 0; i < workers->count; i++)
+		workers->threads.push_back(std::thread(render_worker_main, workers, i));
+}
 
+void render_workers_destroy(vulkan_info_t *info, render_workers_t *workers) {
+	{
+		std::lock_guard<std::mutex> guard(workers->lock);
+		workers->quit = true;
+	}
+	workers->wake.notify_all();
+	for (std::thread &thread : workers->threads)
+		thread.join();
+	workers->threads.clear();
+
+	//Destroying a pool frees its command buffers
+	for (VkCommandPool pool : workers->pools)
+		vkDestroyCommandPool(info->device, pool, NULL);
+	workers->pools.clear();
+	workers->commands.clear();
+}
+
+//What the main pass needs from the frame being recorded, handed through the graph
+struct render_main_pass_t {
+	vulkan_frame_info_t *frame;
+	uint32_t slot;
+	bool parallel;
+};
+
+void render_record_main_pass(render_graph_context_t *context) {
+	render_main_pass_t *pass = (render_main_pass_t*)context->frame;
+	vulkan_info_t *info = context->info;
+	vulkan_frame_info_t *frame = pass->frame;
+
+	//Attachments in declaration order: backbuffer then depth
 	VkClearValue clear_values[2];
 	clear_values[0].color = {
 		frame->clear_color.x,
@@ -81,32 +340,45 @@ void render_create_cmd(vulkan_info_t *info, vulkan_frame_info_t *frame, int i) {
 	clear_values[1].depthStencil.depth = 1.0f;
 	clear_values[1].depthStencil.stencil = 0;
 
-	VkRenderPassBeginInfo pass_begin_info = { };
-	pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	pass_begin_info.pNext = NULL;
-	pass_begin_info.renderPass = info->render_pass;
-	pass_begin_info.framebuffer = info->framebuffers[i];
-	pass_begin_info.renderArea.offset.x = 0;
-	pass_begin_info.renderArea.offset.y = 0;
-	pass_begin_info.renderArea.extent.width = info->width;
-	pass_begin_info.renderArea.extent.height = info->height;
-	pass_begin_info.clearValueCount = 2;
-	pass_begin_info.pClearValues = clear_values;
-
-	vkCmdBeginRenderPass(*command, &pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-	vkCmdBindPipeline(*command, VK_PIPELINE_BIND_POINT_GRAPHICS, info->pipeline);
-	vkCmdBindDescriptorSets(*command, VK_PIPELINE_BIND_POINT_GRAPHICS,
-													info->pipeline_layout, 0, NUM_DESCRIPTORS,
-													info->descriptor_sets, 0, NULL);
+	if (pass->parallel) {
+		render_workers_t *workers = frame->workers;
+		std::vector<VkCommandBuffer> secondaries(workers->count);
+		uint32_t index = pass->slot * info->swapchain_images_count + context->image;
+		for (uint32_t w = 0; w < workers->count; w++)
+			secondaries[w] = workers->commands[w * workers->target_count + index];
+
+		render_graph_begin_render_pass(context, clear_values, 2, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		vkCmdExecuteCommands(context->command, secondaries.size(), secondaries.data());
+	} else {
+		render_graph_begin_render_pass(context, clear_values, 2, VK_SUBPASS_CONTENTS_INLINE);
+		render_record_draws(info, context->command, pass->slot, &frame->draw_lists[pass->slot],
+												frame->draws, frame->draw_count);
+	}
+	vkCmdEndRenderPass(context->command);
+}
 
-	const VkDeviceSize offsets[1] = { 0 };
-	vkCmdBindVertexBuffers(*command, 0, 1, &frame->vertex_buffer.buffer, offsets);
-	vkCmdSetViewport(*command, 0, 1, &info->viewport);
-	vkCmdSetScissor(*command, 0, 1, &info->scissor);
-	vkCmdDraw(*command, frame->vertex_count, 1, 0, 0);
-	vkCmdEndRenderPass(*command);
+void render_create_cmd(vulkan_info_t *info, vulkan_frame_info_t *frame, uint32_t slot, uint32_t image) {
+	render_frame_t *target = &info->frames[slot];
 
+	//Re-recording reuses the buffer, the pool allows individual resets
+	if (target->commands[image] == VK_NULL_HANDLE)
+		target->commands[image] = create_command_buffer(info, info->cmd_pool);
+
+	//The slot's previous submission must retire before its buffers are reset
+	timeline_wait(info, &info->graphic_timeline, target->retire);
+
+	render_main_pass_t pass;
+	pass.frame = frame;
+	pass.slot = slot;
+	pass.parallel = frame->workers != NULL && frame->draw_count >= RENDER_PARALLEL_MIN_DRAWS;
+	if (pass.parallel)
+		render_workers_record(frame->workers, info, frame, slot, image);
+
+	VkCommandBuffer *command = &target->commands[image];
+	render_begin_command(command);
+	render_graph_execute(info, &info->graph, *command, image, &pass);
 	render_end_command(command);
+	target->recorded_versions[image] = frame->scene_version;
 }
 
 void render_create_transition_commands(vulkan_info_t *info, uint32_t i) {
@@ -118,7 +390,7 @@ void render_create_transition_commands(vulkan_info_t *info, uint32_t i) {
 	command_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
 	command_info.pInheritanceInfo = NULL;
 
-	info->swapchain_buffers[i].present_transition_cmd = create_command_buffer(info);
+	info->swapchain_buffers[i].present_transition_cmd = create_command_buffer(info, info->cmd_pool);
 	res = vkBeginCommandBuffer(info->swapchain_buffers[i].present_transition_cmd, &command_info);
 	assert(res == VK_SUCCESS);
 
@@ -146,18 +418,48 @@ void render_create_transition_commands(vulkan_info_t *info, uint32_t i) {
 	assert(res == VK_SUCCESS);
 }
 
+/*
+ * Waits for the slot's previous submission, then acquires an image signaling the slot's semaphore.
+ * Texture slots rewritten meanwhile reach the slot's sets here, objects the GPU is done with are freed.
+ */
 void render_get_frame(vulkan_info_t *info) {
-	vkWaitForFences(info->device, 1, &info->fences[info->frame_index], VK_TRUE, 1000000);
-	vkResetFences(info->device, 1, &info->fences[info->frame_index]);
+	render_frame_t *frame = &info->frames[info->frame_index];
+	timeline_wait(info, &info->graphic_timeline, frame->retire);
+	deferred_collect(info);
+
+	//Without update-after-bind, the commands recorded against the old descriptors are re-recorded
+	if (vulkan_flush_texture_slots(info, info->frame_index) && !info->descriptor_indexing)
+		for (uint32_t i = 0; i < info->swapchain_images_count; i++)
+			frame->recorded_versions[i] = UINT64_MAX;
 
 	VkResult res = vkAcquireNextImageKHR(info->device, info->swapchain, UINT64_MAX,
-																			 info->semaphore_acquired[info->frame_index],
-																			 info->fences[info->frame_index],
-																			 &info->current_buffer);
-	assert(res == VK_SUCCESS);
+															frame->acquired, VK_NULL_HANDLE, &info->current_buffer);
+	//The swapchain is never recreated: a suboptimal image is still presentable, an out of date one is fatal
+	if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR)
+		throw VkException(res);
+}
+
+//Images recorded against an older version are re-recorded when next acquired
+void render_invalidate(vulkan_frame_info_t *frame) {
+	frame->scene_version++;
+}
+
+//Records the slot's commands for the acquired image if needed, true when it did
+bool render_record_frame(vulkan_info_t *info, vulkan_frame_info_t *frame) {
+	render_frame_t *target = &info->frames[info->frame_index];
+	uint32_t image = info->current_buffer;
+	bool stale = target->commands[image] == VK_NULL_HANDLE
+		|| target->recorded_versions[image] != frame->scene_version;
+	if (frame->recording == RENDER_RECORDING_PREBAKED && !stale)
+		return false;
+
+	render_create_cmd(info, frame, info->frame_index, image);
+	return true;
 }
 
 void render_submit(vulkan_info_t *info, vulkan_frame_info_t *frame) {
+	render_frame_t *target = &info->frames[info->frame_index];
+	VkSemaphore rendered = info->swapchain_buffers[info->current_buffer].rendered;
 	VkResult res = VK_SUCCESS;
 
 	VkPipelineStageFlags pipe_stage_flags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
@@ -166,18 +468,15 @@ void render_submit(vulkan_info_t *info, vulkan_frame_info_t *frame) {
 	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	submit_info.pNext = NULL;
 	submit_info.waitSemaphoreCount = 1;
-	submit_info.pWaitSemaphores = &info->semaphore_acquired[info->frame_index];
+	submit_info.pWaitSemaphores = &target->acquired;
 	submit_info.pWaitDstStageMask = &pipe_stage_flags;
 	submit_info.commandBufferCount = 1;
-	submit_info.pCommandBuffers = &info->swapchain_buffers[info->current_buffer].command;
+	submit_info.pCommandBuffers = &target->commands[info->current_buffer];
 	submit_info.signalSemaphoreCount = 1;
-	submit_info.pSignalSemaphores = &info->semaphore_drawing[info->frame_index];
+	submit_info.pSignalSemaphores = &rendered;
 
-	vkWaitForFences(info->device, 1, &info->swapchain_buffers[info->current_buffer].fence, VK_TRUE, 1000000);
-	vkResetFences(info->device, 1, &info->swapchain_buffers[info->current_buffer].fence);
-
-	res = vkQueueSubmit(info->graphic_queue, 1, &submit_info, info->swapchain_buffers[info->current_buffer].fence);
-	assert(res == VK_SUCCESS);
+	target->retire = timeline_submit(info, &info->graphic_timeline, &submit_info);
+	deferred_seal(info, target->retire);
 
 	VkPresentInfoKHR present;
 	present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -186,23 +485,32 @@ void render_submit(vulkan_info_t *info, vulkan_frame_info_t *frame) {
 	present.pSwapchains = &info->swapchain;
 	present.pImageIndices = &info->current_buffer;
 	present.waitSemaphoreCount = 1;
-	present.pWaitSemaphores = &info->semaphore_drawing[info->frame_index];
+	present.pWaitSemaphores = &rendered;
 	present.pResults = NULL;
 	res = vkQueuePresentKHR(info->present_queue, &present);
-	assert(res == VK_SUCCESS);
+	if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR && res != VK_ERROR_OUT_OF_DATE_KHR)
+		throw VkException(res);
 
-	info->frame_index = (info->frame_index + 1) % info->swapchain_images_count;
+	info->frame_index = (info->frame_index + 1) % info->frames_in_flight;
 }
 
 void render_destroy(vulkan_info_t *info, vulkan_frame_info_t *frame) {
-	vkWaitForFences(info->device, info->swapchain_images_count, info->fences, VK_TRUE, UINT64_MAX);
-	for (uint32_t i = 0; i < info->swapchain_images_count; i++) {
-		vkDestroyFence(info->device, info->fences[i], NULL);
-		vkDestroyFence(info->device, info->swapchain_buffers[i].fence, NULL);
-		vkFreeCommandBuffers(info->device, info->cmd_pool, 1, &info->swapchain_buffers[i].command);
-
-		vkDestroySemaphore(info->device, info->semaphore_acquired[i], NULL);
-		vkDestroySemaphore(info->device, info->semaphore_drawing[i], NULL);
-		vkDestroySemaphore(info->device, info->semaphore_ownership[i], NULL);
+	for (uint32_t i = 0; i < info->frames_in_flight; i++) {
+		render_frame_t *target = &info->frames[i];
+		timeline_wait(info, &info->graphic_timeline, target->retire);
+		vkDestroySemaphore(info->device, target->acquired, NULL);
+
+		for (uint32_t j = 0; j < info->swapchain_images_count; j++)
+			if (target->commands[j] != VK_NULL_HANDLE)
+				vkFreeCommandBuffers(info->device, info->cmd_pool, 1, &target->commands[j]);
+		delete[] target->commands;
+		delete[] target->recorded_versions;
 	}
+	delete[] info->frames;
+	info->frames = NULL;
+
+	//Presentations may still hold them
+	vkQueueWaitIdle(info->present_queue);
+	for (uint32_t i = 0; i < info->swapchain_images_count; i++)
+		vkDestroySemaphore(info->device, info->swapchain_buffers[i].rendered, NULL);
 }
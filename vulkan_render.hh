@@ -1,14 +1,100 @@
 #pragma once
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <vulkan/vulkan.hpp>
 
 #include "types.hh"
 #include "vulkan.hh"
 
+struct render_draw_t {
+	data_buffer_t vertex_buffer;
+	data_buffer_t index_buffer;
+	uint32_t index_count;
+	data_buffer_t instance_buffer;
+	uint32_t instance_count;
+	uint32_t texture_index;
+	//Indirect commands the draw may issue, 0 takes 1. Set before creating the draw lists
+	uint32_t max_commands;
+	//Assigned with the draw lists: range of commands and index of the count
+	uint32_t first_command;
+	uint32_t count_index;
+};
+
+/*
+ * Indirect commands of one frame slot, persistently mapped. The recorded
+ * commands only reference the buffers: the draw list can be rewritten,
+ * by the CPU or a GPU pass, once the slot retired without any re-recording.
+ * With VK_KHR_draw_indirect_count each draw reads its count from the counts
+ * buffer, otherwise commands past the count are zeroed.
+ */
+struct render_draw_list_t {
+	data_buffer_t commands;
+	data_buffer_t counts;
+};
+
+//Below this many draws, waking the workers costs more than recording inline
+#define RENDER_PARALLEL_MIN_DRAWS (256)
+#define RENDER_MAX_WORKERS (8)
+
+struct vulkan_frame_info_t;
+
+/*
+ * Prebaked commands are recorded once per frame slot and swapchain image, and
+ * only re-recorded when the scene version moves: static scenes pay nothing
+ * per frame.
+ * Per-frame recording rebuilds the acquired image's commands every frame from
+ * the draw list, for scenes changing too often for the version to help.
+ */
+enum render_recording_e {
+	RENDER_RECORDING_PREBAKED,
+	RENDER_RECORDING_PER_FRAME
+};
+
+/*
+ * Recording threads, each owning a command pool per frame slot and swapchain
+ * image, so a pool is only reset once the slot's previous submission retired.
+ * Every worker records a secondary command buffer for a slice of the draw
+ * list, the primary executes them in order inside the render pass.
+ */
+struct render_workers_t {
+	uint32_t count;
+	//Frames in flight times swapchain images
+	uint32_t target_count;
+	std::vector<std::thread> threads;
+	//Indexed by worker * target_count + slot * swapchain_images_count + image
+	std::vector<VkCommandPool> pools;
+	std::vector<VkCommandBuffer> commands;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable finished;
+	uint64_t generation;
+	uint32_t pending;
+	bool quit;
+
+	//Recording job, valid while pending > 0
+	vulkan_info_t *info;
+	vulkan_frame_info_t *frame;
+	uint32_t slot;
+	uint32_t image;
+};
+
 struct vulkan_frame_info_t {
 	v3_t clear_color;
-	uint32_t vertex_count;
-	data_buffer_t vertex_buffer;
+	render_draw_t *draws;
+	uint32_t draw_count;
+	//One per frame slot, see render_draw_lists_create
+	render_draw_list_t *draw_lists;
+	uint32_t command_count;
+	//Null records every draw on the calling thread
+	render_workers_t *workers;
+	render_recording_e recording;
+	//Bumped by render_invalidate on any structural change: draws, buffers, descriptors
+	uint64_t scene_version;
 
 	VkCommandBuffer command;
 	//Vertex bindings are globals for now
@@ -17,7 +103,18 @@ struct vulkan_frame_info_t {
 
 void render_init_fences(vulkan_info_t *info);
 void render_create_transition_commands(vulkan_info_t *info, uint32_t i);
-void render_create_cmd(vulkan_info_t *info, vulkan_frame_info_t *frame, int i);
+void render_create_cmd(vulkan_info_t *info, vulkan_frame_info_t *frame, uint32_t slot, uint32_t image);
+void render_record_main_pass(render_graph_context_t *context);
 void render_get_frame(vulkan_info_t *info);
+void render_invalidate(vulkan_frame_info_t *frame);
+bool render_record_frame(vulkan_info_t *info, vulkan_frame_info_t *frame);
 void render_submit(vulkan_info_t *info, vulkan_frame_info_t *frame);
 void render_destroy(vulkan_info_t *info, vulkan_frame_info_t *frame);
+
+void render_draw_lists_create(vulkan_info_t *info, vulkan_frame_info_t *frame);
+void render_draw_lists_destroy(vulkan_info_t *info, vulkan_frame_info_t *frame);
+VkDrawIndexedIndirectCommand* render_draw_commands(vulkan_frame_info_t *frame, uint32_t slot, uint32_t draw);
+void render_set_draw_count(vulkan_info_t *info, vulkan_frame_info_t *frame, uint32_t slot, uint32_t draw, uint32_t count);
+
+void render_workers_create(vulkan_info_t *info, render_workers_t *workers, uint32_t count);
+void render_workers_destroy(vulkan_info_t *info, render_workers_t *workers);
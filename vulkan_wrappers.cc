@@ -1,19 +1,6 @@
 #include "vulkan_wrappers.hh"
 #include "vulkan_exception.hh"
 
-bool find_memory_type_index(vulkan_info_t *info, uint32_t type, VkFlags flags, uint32_t *res) {
-	for (uint32_t i = 0; i < info->memory_properties.memoryTypeCount; i++) {
-		if ((type & 1) == 1) {
-			if ((info->memory_properties.memoryTypes[i].propertyFlags & flags) == flags) {
-				*res = i;
-				return true;
-			}
-		}
-		type >>= 1;
-	}
-	assert(0 && "Unable to find the proper memory type");
-}
-
 uint32_t get_queue_family_index(VkQueueFlagBits bits, uint32_t count, VkQueueFamilyProperties *props) {
 	for (uint32_t i = 0; i < count ; i++) {
 		if (props[i].queueFlags & bits)
@@ -23,11 +10,41 @@ uint32_t get_queue_family_index(VkQueueFlagBits bits, uint32_t count, VkQueueFam
 	return (uint32_t)-1;
 }
 
-VkCommandBuffer create_command_buffer(vulkan_info_t *info) {
+bool has_instance_extension(const char *name) {
+	uint32_t count = 0;
+	VkResult res = vkEnumerateInstanceExtensionProperties(NULL, &count, NULL);
+	assert(res == VK_SUCCESS);
+
+	std::vector<VkExtensionProperties> props(count);
+	res = vkEnumerateInstanceExtensionProperties(NULL, &count, props.data());
+	assert(res == VK_SUCCESS);
+
+	for (uint32_t i = 0; i < count; i++)
+		if (strcmp(props[i].extensionName, name) == 0)
+			return true;
+	return false;
+}
+
+bool has_device_extension(vulkan_info_t *info, const char *name) {
+	uint32_t count = 0;
+	VkResult res = vkEnumerateDeviceExtensionProperties(info->physical_device, NULL, &count, NULL);
+	assert(res == VK_SUCCESS);
+
+	std::vector<VkExtensionProperties> props(count);
+	res = vkEnumerateDeviceExtensionProperties(info->physical_device, NULL, &count, props.data());
+	assert(res == VK_SUCCESS);
+
+	for (uint32_t i = 0; i < count; i++)
+		if (strcmp(props[i].extensionName, name) == 0)
+			return true;
+	return false;
+}
+
+VkCommandBuffer create_command_buffer(vulkan_info_t *info, VkCommandPool pool) {
 	VkCommandBufferAllocateInfo alloc_info = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
 		.pNext = NULL,
-		.commandPool = info->cmd_pool,
+		.commandPool = pool,
 		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
 		.commandBufferCount = 1,
 	};
@@ -40,42 +57,39 @@ VkCommandBuffer create_command_buffer(vulkan_info_t *info) {
 	return command;
 }
 
-VkCommandBuffer command_begin_disposable(vulkan_info_t *info) {
-	
-	VkCommandBuffer command = create_command_buffer(info);
-	VkCommandBufferBeginInfo begin_info = {};
-	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	begin_info.pNext = NULL;
-	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-	begin_info.pInheritanceInfo = NULL;
-
-	VkResult res = vkBeginCommandBuffer(command, &begin_info);
-	assert(res == VK_SUCCESS);
-	return command;
-}
-
-void command_submit_disposable(vulkan_info_t *info, VkCommandBuffer command) {
-	VkResult res = VK_SUCCESS;
-	res = vkEndCommandBuffer(command);
-	assert(res == VK_SUCCESS);
-
-	VkSubmitInfo submission = { };
-	submission.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submission.commandBufferCount = 1;
-	submission.pCommandBuffers = &command;
+void buffer_create(vulkan_info_t *info, VkDeviceSize size, VkBufferUsageFlags usage,
+									 memory_usage_e memory_usage, memory_category_e category, data_buffer_t *buffer) {
+	VkBufferCreateInfo buffer_info = {};
+	buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buffer_info.pNext = NULL;
+	buffer_info.flags = 0;
+	buffer_info.size = size;
+	buffer_info.usage = usage;
+	buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	buffer_info.queueFamilyIndexCount = 0;
+	buffer_info.pQueueFamilyIndices = NULL;
+
+	VkResult res = vkCreateBuffer(info->device, &buffer_info, NULL, &buffer->buffer);
+	if (res != VK_SUCCESS)
+		throw VkException(res);
 
-	res = vkQueueSubmit(info->graphic_queue, 1, &submission, VK_NULL_HANDLE);
-	assert(res == VK_SUCCESS);
+	memory_bind_buffer(info, buffer->buffer, memory_usage, category, &buffer->allocation);
 
-	res = vkQueueWaitIdle(info->graphic_queue);
-	assert(res == VK_SUCCESS);
+	buffer->descriptor.buffer = buffer->buffer;
+	buffer->descriptor.offset = 0;
+	buffer->descriptor.range = size;
+	buffer->usage = usage;
+}
 
-	vkFreeCommandBuffers(info->device, info->cmd_pool, 1, &command);
+void buffer_destroy(vulkan_info_t *info, data_buffer_t *buffer) {
+	vkDestroyBuffer(info->device, buffer->buffer, NULL);
+	memory_free(info, &buffer->allocation);
+	buffer->buffer = VK_NULL_HANDLE;
 }
 
 void image_create(vulkan_info_t *info, uint32_t w, uint32_t h,
-									VkImage *img, VkDeviceMemory *mem, VkDeviceSize *size,
-									VkFormat format, VkImageUsageFlags usage) {
+									VkImage *img, gpu_allocation_t *mem, VkDeviceSize *size,
+									VkFormat format, VkImageUsageFlags usage, memory_category_e category) {
 	VkResult res = VK_SUCCESS;
 	(void)res;
 
@@ -99,101 +113,40 @@ void image_create(vulkan_info_t *info, uint32_t w, uint32_t h,
 	res = vkCreateImage(info->device, &image_info, NULL, img);
 	assert(res == VK_SUCCESS && "Unable to create Image");
 
-	VkMemoryRequirements mem_reqs;
-	vkGetImageMemoryRequirements(info->device, *img, &mem_reqs);
+	memory_bind_image(info, *img, VK_IMAGE_TILING_LINEAR, MEMORY_USAGE_UPLOAD, category, mem);
+	*size = mem->size;
+}
 
-	VkMemoryAllocateInfo alloc_info = {};
-	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc_info.pNext = NULL;
-	alloc_info.memoryTypeIndex = 0;
-	alloc_info.allocationSize = mem_reqs.size;
-	*size = mem_reqs.size;
-	bool success = find_memory_type_index(info, mem_reqs.memoryTypeBits,
-										VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-										&alloc_info.memoryTypeIndex );
+void image_create_optimal(vulkan_info_t *info, uint32_t w, uint32_t h, uint32_t levels,
+													VkImage *img, gpu_allocation_t *mem, VkDeviceSize *size,
+													VkFormat format, VkImageUsageFlags usage, memory_category_e category) {
+	VkImageCreateInfo image_info = {};
+	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.pNext = NULL;
+	image_info.flags = 0;
+	image_info.imageType = VK_IMAGE_TYPE_2D;
+	image_info.extent.width = w;
+	image_info.extent.height = h;
+	image_info.extent.depth = 1;
+	image_info.mipLevels = levels;
+	image_info.arrayLayers = 1;
+	image_info.format = format;
+	image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	image_info.usage = usage;
+	image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_info.samples = VK_SAMPLE_COUNT_1_BIT;
 
-	assert(success);
-	res = vkAllocateMemory(info->device, &alloc_info, NULL, mem);
+	VkResult res = vkCreateImage(info->device, &image_info, NULL, img);
 	if (res != VK_SUCCESS)
 		throw VkException(res);
 
-	res = vkBindImageMemory(info->device, *img, *mem, 0);
-	assert(res == VK_SUCCESS && "Cannot bind memory");
-}
-
-static VkAccessFlags get_access_flag_from_old_layout(VkImageLayout layout) {
-	switch (layout) {
-		case VK_IMAGE_LAYOUT_PREINITIALIZED:
-			return VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
-		case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-			return VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
-			return VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-		case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
-			return VK_ACCESS_TRANSFER_READ_BIT;
-		case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-			return VK_ACCESS_SHADER_READ_BIT;
-		case VK_IMAGE_LAYOUT_UNDEFINED:
-			return 0;
-		default:
-			assert(0 && "Unhandled old layout transition");
-			break;
-	}
-	assert(0 && "Unhandled layout transition");
-	return VK_ACCESS_MEMORY_READ_BIT;
-}
-
-static VkAccessFlags get_access_flag_from_new_layout(VkImageLayout layout) {
-	switch(layout) {
-		case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
-			return VK_ACCESS_TRANSFER_WRITE_BIT;
-		case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
-			return VK_ACCESS_TRANSFER_READ_BIT;
-		case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-			return VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
-			return VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-		case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-			return VK_ACCESS_SHADER_READ_BIT;
-		default:
-			assert(0 && "Unhandled new layout transition");
-			break;
-	}
-	assert(0 && "Unhandled layout transition");
-	return VK_ACCESS_MEMORY_READ_BIT;
-}
-
-void image_layout_transition(vulkan_info_t *info, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout) {
-	VkCommandBuffer command = command_begin_disposable(info);
-
-	VkImageMemoryBarrier barrier = { };
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.pNext = NULL;
-	barrier.srcAccessMask = get_access_flag_from_old_layout(old_layout);
-	barrier.dstAccessMask = get_access_flag_from_new_layout(new_layout);
-	barrier.oldLayout = old_layout;
-	barrier.newLayout = new_layout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-
-	vkCmdPipelineBarrier( command,
-		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-		0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-	command_submit_disposable(info, command);
+	memory_bind_image(info, *img, VK_IMAGE_TILING_OPTIMAL, MEMORY_USAGE_GPU_ONLY, category, mem);
+	*size = mem->size;
 }
 
-void image_copy(vulkan_info_t *info, VkImage src, VkImage dst, uint32_t width,
+void image_copy(VkCommandBuffer command, VkImage src, VkImage dst, uint32_t width,
 								uint32_t height) {
-	VkCommandBuffer command = command_begin_disposable(info);
-
 	VkImageSubresourceLayers subResource = { };
 	subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	subResource.baseArrayLayer = 0;
@@ -211,10 +164,10 @@ void image_copy(vulkan_info_t *info, VkImage src, VkImage dst, uint32_t width,
 
 	vkCmdCopyImage(command, src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
 								 dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-	command_submit_disposable(info, command);
 }
 
-void image_view_create(vulkan_info_t *info, VkImage image, VkFormat format, VkImageView *view) {
+void image_view_create(vulkan_info_t *info, VkImage image, VkFormat format, VkImageView *view,
+											 uint32_t levels) {
 	VkImageViewCreateInfo create_info = { };
 	create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 	create_info.pNext = NULL;
@@ -228,7 +181,7 @@ void image_view_create(vulkan_info_t *info, VkImage image, VkFormat format, VkIm
 	create_info.components.a = VK_COMPONENT_SWIZZLE_A;
 	create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	create_info.subresourceRange.baseMipLevel = 0;
-	create_info.subresourceRange.levelCount = 1;
+	create_info.subresourceRange.levelCount = levels;
 	create_info.subresourceRange.baseArrayLayer = 0;
 	create_info.subresourceRange.layerCount = 1;
 
@@ -237,6 +190,7 @@ void image_view_create(vulkan_info_t *info, VkImage image, VkFormat format, VkIm
 		throw VkException(res);
 }
 
+//Shared through the sampler cache, release with image_sampler_release
 void image_sampler_create(vulkan_info_t *info, VkSampler *sampler) {
 	VkSamplerCreateInfo sampler_info = { };
 	sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -254,10 +208,13 @@ void image_sampler_create(vulkan_info_t *info, VkSampler *sampler) {
 	sampler_info.compareEnable = VK_FALSE;
 	sampler_info.compareOp = VK_COMPARE_OP_ALWAYS;
 	sampler_info.minLod = 0.0f;
-	sampler_info.maxLod = 0.0f;
+	sampler_info.maxLod = VK_LOD_CLAMP_NONE;
 	sampler_info.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
 	sampler_info.unnormalizedCoordinates = VK_FALSE;
 
-	VkResult res = vkCreateSampler(info->device, &sampler_info, NULL, sampler);
-	assert(res == VK_SUCCESS);
+	*sampler = sampler_cache_acquire(info, &sampler_info);
+}
+
+void image_sampler_release(vulkan_info_t *info, VkSampler sampler) {
+	sampler_cache_release(info, sampler);
 }
@@ -2,20 +2,29 @@
 
 #include "vulkan.hh"
 
-bool find_memory_type_index(vulkan_info_t *info, uint32_t type, VkFlags flags, uint32_t *res);
 uint32_t get_queue_family_index(VkQueueFlagBits bits, uint32_t count, VkQueueFamilyProperties *props);
+bool has_instance_extension(const char *name);
+bool has_device_extension(vulkan_info_t *info, const char *name);
 
 /* Command buffers */
-VkCommandBuffer create_command_buffer(vulkan_info_t *info);
-VkCommandBuffer command_begin_disposable(vulkan_info_t *info);
-void command_submit_disposable(vulkan_info_t *info, VkCommandBuffer cmd);
+//From the graphic pool unless told otherwise
+VkCommandBuffer create_command_buffer(vulkan_info_t *info, VkCommandPool pool);
+
+/* Buffers */
+void buffer_create(vulkan_info_t *info, VkDeviceSize size, VkBufferUsageFlags usage,
+									 memory_usage_e memory_usage, memory_category_e category, data_buffer_t *buffer);
+void buffer_destroy(vulkan_info_t *info, data_buffer_t *buffer);
 
 /* Images */
-void image_layout_transition(vulkan_info_t *info, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout);
 void image_create(vulkan_info_t *info, uint32_t w, uint32_t h,
-									VkImage *img, VkDeviceMemory *mem, VkDeviceSize *size,
-									VkFormat format, VkImageUsageFlags usage);
-void image_copy(vulkan_info_t *info, VkImage src, VkImage dst, uint32_t width,
+									VkImage *img, gpu_allocation_t *mem, VkDeviceSize *size,
+									VkFormat format, VkImageUsageFlags usage, memory_category_e category);
+void image_create_optimal(vulkan_info_t *info, uint32_t w, uint32_t h, uint32_t levels,
+													VkImage *img, gpu_allocation_t *mem, VkDeviceSize *size,
+													VkFormat format, VkImageUsageFlags usage, memory_category_e category);
+void image_copy(VkCommandBuffer command, VkImage src, VkImage dst, uint32_t width,
 								uint32_t height);
-void image_view_create(vulkan_info_t *info, VkImage image, VkFormat format, VkImageView *view);
+void image_view_create(vulkan_info_t *info, VkImage image, VkFormat format, VkImageView *view,
+											 uint32_t levels = 1);
 void image_sampler_create(vulkan_info_t *info, VkSampler *sampler);
+void image_sampler_release(vulkan_info_t *info, VkSampler sampler);